@@ -15,6 +15,8 @@ public:
 	virtual std::string effect_type_id() const { return "AlphaDivisionEffect"; }
 	std::string output_fragment_shader();
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual bool is_mergeable() const { return true; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 };
 
 }  // namespace movit
@@ -0,0 +1,123 @@
+#include <epoxy/gl.h>
+#include <assert.h>
+#include <math.h>
+
+#include "baked_lut_effect.h"
+#include "effect_chain.h"
+#include "effect_util.h"
+#include "flat_input.h"
+#include "resource_pool.h"
+#include "trace.h"
+#include "util.h"
+
+using namespace std;
+
+namespace movit {
+
+BakedLUTEffect::BakedLUTEffect(unsigned lut_size, const ImageFormat &input_format, ResourcePool *resource_pool)
+	: lut_size(lut_size),
+	  resource_pool(resource_pool),
+	  lut_texnum(0)
+{
+	assert(lut_size >= 2);
+
+	// Lay out the slices in a roughly square grid, so that we do not
+	// run into the texture size limits for the larger LUTs.
+	lut_columns = lrintf(ceil(sqrt(double(lut_size))));
+	lut_rows = (lut_size + lut_columns - 1) / lut_columns;
+	texture_width = lut_columns * lut_size;
+	texture_height = lut_rows * lut_size;
+
+	lattice.resize(texture_width * texture_height * 3);
+	for (unsigned b = 0; b < lut_size; ++b) {
+		unsigned x0 = (b % lut_columns) * lut_size;
+		unsigned y0 = (b / lut_columns) * lut_size;
+		for (unsigned g = 0; g < lut_size; ++g) {
+			for (unsigned r = 0; r < lut_size; ++r) {
+				float *rgb = &lattice[((y0 + g) * texture_width + x0 + r) * 3];
+				rgb[0] = float(r) / (lut_size - 1);
+				rgb[1] = float(g) / (lut_size - 1);
+				rgb[2] = float(b) / (lut_size - 1);
+			}
+		}
+	}
+
+	// Top-left origin, so that row y of the lattice becomes row y of the LUT.
+	bake_chain = new EffectChain(texture_width, texture_height, resource_pool);
+	bake_chain->set_output_origin(OUTPUT_ORIGIN_TOP_LEFT);
+	FlatInput *input = new FlatInput(input_format, FORMAT_RGB, GL_FLOAT, texture_width, texture_height);
+	input->set_pixel_data(&lattice[0]);
+	bake_chain->add_input(input);
+
+	register_uniform_sampler2d("lut_tex", &uniform_lut_tex);
+	register_uniform_float("lut_size", &uniform_lut_size);
+	register_uniform_float("lut_columns", &uniform_lut_columns);
+	register_uniform_vec2("inv_lut_texture_size", uniform_inv_lut_texture_size);
+}
+
+BakedLUTEffect::~BakedLUTEffect()
+{
+	delete bake_chain;
+	if (lut_texnum != 0) {
+		resource_pool->release_2d_texture(lut_texnum);
+	}
+}
+
+string BakedLUTEffect::output_fragment_shader()
+{
+	return read_file("baked_lut_effect.frag");
+}
+
+void BakedLUTEffect::update_lut()
+{
+	bool changed = (lut_texnum == 0);
+	baked_generations.resize(effects.size());
+	for (unsigned i = 0; i < effects.size(); ++i) {
+		if (effects[i]->get_generation() != baked_generations[i]) {
+			baked_generations[i] = effects[i]->get_generation();
+			changed = true;
+		}
+	}
+	if (!changed) {
+		return;
+	}
+
+	TraceScope trace("frame", "BakedLUTEffect::update_lut");
+	if (lut_texnum == 0) {
+		lut_texnum = resource_pool->create_2d_texture(GL_RGBA16F, texture_width, texture_height);
+	}
+	GLuint fbo = resource_pool->create_fbo(lut_texnum);
+	bake_chain->render_to_fbo(fbo, texture_width, texture_height);
+	resource_pool->release_fbo(fbo);
+
+	// Our output has changed without any of our own parameters changing.
+	bump_generation();
+}
+
+void BakedLUTEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+	assert(lut_texnum != 0);
+
+	glActiveTexture(GL_TEXTURE0 + *sampler_num);
+	check_error();
+	glBindTexture(GL_TEXTURE_2D, lut_texnum);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	check_error();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	check_error();
+	uniform_lut_tex = *sampler_num;
+	++*sampler_num;
+
+	uniform_lut_size = lut_size;
+	uniform_lut_columns = lut_columns;
+	uniform_inv_lut_texture_size[0] = 1.0f / texture_width;
+	uniform_inv_lut_texture_size[1] = 1.0f / texture_height;
+}
+
+}  // namespace movit
@@ -0,0 +1,26 @@
+// Implicit uniforms:
+// uniform sampler2D PREFIX(lut_tex);
+// uniform float PREFIX(lut_size), PREFIX(lut_columns);
+// uniform vec2 PREFIX(inv_lut_texture_size);
+
+vec4 FUNCNAME(vec2 tc) {
+	vec4 x = INPUT(tc);
+
+	// Lattice coordinates, from 0 to lut_size - 1 in each direction.
+	vec3 pos = clamp(x.rgb, 0.0, 1.0) * (PREFIX(lut_size) - 1.0);
+
+	// Red and green are interpolated by the hardware within each slice;
+	// we then interpolate between the two nearest slices along blue.
+	// The +0.5 is to avoid rounding errors in the division.
+	float slice0 = min(floor(pos.b), PREFIX(lut_size) - 2.0);
+	float slice1 = slice0 + 1.0;
+	float row0 = floor((slice0 + 0.5) / PREFIX(lut_columns));
+	float row1 = floor((slice1 + 0.5) / PREFIX(lut_columns));
+	vec2 origin0 = vec2(slice0 - row0 * PREFIX(lut_columns), row0) * PREFIX(lut_size);
+	vec2 origin1 = vec2(slice1 - row1 * PREFIX(lut_columns), row1) * PREFIX(lut_size);
+	vec3 y0 = tex2D(PREFIX(lut_tex), (origin0 + pos.rg + 0.5) * PREFIX(inv_lut_texture_size)).rgb;
+	vec3 y1 = tex2D(PREFIX(lut_tex), (origin1 + pos.rg + 0.5) * PREFIX(inv_lut_texture_size)).rgb;
+	x.rgb = mix(y0, y1, pos.b - slice0);
+
+	return x;
+}
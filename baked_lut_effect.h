@@ -0,0 +1,90 @@
+#ifndef _MOVIT_BAKED_LUT_EFFECT_H
+#define _MOVIT_BAKED_LUT_EFFECT_H 1
+
+// A run of pointwise effects (see Effect::is_pointwise()), such as gamma
+// conversions, lift/gamma/gain and white balance, replaced by a lookup
+// into a 3D LUT. This is inserted by EffectChain::finalize() if the user
+// has asked for it with EffectChain::set_lut_baking().
+//
+// The LUT is computed on the GPU, by running the original effects
+// (in an EffectChain of their own) on a lattice of lut_size³ colors
+// spanning [0,1] in each channel, and is recomputed whenever any of their
+// parameters change. The lookup is trilinear; the lattice is stored
+// in a 2D texture as lut_size slices (one per blue value) in a grid,
+// so it costs two bilinear texture lookups per pixel.
+//
+// This is an approximation: Input values outside [0,1] are clamped,
+// and the error from interpolation depends on how curved the
+// original transformation is (the gamma curves are, near black).
+// It only pays off if the original effects are expensive; in particular,
+// single matrix multiplications are better left to ColorMatrixEffect.
+// Only runs with blank alpha are baked, so that the output only depends
+// on the input RGB.
+
+#include <epoxy/gl.h>
+#include <string>
+#include <vector>
+
+#include "effect.h"
+#include "image_format.h"
+
+namespace movit {
+
+class EffectChain;
+class ResourcePool;
+
+class BakedLUTEffect : public Effect {
+private:
+	// Should not be instantiated by end users; call
+	// EffectChain::set_lut_baking() instead. The input values to the
+	// LUT are in <input_format>. EffectChain adds the effects to
+	// bake_chain and finalizes it afterwards.
+	BakedLUTEffect(unsigned lut_size, const ImageFormat &input_format, ResourcePool *resource_pool);
+	friend class EffectChain;
+
+public:
+	~BakedLUTEffect();
+	virtual std::string effect_type_id() const { return "BakedLUTEffect"; }
+	std::string output_fragment_shader();
+
+	virtual bool needs_srgb_primaries() const { return false; }
+	virtual AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
+	virtual bool one_to_one_sampling() const { return true; }
+	virtual bool is_pointwise() const { return true; }
+	virtual unsigned estimated_alu_ops() const { return 12; }
+	virtual unsigned estimated_texture_fetches() const { return 2; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
+
+	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
+
+	// Recompute the LUT if it does not exist yet, or if any of the
+	// baked effects have changed since last time. Called by EffectChain
+	// at the start of every frame, since it needs to render.
+	void update_lut();
+
+	const std::vector<Effect *> &get_baked_effects() const { return effects; }
+
+private:
+	unsigned lut_size;
+	unsigned lut_columns, lut_rows;  // The grid of slices.
+	unsigned texture_width, texture_height;
+	ResourcePool *resource_pool;
+
+	// The lattice colors; the input to bake_chain.
+	std::vector<float> lattice;
+
+	// Owns the baked effects.
+	EffectChain *bake_chain;
+	std::vector<Effect *> effects;
+	std::vector<unsigned> baked_generations;
+
+	GLuint lut_texnum;  // 0 if not baked yet.
+
+	GLint uniform_lut_tex;
+	float uniform_lut_size, uniform_lut_columns;
+	float uniform_inv_lut_texture_size[2];
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_BAKED_LUT_EFFECT_H)
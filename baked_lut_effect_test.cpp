@@ -0,0 +1,114 @@
+// Unit tests for BakedLUTEffect, ie., the baking of runs of pointwise
+// effects into a 3D LUT. Since the LUT is an approximation, we compare
+// against the same chain without baking, with somewhat looser limits
+// than usual.
+
+#include <epoxy/gl.h>
+
+#include "effect_chain.h"
+#include "gtest/gtest.h"
+#include "image_format.h"
+#include "lift_gamma_gain_effect.h"
+#include "saturation_effect.h"
+#include "test_util.h"
+
+namespace movit {
+
+namespace {
+
+const unsigned width = 8, height = 8;
+
+// Deterministic pseudorandom colors, in the same spirit as the dither.
+void fill_with_random_colors(float *data, unsigned num_values)
+{
+	unsigned seed = 1234;
+	for (unsigned i = 0; i < num_values; ++i) {
+		seed = (seed * 1103515245U + 12345U) & ((1U << 31) - 1);
+		data[i] = seed * (1.0f / (1U << 31));
+	}
+}
+
+// A typical color correction chain, from and to sRGB, so that there are
+// gamma conversions on both sides. Returns the LiftGammaGainEffect.
+Effect *add_color_correction(EffectChain *chain)
+{
+	const float lift[] = { 0.02f, 0.0f, 0.01f };
+	const float gamma[] = { 1.1f, 1.0f, 0.9f };
+	const float gain[] = { 0.9f, 1.0f, 1.05f };
+	Effect *lgg_effect = chain->add_effect(new LiftGammaGainEffect());
+	EXPECT_TRUE(lgg_effect->set_vec3("lift", lift));
+	EXPECT_TRUE(lgg_effect->set_vec3("gamma", gamma));
+	EXPECT_TRUE(lgg_effect->set_vec3("gain", gain));
+	Effect *saturation_effect = chain->add_effect(new SaturationEffect());
+	EXPECT_TRUE(saturation_effect->set_float("saturation", 0.8f));
+	return lgg_effect;
+}
+
+}  // namespace
+
+TEST(BakedLUTEffectTest, MatchesUnbakedChain) {
+	float data[width * height * 3];
+	fill_with_random_colors(data, width * height * 3);
+	float expected_data[width * height * 4], out_data[width * height * 4];
+
+	EffectChainTester reference_tester(data, width, height, FORMAT_RGB, COLORSPACE_sRGB, GAMMA_sRGB);
+	add_color_correction(reference_tester.get_chain());
+	reference_tester.run(expected_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+	// The error is largest near black, where the gamma curves are steep.
+	EffectChainTester tester(data, width, height, FORMAT_RGB, COLORSPACE_sRGB, GAMMA_sRGB);
+	tester.get_chain()->set_lut_baking(33);
+	Effect *lgg_effect = add_color_correction(tester.get_chain());
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+	expect_equal(expected_data, out_data, width * 4, height, 5.0 / 255.0, 1.0 / 255.0);
+
+	// The effect is now owned by the LUT's own chain.
+	EXPECT_TRUE(tester.get_chain()->find_node_for_effect(lgg_effect) == NULL);
+}
+
+TEST(BakedLUTEffectTest, ParametersCanChangeAfterFinalize) {
+	float data[width * height * 3];
+	fill_with_random_colors(data, width * height * 3);
+	float expected_data[width * height * 4], out_data[width * height * 4];
+	const float gain[] = { 0.5f, 0.7f, 0.6f };
+
+	EffectChainTester reference_tester(data, width, height, FORMAT_RGB, COLORSPACE_sRGB, GAMMA_sRGB);
+	Effect *reference_lgg_effect = add_color_correction(reference_tester.get_chain());
+	ASSERT_TRUE(reference_lgg_effect->set_vec3("gain", gain));
+	reference_tester.run(expected_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+	// Render once with the original parameters, so that the LUT
+	// has to be baked again for the new ones.
+	EffectChainTester tester(data, width, height, FORMAT_RGB, COLORSPACE_sRGB, GAMMA_sRGB);
+	tester.get_chain()->set_lut_baking(33);
+	Effect *lgg_effect = add_color_correction(tester.get_chain());
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	ASSERT_TRUE(lgg_effect->set_vec3("gain", gain));
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+	expect_equal(expected_data, out_data, width * 4, height, 5.0 / 255.0, 1.0 / 255.0);
+}
+
+TEST(BakedLUTEffectTest, EffectsWithAlphaAreNotBaked) {
+	float data[width * height * 4];
+	fill_with_random_colors(data, width * height * 4);
+	float expected_data[width * height * 4], out_data[width * height * 4];
+
+	EffectChainTester reference_tester(data, width, height, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+	add_color_correction(reference_tester.get_chain());
+	reference_tester.run(expected_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+	EffectChainTester tester(data, width, height, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+	tester.get_chain()->set_lut_baking(33);
+	Effect *lgg_effect = add_color_correction(tester.get_chain());
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+
+	// Exactly the same shaders, so exactly the same result.
+	expect_equal(expected_data, out_data, width * 4, height, 1e-6, 1e-7);
+	Node *node = tester.get_chain()->find_node_for_effect(lgg_effect);
+	ASSERT_TRUE(node != NULL);
+	EXPECT_FALSE(node->disabled);
+}
+
+}  // namespace movit
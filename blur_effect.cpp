@@ -7,6 +7,7 @@
 #include "effect_chain.h"
 #include "effect_util.h"
 #include "init.h"
+#include "trace.h"
 #include "util.h"
 
 using namespace std;
@@ -19,6 +20,9 @@ BlurEffect::BlurEffect()
 	  input_width(1280),
 	  input_height(720)
 {
+	register_int("num_taps", &num_taps);
+	register_float("radius", &radius);
+
 	// The first blur pass will forward resolution information to us.
 	hpass = new SingleBlurPassEffect(this);
 	CHECK(hpass->set_int("direction", SingleBlurPassEffect::HORIZONTAL));
@@ -83,25 +87,13 @@ void BlurEffect::update_radius()
 	assert(ok);
 }
 
-bool BlurEffect::set_float(const string &key, float value) {
-	if (key == "radius") {
-		radius = value;
-		update_radius();
-		return true;
-	}
-	return false;
-}
-
-bool BlurEffect::set_int(const string &key, int value) {
-	if (key == "num_taps") {
-		if (value < 2 || value % 2 != 0) {
-			return false;
-		}
-		num_taps = value;
-		update_radius();
-		return true;
+bool BlurEffect::parameter_changed(const void *param)
+{
+	if (param == &num_taps && (num_taps < 2 || num_taps % 2 != 0)) {
+		return false;
 	}
-	return false;
+	update_radius();
+	return true;
 }
 
 SingleBlurPassEffect::SingleBlurPassEffect(BlurEffect *parent)
@@ -137,9 +129,9 @@ string SingleBlurPassEffect::output_fragment_shader()
 	return buf + read_file("blur_effect.frag");
 }
 
-void SingleBlurPassEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+void calculate_blur_samples(float radius, int num_taps, int size, float *samples)
 {
-	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+	TraceScope trace("weights", "SingleBlurPassEffect weights");
 
 	// Compute the weights; they will be symmetrical, so we only compute
 	// the right side.
@@ -187,17 +179,9 @@ void SingleBlurPassEffect::set_gl_state(GLuint glsl_program_num, const string &p
 	// in (x,y), and the weight in z. w is unused.
 
 	// Center sample.
-	uniform_samples[2 * 0 + 0] = 0.0f;
-	uniform_samples[2 * 0 + 1] = weight[0];
+	samples[2 * 0 + 0] = 0.0f;
+	samples[2 * 0 + 1] = weight[0];
 
-	int size;
-	if (direction == HORIZONTAL) {
-		size = width;
-	} else if (direction == VERTICAL) {
-		size = height;
-	} else {
-		assert(false);
-	}
 	float num_subtexels = size / movit_texel_subpixel_precision;
 	float inv_num_subtexels = movit_texel_subpixel_precision / size;
 
@@ -212,15 +196,47 @@ void SingleBlurPassEffect::set_gl_state(GLuint glsl_program_num, const string &p
 		float pos, total_weight;
 		combine_two_samples(w1, w2, pos1, pos2, num_subtexels, inv_num_subtexels, &pos, &total_weight, NULL);
 
-		uniform_samples[2 * i + 0] = pos;
-		uniform_samples[2 * i + 1] = total_weight;
+		samples[2 * i + 0] = pos;
+		samples[2 * i + 1] = total_weight;
 	}
 
 	delete[] weight;
 }
 
+void SingleBlurPassEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+
+	int size;
+	if (direction == HORIZONTAL) {
+		size = width;
+	} else if (direction == VERTICAL) {
+		size = height;
+	} else {
+		assert(false);
+	}
+	calculate_blur_samples(radius, num_taps, size, uniform_samples);
+}
+
 void SingleBlurPassEffect::clear_gl_state()
 {
 }
 
+Region SingleBlurPassEffect::get_input_footprint(unsigned input_num, const Region &output_region) const
+{
+	// We sample up to num_taps texels out on either side (see set_gl_state()),
+	// plus one for the bilinear filtering.
+	Region input_region = output_region;
+	if (direction == HORIZONTAL) {
+		float margin = (num_taps + 1.0f) / width;
+		input_region.left -= margin;
+		input_region.right += margin;
+	} else {
+		float margin = (num_taps + 1.0f) / height;
+		input_region.bottom -= margin;
+		input_region.top += margin;
+	}
+	return input_region;
+}
+
 }  // namespace movit
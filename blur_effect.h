@@ -49,9 +49,10 @@ public:
 	}
 
 	virtual void rewrite_graph(EffectChain *graph, Node *self);
-	virtual bool set_float(const std::string &key, float value);
-	virtual bool set_int(const std::string &key, int value);
-	
+
+protected:
+	virtual bool parameter_changed(const void *param);
+
 private:
 	void update_radius();
 
@@ -84,6 +85,10 @@ public:
 	virtual bool changes_output_size() const { return true; }
 	virtual bool sets_virtual_output_size() const { return true; }
 	virtual bool one_to_one_sampling() const { return false; }  // Can sample outside the border.
+	virtual bool is_mergeable() const { return true; }
+	virtual unsigned estimated_alu_ops() const { return 2 * (num_taps / 2 + 1); }
+	virtual unsigned estimated_texture_fetches() const { return num_taps / 2 + 1; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const;
 
 	virtual void get_output_size(unsigned *width, unsigned *height, unsigned *virtual_width, unsigned *virtual_height) const {
 		*width = this->width;
@@ -106,6 +111,12 @@ private:
 	float *uniform_samples;
 };
 
+// Computes the sample positions and weights for one pass of a blur
+// with the given radius over <size> pixels, packed as <num_taps> / 2 + 1
+// (position, weight) pairs into <samples>, the way SingleBlurPassEffect
+// sends them to its shader. Needs no OpenGL context.
+void calculate_blur_samples(float radius, int num_taps, int size, float *samples);
+
 }  // namespace movit
 
 #endif // !defined(_MOVIT_BLUR_EFFECT_H)
@@ -79,6 +79,38 @@ TEST(BlurEffectTest, BlurTwoDotsSmallRadius) {
 	expect_equal(expected_data, out_data, size, size, 1e-3, 1e-5);
 }
 
+TEST(BlurEffectTest, RadiusThroughParamHandle) {
+	const float sigma = 3.0f;
+	const int size = 32;
+	const int x1 = 8;
+	const int y1 = 8;
+
+	float data[size * size], out_data[size * size], expected_data[size * size];
+	memset(data, 0, sizeof(data));
+	memset(expected_data, 0, sizeof(expected_data));
+
+	data[y1 * size + x1] = 1.0f;
+	add_blurred_point(expected_data, size, x1, y1, 1.0f, sigma);
+
+	EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *blur_effect = tester.get_chain()->add_effect(new BlurEffect());
+	ASSERT_TRUE(blur_effect->set_float("radius", 10.0f));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	// The handle must update the blur passes, just like set_float() does.
+	ParamHandle<float> radius = blur_effect->get_float_handle("radius");
+	ASSERT_TRUE(radius.is_valid());
+	ASSERT_TRUE(radius.set(sigma));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, size, size, 1e-3, 1e-5);
+
+	// Invalid values are rejected, also through handles.
+	ParamHandle<int> num_taps = blur_effect->get_int_handle("num_taps");
+	ASSERT_TRUE(num_taps.is_valid());
+	EXPECT_FALSE(num_taps.set(7));
+	EXPECT_FALSE(blur_effect->get_float_handle("nonexistent").is_valid());
+}
+
 TEST(BlurEffectTest, BlurTwoDotsLargeRadius) {
 	const float sigma = 20.0f;  // Large enough that we will begin scaling.
 	const int size = 256;
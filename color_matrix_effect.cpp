@@ -0,0 +1,55 @@
+#include <Eigen/Core>
+
+#include "color_matrix_effect.h"
+#include "util.h"
+
+using namespace Eigen;
+using namespace std;
+
+namespace movit {
+
+ColorMatrixEffect::ColorMatrixEffect(const vector<Effect *> &effects)
+	: effects(effects),
+	  folded_alpha_handling(DONT_CARE_ALPHA_TYPE),
+	  uniform_alpha_factor(1.0f)
+{
+	// The effects have all had their alpha fixed up already, so anything
+	// that is not DONT_CARE_ALPHA_TYPE will be getting premultiplied alpha,
+	// and so will the rest of the run.
+	for (unsigned i = 0; i < effects.size(); ++i) {
+		if (effects[i]->alpha_handling() != DONT_CARE_ALPHA_TYPE) {
+			folded_alpha_handling = INPUT_AND_OUTPUT_PREMULTIPLIED_ALPHA;
+		}
+	}
+	register_uniform_mat3("matrix", &uniform_matrix);
+	register_uniform_float("alpha_factor", &uniform_alpha_factor);
+}
+
+string ColorMatrixEffect::output_fragment_shader()
+{
+	return read_file("color_matrix_effect.frag");
+}
+
+void ColorMatrixEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	Effect::set_gl_state(glsl_program_num, prefix, sampler_num);
+	CHECK(get_color_matrix(&uniform_matrix, &uniform_alpha_factor));
+}
+
+bool ColorMatrixEffect::get_color_matrix(Matrix3d *matrix, float *alpha_factor) const
+{
+	*matrix = Matrix3d::Identity();
+	*alpha_factor = 1.0f;
+	for (unsigned i = 0; i < effects.size(); ++i) {
+		// Since we postmultiply the RGB column vector, later effects
+		// need to go on the left.
+		Matrix3d effect_matrix;
+		float effect_alpha_factor;
+		CHECK(effects[i]->get_color_matrix(&effect_matrix, &effect_alpha_factor));
+		*matrix = effect_matrix * *matrix;
+		*alpha_factor *= effect_alpha_factor;
+	}
+	return true;
+}
+
+}  // namespace movit
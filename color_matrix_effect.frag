@@ -0,0 +1,10 @@
+// Implicit uniforms:
+// uniform mat3 PREFIX(matrix);
+// uniform float PREFIX(alpha_factor);
+
+vec4 FUNCNAME(vec2 tc) {
+	vec4 x = INPUT(tc);
+	x.rgb = PREFIX(matrix) * x.rgb;
+	x.a *= PREFIX(alpha_factor);
+	return x;
+}
@@ -0,0 +1,51 @@
+#ifndef _MOVIT_COLOR_MATRIX_EFFECT_H
+#define _MOVIT_COLOR_MATRIX_EFFECT_H 1
+
+// A run of effects that are all linear transformations of each pixel
+// (see Effect::get_color_matrix()), such as white balance, saturation
+// and colorspace conversions, folded into a single matrix multiplication.
+// This is inserted by EffectChain::finalize() in place of the original
+// effects; the matrix is recomputed from their parameters every frame,
+// so changing them after finalize() works as usual.
+
+#include <epoxy/gl.h>
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+
+#include "effect.h"
+
+namespace movit {
+
+class ColorMatrixEffect : public Effect {
+private:
+	// Should not be instantiated by end users; <effects> are owned
+	// by the EffectChain, and are given in the order they are applied.
+	ColorMatrixEffect(const std::vector<Effect *> &effects);
+	friend class EffectChain;
+
+public:
+	virtual std::string effect_type_id() const { return "ColorMatrixEffect"; }
+	std::string output_fragment_shader();
+
+	virtual bool needs_srgb_primaries() const { return false; }
+	virtual AlphaHandling alpha_handling() const { return folded_alpha_handling; }
+	virtual bool one_to_one_sampling() const { return true; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
+
+	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
+	virtual bool get_color_matrix(Eigen::Matrix3d *matrix, float *alpha_factor) const;
+
+	const std::vector<Effect *> &get_folded_effects() const { return effects; }
+
+private:
+	std::vector<Effect *> effects;
+	AlphaHandling folded_alpha_handling;
+
+	Eigen::Matrix3d uniform_matrix;
+	float uniform_alpha_factor;
+};
+
+}  // namespace movit
+
+#endif // !defined(_MOVIT_COLOR_MATRIX_EFFECT_H)
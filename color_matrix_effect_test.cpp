@@ -0,0 +1,114 @@
+// Unit tests for ColorMatrixEffect, ie., the folding of adjacent
+// linear color effects into one.
+
+#include <epoxy/gl.h>
+
+#include "effect_chain.h"
+#include "gtest/gtest.h"
+#include "image_format.h"
+#include "multiply_effect.h"
+#include "saturation_effect.h"
+#include "test_util.h"
+#include "white_balance_effect.h"
+
+namespace movit {
+
+TEST(ColorMatrixEffectTest, SaturationAndMultiplyAreFolded) {
+	float data[] = {
+		1.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 1.0f,
+		0.5f, 0.5f, 0.5f,
+	};
+	float expected_data[] = {
+		0.5f * 0.2126f, 0.2126f, 1.5f * 0.2126f, 1.0f,
+		0.5f * 0.7152f, 0.7152f, 1.5f * 0.7152f, 1.0f,
+		0.5f * 0.0722f, 0.0722f, 1.5f * 0.0722f, 1.0f,
+		0.25f, 0.5f, 0.75f, 1.0f,
+	};
+	const float factor[] = { 0.5f, 1.0f, 1.5f, 1.0f };
+
+	float out_data[4 * 4];
+	EffectChainTester tester(data, 4, 1, FORMAT_RGB, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *saturation_effect = tester.get_chain()->add_effect(new SaturationEffect());
+	ASSERT_TRUE(saturation_effect->set_float("saturation", 0.0f));
+	Effect *multiply_effect = tester.get_chain()->add_effect(new MultiplyEffect());
+	ASSERT_TRUE(multiply_effect->set_vec4("factor", factor));
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(expected_data, out_data, 4, 4);
+	EXPECT_TRUE(tester.get_chain()->find_node_for_effect(saturation_effect)->disabled);
+	EXPECT_TRUE(tester.get_chain()->find_node_for_effect(multiply_effect)->disabled);
+}
+
+TEST(ColorMatrixEffectTest, ParametersCanChangeAfterFinalize) {
+	float data[] = {
+		1.0f, 0.0f, 0.0f,
+		0.3f, 0.1f, 0.1f,
+	};
+	float expected_data[] = {
+		0.2126f, 0.2126f, 0.2126f,
+		0.1425f, 0.1425f, 0.1425f,
+	};
+	float out_data[2 * 3];
+	EffectChainTester tester(data, 2, 1, FORMAT_RGB, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *first = tester.get_chain()->add_effect(new SaturationEffect());
+	Effect *second = tester.get_chain()->add_effect(new SaturationEffect());
+	ASSERT_TRUE(first->set_float("saturation", 0.0f));
+	tester.run(out_data, GL_RGB, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, 3, 2);
+
+	// Undo the desaturation with the first effect;
+	// the second one still does nothing.
+	ASSERT_TRUE(first->set_float("saturation", 1.0f));
+	tester.run(out_data, GL_RGB, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, 3, 2);
+
+	// And then do it with the second one instead.
+	ASSERT_TRUE(second->set_float("saturation", 0.0f));
+	tester.run(out_data, GL_RGB, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, 3, 2);
+}
+
+TEST(ColorMatrixEffectTest, AlphaFactorsAreMultiplied) {
+	float data[] = {
+		1.0f, 0.5f, 0.25f, 1.0f,
+		0.2f, 0.2f, 0.2f, 0.5f,
+	};
+	float expected_data[] = {
+		0.25f, 0.125f, 0.0625f, 0.25f,
+		0.05f, 0.05f, 0.05f, 0.125f,
+	};
+	const float half[] = { 0.5f, 0.5f, 0.5f, 0.5f };
+
+	float out_data[2 * 4];
+	EffectChainTester tester(data, 2, 1, FORMAT_RGBA_PREMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *first = tester.get_chain()->add_effect(new MultiplyEffect());
+	Effect *second = tester.get_chain()->add_effect(new MultiplyEffect());
+	ASSERT_TRUE(first->set_vec4("factor", half));
+	ASSERT_TRUE(second->set_vec4("factor", half));
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+
+	expect_equal(expected_data, out_data, 4, 2);
+	EXPECT_TRUE(tester.get_chain()->find_node_for_effect(first)->disabled);
+}
+
+TEST(ColorMatrixEffectTest, ColorspaceConversionsAreFoldedToo) {
+	// WhiteBalanceEffect needs sRGB primaries, so this gets
+	// conversions inserted on both sides, which are all folded into one.
+	// The default white balance settings are a no-op.
+	float data[] = {
+		0.0f, 0.0f, 0.0f,
+		1.0f, 0.5f, 0.25f,
+		0.3f, 0.9f, 0.6f,
+	};
+	float out_data[3 * 3];
+	EffectChainTester tester(data, 3, 1, FORMAT_RGB, COLORSPACE_REC_601_525, GAMMA_LINEAR);
+	Effect *white_balance_effect = tester.get_chain()->add_effect(new WhiteBalanceEffect());
+	tester.run(out_data, GL_RGB, COLORSPACE_REC_601_525, GAMMA_LINEAR);
+
+	expect_equal(data, out_data, 3, 3, 1e-3, 1e-4);
+	EXPECT_TRUE(tester.get_chain()->find_node_for_effect(white_balance_effect)->disabled);
+}
+
+}  // namespace movit
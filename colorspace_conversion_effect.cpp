@@ -129,7 +129,7 @@ Matrix3d ColorspaceConversionEffect::get_xyz_matrix(Colorspace space)
 	return m;
 }
 
-string ColorspaceConversionEffect::output_fragment_shader()
+Matrix3d ColorspaceConversionEffect::get_conversion_matrix() const
 {
 	// Create a matrix to convert from source space -> XYZ,
 	// another matrix to convert from XYZ -> destination space,
@@ -139,10 +139,20 @@ string ColorspaceConversionEffect::output_fragment_shader()
 	// concatenation order needs to be the opposite of the operation order.
 	Matrix3d source_space_to_xyz = get_xyz_matrix(source_space);
 	Matrix3d xyz_to_destination_space = get_xyz_matrix(destination_space).inverse();
-	Matrix3d m = xyz_to_destination_space * source_space_to_xyz;
+	return xyz_to_destination_space * source_space_to_xyz;
+}
 
-	return output_glsl_mat3("PREFIX(conversion_matrix)", m) +
+string ColorspaceConversionEffect::output_fragment_shader()
+{
+	return output_glsl_mat3("PREFIX(conversion_matrix)", get_conversion_matrix()) +
 		read_file("colorspace_conversion_effect.frag");
 }
 
+bool ColorspaceConversionEffect::get_color_matrix(Matrix3d *matrix, float *alpha_factor) const
+{
+	*matrix = get_conversion_matrix();
+	*alpha_factor = 1.0f;
+	return true;
+}
+
 }  // namespace movit
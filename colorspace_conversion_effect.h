@@ -25,15 +25,22 @@ private:
 public:
 	virtual std::string effect_type_id() const { return "ColorspaceConversionEffect"; }
 	std::string output_fragment_shader();
+	virtual bool get_color_matrix(Eigen::Matrix3d *matrix, float *alpha_factor) const;
 
 	virtual bool needs_srgb_primaries() const { return false; }
 	virtual AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual bool is_pointwise() const { return true; }
+	virtual bool is_mergeable() const { return true; }
+	virtual unsigned estimated_alu_ops() const { return 9; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 
 	// Get a conversion matrix from the given color space to XYZ.
 	static Eigen::Matrix3d get_xyz_matrix(Colorspace space);
 
 private:
+	Eigen::Matrix3d get_conversion_matrix() const;
+
 	Colorspace source_space, destination_space;
 };
 
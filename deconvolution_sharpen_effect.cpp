@@ -254,7 +254,7 @@ MatrixXf central_convolve(const MatrixXf &a, const MatrixXf &b)
 
 }  // namespace
 
-void DeconvolutionSharpenEffect::update_deconvolution_kernel()
+MatrixXf compute_deconvolution_kernel(int R, float circle_radius, float gaussian_radius, float correlation, float noise)
 {
 	// Figure out the impulse response for the circular part of the blur.
 	MatrixXf circ_h(2 * R + 1, 2 * R + 1);
@@ -404,7 +404,7 @@ void DeconvolutionSharpenEffect::update_deconvolution_kernel()
 	assert(g_flattened.cols() == 1);
 
 	// Normalize and de-flatten the deconvolution matrix.
-	g = MatrixXf(R + 1, R + 1);
+	MatrixXf g(R + 1, R + 1);
 	sum = 0.0f;
 	for (int i = 0; i < g_flattened.rows(); ++i) {
 		int y = i / (R + 1);
@@ -422,7 +422,12 @@ void DeconvolutionSharpenEffect::update_deconvolution_kernel()
 		int x = i % (R + 1);
 		g(y, x) = g_flattened(i) / sum;
 	}
+	return g;
+}
 
+void DeconvolutionSharpenEffect::update_deconvolution_kernel()
+{
+	g = compute_deconvolution_kernel(R, circle_radius, gaussian_radius, correlation, noise);
 	last_circle_radius = circle_radius;
 	last_gaussian_radius = gaussian_radius;
 	last_correlation = correlation;
@@ -46,6 +46,14 @@ public:
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
 	virtual AlphaHandling alpha_handling() const { return INPUT_PREMULTIPLIED_ALPHA_KEEP_BLANK; }
 
+	// The kernel reaches R texels out in every direction.
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const
+	{
+		float margin_x = (R + 1.0f) / width, margin_y = (R + 1.0f) / height;
+		return Region(output_region.left - margin_x, output_region.bottom - margin_y,
+		              output_region.right + margin_x, output_region.top + margin_y);
+	}
+
 private:
 	// Input size.
 	unsigned width, height;
@@ -73,6 +81,12 @@ private:
 	void update_deconvolution_kernel();
 };
 
+// Solves for the (R + 1) x (R + 1) quadrant of the deconvolution kernel
+// for the given parameters (see DeconvolutionSharpenEffect above).
+// This is by far the most expensive part of changing the parameters,
+// and needs no OpenGL context.
+Eigen::MatrixXf compute_deconvolution_kernel(int R, float circle_radius, float gaussian_radius, float correlation, float noise);
+
 }  // namespace movit
 
 #endif // !defined(_MOVIT_DECONVOLUTION_SHARPEN_EFFECT_H)
@@ -47,6 +47,13 @@ bool DiffusionEffect::set_float(const string &key, float value) {
 	return blur->set_float(key, value);
 }
 
+ParamHandle<float> DiffusionEffect::get_float_handle(const string &key) {
+	if (key == "blurred_mix_amount") {
+		return overlay_matte->get_float_handle(key);
+	}
+	return blur->get_float_handle(key);
+}
+
 OverlayMatteEffect::OverlayMatteEffect()
 	: blurred_mix_amount(0.3f)
 {
@@ -33,6 +33,7 @@ public:
 
 	virtual void rewrite_graph(EffectChain *graph, Node *self);
 	virtual bool set_float(const std::string &key, float value);
+	virtual ParamHandle<float> get_float_handle(const std::string &key);
 	
 	virtual std::string output_fragment_shader() {
 		assert(false);
@@ -58,6 +59,7 @@ public:
 
 	unsigned num_inputs() const { return 2; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 
 private:
 	float blurred_mix_amount;
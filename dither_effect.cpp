@@ -55,17 +55,11 @@ string DitherEffect::output_fragment_shader()
 	return buf + read_file("dither_effect.frag");
 }
 
-void DitherEffect::update_texture(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+void generate_dither_noise(int width, int height, int num_bits,
+                           int texture_width, int texture_height, float *dither_noise)
 {
-	float *dither_noise = new float[width * height];
 	float dither_double_amplitude = 1.0f / (1 << num_bits);
 
-	// We don't need a strictly nonrepeating dither; reducing the resolution
-	// to max 128x128 saves a lot of texture bandwidth, without causing any
-	// noticeable harm to the dither's performance.
-	texture_width = min(width, 128);
-	texture_height = min(height, 128);
-
 	// Using the resolution as a seed gives us a consistent dither from frame to frame.
 	// It also gives a different dither for e.g. different aspect ratios, which _feels_
 	// good, but probably shouldn't matter.
@@ -75,6 +69,18 @@ void DitherEffect::update_texture(GLuint glsl_program_num, const string &prefix,
 		float normalized_rand = seed * (1.0f / (1U << 31)) - 0.5;  // [-0.5, 0.5>
 		dither_noise[i] = dither_double_amplitude * normalized_rand;
 	}
+}
+
+void DitherEffect::update_texture(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	// We don't need a strictly nonrepeating dither; reducing the resolution
+	// to max 128x128 saves a lot of texture bandwidth, without causing any
+	// noticeable harm to the dither's performance.
+	texture_width = min(width, 128);
+	texture_height = min(height, 128);
+
+	float *dither_noise = new float[texture_width * texture_height];
+	generate_dither_noise(width, height, num_bits, texture_width, texture_height, dither_noise);
 
 	glActiveTexture(GL_TEXTURE0 + *sampler_num);
 	check_error();
@@ -67,6 +67,7 @@ public:
 	// space as quantization, whether that be pre- or postmultiply.
 	virtual AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
 
@@ -83,6 +84,12 @@ private:
 	GLint uniform_dither_tex;
 };
 
+// Fills <dither_noise> (texture_width * texture_height floats) with the
+// deterministic noise DitherEffect uses for the given output size and
+// bit depth. Needs no OpenGL context.
+void generate_dither_noise(int width, int height, int num_bits,
+                           int texture_width, int texture_height, float *dither_noise);
+
 }  // namespace movit
 
 #endif // !defined(_MOVIT_DITHER_EFFECT_H)
@@ -1,5 +1,6 @@
 #include <epoxy/gl.h>
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <utility>
@@ -12,51 +13,227 @@ using namespace std;
 
 namespace movit {
 
-bool Effect::set_int(const string &key, int value)
+namespace {
+
+template<class T>
+bool same_parameters(const map<string, T *> &a, const map<string, T *> &b, unsigned num_values)
 {
-	if (params_int.count(key) == 0) {
+	if (a.size() != b.size()) {
 		return false;
 	}
-	*params_int[key] = value;
+	for (typename map<string, T *>::const_iterator a_it = a.begin(), b_it = b.begin();
+	     a_it != a.end();
+	     ++a_it, ++b_it) {
+		if (a_it->first != b_it->first ||
+		    memcmp(a_it->second, b_it->second, sizeof(T) * num_values) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template<class T>
+void add_keys(const map<string, T *> &params, set<string> *keys)
+{
+	for (typename map<string, T *>::const_iterator it = params.begin(); it != params.end(); ++it) {
+		keys->insert(it->first);
+	}
+}
+
+bool all_finite(const float *values, unsigned num_values)
+{
+	for (unsigned i = 0; i < num_values; ++i) {
+		if (!isfinite(values[i])) {
+			return false;
+		}
+	}
 	return true;
 }
 
+// Whether <param> belongs to one of the keys in <frozen_params>.
+bool is_frozen(const map<string, float *> &params, const set<string> &frozen_params, const float *param)
+{
+	for (map<string, float *>::const_iterator it = params.begin(); it != params.end(); ++it) {
+		if (it->second == param) {
+			return frozen_params.count(it->first) != 0;
+		}
+	}
+	return false;
+}
+
+}  // namespace
+
+bool Effect::set_int(const string &key, int value)
+{
+	map<string, int *>::const_iterator it = params_int.find(key);
+	if (it == params_int.end()) {
+		return false;
+	}
+	return update_parameter(it->second, &value, 1);
+}
+
 bool Effect::set_float(const string &key, float value)
 {
-	if (params_float.count(key) == 0) {
+	map<string, float *>::const_iterator it = params_float.find(key);
+	if (it == params_float.end()) {
 		return false;
 	}
-	*params_float[key] = value;
-	return true;
+	return update_parameter(it->second, &value, 1);
 }
 
 bool Effect::set_vec2(const string &key, const float *values)
 {
-	if (params_vec2.count(key) == 0) {
+	map<string, float *>::const_iterator it = params_vec2.find(key);
+	if (it == params_vec2.end()) {
 		return false;
 	}
-	memcpy(params_vec2[key], values, sizeof(float) * 2);
-	return true;
+	return update_parameter(it->second, values, 2);
 }
 
 bool Effect::set_vec3(const string &key, const float *values)
 {
-	if (params_vec3.count(key) == 0) {
+	map<string, float *>::const_iterator it = params_vec3.find(key);
+	if (it == params_vec3.end()) {
 		return false;
 	}
-	memcpy(params_vec3[key], values, sizeof(float) * 3);
-	return true;
+	return update_parameter(it->second, values, 3);
 }
 
 bool Effect::set_vec4(const string &key, const float *values)
 {
-	if (params_vec4.count(key) == 0) {
+	map<string, float *>::const_iterator it = params_vec4.find(key);
+	if (it == params_vec4.end()) {
+		return false;
+	}
+	return update_parameter(it->second, values, 4);
+}
+
+template<class T>
+bool Effect::update_values(T *param, const T *values, unsigned num_values)
+{
+	if (memcmp(param, values, sizeof(T) * num_values) == 0) {
+		return true;
+	}
+	T old_values[4];
+	assert(num_values <= 4);
+	memcpy(old_values, param, sizeof(T) * num_values);
+	memcpy(param, values, sizeof(T) * num_values);
+	if (!parameter_changed(param)) {
+		memcpy(param, old_values, sizeof(T) * num_values);
 		return false;
 	}
-	memcpy(params_vec4[key], values, sizeof(float) * 4);
+	bump_generation();
 	return true;
 }
 
+template<class T>
+ParamHandle<T> Effect::find_handle(const map<string, T *> &params, const string &key, unsigned num_values)
+{
+	typename map<string, T *>::const_iterator it = params.find(key);
+	if (it == params.end()) {
+		return ParamHandle<T>();
+	}
+	return ParamHandle<T>(this, it->second, num_values);
+}
+
+bool Effect::update_parameter(int *param, const int *values, unsigned num_values)
+{
+	return update_values(param, values, num_values);
+}
+
+bool Effect::update_parameter(float *param, const float *values, unsigned num_values)
+{
+	// Frozen parameters end up as constants in the shader source,
+	// where infinities and NaNs cannot be expressed.
+	if (!all_finite(values, num_values) &&
+	    (is_frozen(params_float, frozen_params, param) ||
+	     is_frozen(params_vec2, frozen_params, param) ||
+	     is_frozen(params_vec3, frozen_params, param) ||
+	     is_frozen(params_vec4, frozen_params, param))) {
+		return false;
+	}
+	return update_values(param, values, num_values);
+}
+
+ParamHandle<int> Effect::get_int_handle(const string &key)
+{
+	return find_handle(params_int, key, 1);
+}
+
+ParamHandle<float> Effect::get_float_handle(const string &key)
+{
+	return find_handle(params_float, key, 1);
+}
+
+ParamHandle<float> Effect::get_vec2_handle(const string &key)
+{
+	return find_handle(params_vec2, key, 2);
+}
+
+ParamHandle<float> Effect::get_vec3_handle(const string &key)
+{
+	return find_handle(params_vec3, key, 3);
+}
+
+ParamHandle<float> Effect::get_vec4_handle(const string &key)
+{
+	return find_handle(params_vec4, key, 4);
+}
+
+bool Effect::has_same_parameters(const Effect *other) const
+{
+	return same_parameters(params_int, other->params_int, 1) &&
+	       same_parameters(params_float, other->params_float, 1) &&
+	       same_parameters(params_vec2, other->params_vec2, 2) &&
+	       same_parameters(params_vec3, other->params_vec3, 3) &&
+	       same_parameters(params_vec4, other->params_vec4, 4);
+}
+
+bool Effect::parameter_is_finite(const string &key)
+{
+	if (params_float.count(key) != 0) {
+		return all_finite(params_float[key], 1);
+	} else if (params_vec2.count(key) != 0) {
+		return all_finite(params_vec2[key], 2);
+	} else if (params_vec3.count(key) != 0) {
+		return all_finite(params_vec3[key], 3);
+	} else if (params_vec4.count(key) != 0) {
+		return all_finite(params_vec4[key], 4);
+	}
+	return true;
+}
+
+bool Effect::freeze_parameter(const string &key)
+{
+	if (params_int.count(key) == 0 &&
+	    params_float.count(key) == 0 &&
+	    params_vec2.count(key) == 0 &&
+	    params_vec3.count(key) == 0 &&
+	    params_vec4.count(key) == 0) {
+		return false;
+	}
+	if (!parameter_is_finite(key)) {
+		return false;
+	}
+	frozen_params.insert(key);
+	return true;
+}
+
+void Effect::freeze_all_parameters()
+{
+	set<string> keys;
+	add_keys(params_int, &keys);
+	add_keys(params_float, &keys);
+	add_keys(params_vec2, &keys);
+	add_keys(params_vec3, &keys);
+	add_keys(params_vec4, &keys);
+	for (set<string>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+		if (parameter_is_finite(*it)) {
+			frozen_params.insert(*it);
+		}
+	}
+}
+
 void Effect::register_int(const string &key, int *value)
 {
 	assert(params_int.count(key) == 0);
@@ -103,6 +280,7 @@ void Effect::register_uniform_sampler2d(const std::string &key, const GLint *val
 	uniform.value = value;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_sampler2d.push_back(uniform);
 }
 
@@ -113,6 +291,7 @@ void Effect::register_uniform_bool(const std::string &key, const bool *value)
 	uniform.value = value;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_bool.push_back(uniform);
 }
 
@@ -123,6 +302,7 @@ void Effect::register_uniform_int(const std::string &key, const int *value)
 	uniform.value = value;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_int.push_back(uniform);
 }
 
@@ -133,6 +313,7 @@ void Effect::register_uniform_float(const std::string &key, const float *value)
 	uniform.value = value;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_float.push_back(uniform);
 }
 
@@ -143,6 +324,7 @@ void Effect::register_uniform_vec2(const std::string &key, const float *values)
 	uniform.value = values;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_vec2.push_back(uniform);
 }
 
@@ -153,6 +335,7 @@ void Effect::register_uniform_vec3(const std::string &key, const float *values)
 	uniform.value = values;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_vec3.push_back(uniform);
 }
 
@@ -163,6 +346,7 @@ void Effect::register_uniform_vec4(const std::string &key, const float *values)
 	uniform.value = values;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_vec4.push_back(uniform);
 }
 
@@ -173,6 +357,7 @@ void Effect::register_uniform_float_array(const std::string &key, const float *v
 	uniform.value = values;
 	uniform.num_values = num_values;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_float_array.push_back(uniform);
 }
 
@@ -183,6 +368,7 @@ void Effect::register_uniform_vec2_array(const std::string &key, const float *va
 	uniform.value = values;
 	uniform.num_values = num_values;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_vec2_array.push_back(uniform);
 }
 
@@ -193,6 +379,7 @@ void Effect::register_uniform_vec3_array(const std::string &key, const float *va
 	uniform.value = values;
 	uniform.num_values = num_values;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_vec3_array.push_back(uniform);
 }
 
@@ -203,6 +390,7 @@ void Effect::register_uniform_vec4_array(const std::string &key, const float *va
 	uniform.value = values;
 	uniform.num_values = num_values;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_vec4_array.push_back(uniform);
 }
 
@@ -213,6 +401,7 @@ void Effect::register_uniform_mat3(const std::string &key, const Matrix3d *matri
 	uniform.value = matrix;
 	uniform.num_values = 1;
 	uniform.location = -1;
+	uniform.ubo_offset = -1;
 	uniforms_mat3.push_back(uniform);
 }
 
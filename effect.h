@@ -14,6 +14,7 @@
 #include <assert.h>
 #include <stddef.h>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <Eigen/Core>
@@ -22,9 +23,43 @@
 
 namespace movit {
 
+class Effect;
 class EffectChain;
 class Node;
 
+// A parameter of an effect, looked up by name once (see
+// Effect::get_float_handle() etc.). Setting it through the handle has
+// the same effect as calling Effect::set_float() etc. with the same name,
+// but without looking up the name each time, which adds up if you animate
+// many parameters every frame. Handles are cheap to copy, and stay valid
+// for as long as the effect lives.
+//
+// T is int or float; vec2, vec3 and vec4 parameters are ParamHandle<float>,
+// and must be set with set_vec().
+template<class T>
+class ParamHandle {
+public:
+	// An invalid handle, as also returned for nonexistent parameters.
+	ParamHandle() : effect(NULL), param(NULL), num_values(0) {}
+
+	bool is_valid() const { return effect != NULL; }
+	unsigned get_num_values() const { return num_values; }
+
+	// Returns false if the effect did not accept the value,
+	// like set_*() would.
+	bool set(T value) const MUST_CHECK_RESULT;
+	bool set_vec(const T *values) const MUST_CHECK_RESULT;
+
+private:
+	ParamHandle(Effect *effect, T *param, unsigned num_values)
+		: effect(effect), param(param), num_values(num_values) {}
+	friend class Effect;
+
+	Effect *effect;
+	T *param;
+	unsigned num_values;
+};
+
 // Can alias on a float[2].
 struct Point2D {
 	Point2D() {}
@@ -52,6 +87,17 @@ struct RGBATuple {
 	float r, g, b, a;
 };
 
+// A rectangle in normalized image coordinates, ie. 0.0 to 1.0 covers the
+// entire image, with the origin in the lower-left corner (the same convention
+// as the texture coordinates in the shaders).
+struct Region {
+	Region() {}
+	Region(float left, float bottom, float right, float top)
+		: left(left), bottom(bottom), right(right), top(top) {}
+
+	float left, bottom, right, top;
+};
+
 // Represents a registered uniform.
 template<class T>
 struct Uniform {
@@ -60,10 +106,12 @@ struct Uniform {
 	size_t num_values;  // Number of elements; for arrays only. _Not_ the vector length.
 	std::string prefix;  // Filled in only after phases have been constructed.
 	GLint location;  // Filled in only after phases have been constructed. -1 if no location.
+	GLint ubo_offset;  // Filled in only after phases have been constructed. -1 if not in a uniform block.
 };
 
 class Effect {
 public:
+	Effect() : generation(0) {}
 	virtual ~Effect() {}
 
 	// An identifier for this type of effect, mostly used for debug output
@@ -262,6 +310,62 @@ public:
 	// if you have several, they will be INPUT1(), INPUT2(), and so on.
 	virtual unsigned num_inputs() const { return 1; }
 
+	// If this effect, for any value of its parameters, is a linear
+	// transformation of each pixel on its own (out.rgb = M * in.rgb and
+	// out.a = alpha_factor * in.a), return true and store M and alpha_factor
+	// for the current parameters. EffectChain will then fold runs of two or
+	// more such effects into a single matrix multiplication when finalizing
+	// (see ColorMatrixEffect), and call this every frame instead of
+	// set_gl_state(), so it must not depend on any GL state.
+	//
+	// The transformation is done in whatever color space, gamma curve and
+	// alpha type the effect would have gotten its input in.
+	virtual bool get_color_matrix(Eigen::Matrix3d *matrix, float *alpha_factor) const { return false; }
+
+	// If this effect has one input, and the output color of each pixel is
+	// a function of the input color of that same pixel only (ie., it does
+	// not depend on the position, the neighbors or anything but its
+	// parameters), return true. This is a much weaker requirement than
+	// get_color_matrix(); gamma curves, lift/gamma/gain and the like
+	// all qualify. If the user has asked for it (see
+	// EffectChain::set_lut_baking()), runs of such effects can then be
+	// replaced by a lookup in a 3D LUT (see BakedLUTEffect).
+	virtual bool is_pointwise() const { return false; }
+
+	// If the output of this effect is fully determined by its inputs and
+	// its parameters (ie., what is registered with register_int() etc.;
+	// anything derived from those and from inform_input_size() is fine),
+	// return true. If the user has asked for it (see
+	// EffectChain::enable_common_subexpression_elimination()), two such
+	// effects of the same type, with the same inputs and the same parameters,
+	// can then be merged into one.
+	virtual bool is_mergeable() const { return false; }
+
+	// Rough estimates of the work this effect does per output pixel,
+	// for EffectChain's phase cost model (see PhaseCostModel).
+	// <alu_ops> counts arithmetic instructions. <texture_fetches> counts
+	// the lookups the effect does itself, ie., in its own textures (LUTs
+	// and the like) or directly in its inputs if it has
+	// needs_texture_bounce(); each INPUT() call is already counted by the
+	// chain. The defaults describe a simple effect like MultiplyEffect;
+	// only the order of magnitude matters.
+	virtual unsigned estimated_alu_ops() const { return 4; }
+	virtual unsigned estimated_texture_fetches() const { return 0; }
+
+	// Used for region-of-interest rendering (see EffectChain::render_to_fbo_region()).
+	// Given the region of the output that needs to be computed, return
+	// the region of input <input_num> that you might sample from to do so.
+	// It is fine to return something larger than the input; it will be clipped.
+	// This will be called after inform_input_size().
+	//
+	// The default assumes that you can sample from anywhere, which is always
+	// safe, but means that everything before this effect will be computed
+	// in full. Effects that only sample their inputs at the same coordinates
+	// as they output (like most color effects) should return <output_region>.
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const {
+		return Region(0.0f, 0.0f, 1.0f, 1.0f);
+	}
+
 	// Inform the effect that it has been just added to the EffectChain.
 	// The primary use for this is to store the ResourcePool uesd by
 	// the chain; for modifications to it, rewrite_graph() below
@@ -307,7 +411,65 @@ public:
 	virtual bool set_vec3(const std::string &key, const float *values) MUST_CHECK_RESULT;
 	virtual bool set_vec4(const std::string &key, const float *values) MUST_CHECK_RESULT;
 
+	// A counter that changes whenever something that could affect the
+	// output of this effect changes; e.g., a parameter is set to a new value
+	// through set_*(), or an input gets new pixel data. Used by EffectChain
+	// to find phases whose output from the previous frame can be reused
+	// (see EffectChain::set_phase_cache_budget()).
+	unsigned get_generation() const { return generation; }
+
+	// Look up a parameter once, to set it repeatedly through the returned
+	// handle (see ParamHandle). The handle is invalid if there is no such
+	// parameter. Composite effects return handles to the parameters of
+	// their sub-effects where that does the same as set_*(); where it does
+	// not (e.g. one value that sets two parameters), the handle is invalid,
+	// and you will need to use set_*().
+	virtual ParamHandle<int> get_int_handle(const std::string &key);
+	virtual ParamHandle<float> get_float_handle(const std::string &key);
+	virtual ParamHandle<float> get_vec2_handle(const std::string &key);
+	virtual ParamHandle<float> get_vec3_handle(const std::string &key);
+	virtual ParamHandle<float> get_vec4_handle(const std::string &key);
+
+	// Whether <other> has the same parameters (see register_int() etc.)
+	// as this effect, with the same values.
+	bool has_same_parameters(const Effect *other) const;
+
+	// Compile the current value of the given parameter (see register_int()
+	// etc.) into the shader as a constant, instead of sending it as
+	// a uniform, so that the shader compiler can fold it into the
+	// surrounding arithmetic. This is meant for parameters that are set up
+	// once and then never change. Changing a frozen parameter afterwards
+	// still works, but the next frame will have to compile a new program
+	// (or find it in the ResourcePool, if it has been used before).
+	// The value must be finite; setting a frozen parameter to infinity or
+	// NaN is rejected. It must also not be changed by the effect itself
+	// in set_gl_state().
+	//
+	// Must be called before the chain is finalized. Returns false
+	// if there is no such parameter, or if its value is not finite.
+	bool freeze_parameter(const std::string &key) MUST_CHECK_RESULT;
+
+	// Freeze all parameters registered so far (see freeze_parameter()),
+	// except those whose value is not finite.
+	void freeze_all_parameters();
+
+	bool is_parameter_frozen(const std::string &key) const { return frozen_params.count(key) != 0; }
+
 protected:
+	// Effects whose output can change in ways that do not go through
+	// the set_*() functions above (typically inputs getting new data)
+	// must call this whenever that happens.
+	void bump_generation() { ++generation; }
+
+	// Called when a parameter (see register_int() etc.) has been set
+	// to a new value, through set_*() or a ParamHandle. <param> is the
+	// pointer given at registration, and already holds the new value.
+	// Effects that need to do more than storing the value (e.g. composite
+	// effects that pass it on to their sub-effects) can do so here.
+	// Return false to reject the value; the old value is then restored,
+	// and the setter returns false.
+	virtual bool parameter_changed(const void *param) { return true; }
+
 	// Register a parameter. Whenever set_*() is called with the same key,
 	// it will update the value in the given pointer (typically a pointer
 	// to some private member variable in your effect). It will also
@@ -326,8 +488,8 @@ protected:
 	// Register uniforms, such that they will automatically be set
 	// before the shader runs. This is more efficient than set_uniform_*
 	// in effect_util.h, because it doesn't need to do name lookups
-	// every time. Also, in the future, it will use uniform buffer objects
-	// (UBOs) if available to reduce the number of calls into the driver.
+	// every time. Also, it will use uniform buffer objects (UBOs) if
+	// available to reduce the number of calls into the driver.
 	//
 	// May not be called after output_fragment_shader() has returned.
 	// The pointer must be valid for the entire lifetime of the Effect,
@@ -362,6 +524,24 @@ private:
 	std::map<std::string, float *> params_vec2;
 	std::map<std::string, float *> params_vec3;
 	std::map<std::string, float *> params_vec4;
+	std::set<std::string> frozen_params;
+
+	// Whether all values of the given (existing) parameter are finite,
+	// as they need to be for freezing it.
+	bool parameter_is_finite(const std::string &key);
+
+	// Store new values for a parameter, and notify parameter_changed()
+	// if they differ from the old ones.
+	bool update_parameter(int *param, const int *values, unsigned num_values);
+	bool update_parameter(float *param, const float *values, unsigned num_values);
+	template<class T> friend class ParamHandle;
+
+	template<class T>
+	bool update_values(T *param, const T *values, unsigned num_values);
+	template<class T>
+	ParamHandle<T> find_handle(const std::map<std::string, T *> &params, const std::string &key, unsigned num_values);
+
+	unsigned generation;
 
 	// Picked out by EffectChain during finalization.
 	std::vector<Uniform<int> > uniforms_sampler2d;
@@ -379,6 +559,20 @@ private:
 	friend class EffectChain;
 };
 
+template<class T>
+inline bool ParamHandle<T>::set(T value) const
+{
+	assert(num_values == 1);
+	return effect->update_parameter(param, &value, 1);
+}
+
+template<class T>
+inline bool ParamHandle<T>::set_vec(const T *values) const
+{
+	assert(effect != NULL);
+	return effect->update_parameter(param, values, num_values);
+}
+
 }  // namespace movit
 
 #endif // !defined(_MOVIT_EFFECT_H)
@@ -10,10 +10,13 @@
 #include <stack>
 #include <utility>
 #include <vector>
+#include <Eigen/Cholesky>
 #include <Eigen/Core>
 
 #include "alpha_division_effect.h"
 #include "alpha_multiplication_effect.h"
+#include "baked_lut_effect.h"
+#include "color_matrix_effect.h"
 #include "colorspace_conversion_effect.h"
 #include "dither_effect.h"
 #include "effect.h"
@@ -24,6 +27,7 @@
 #include "init.h"
 #include "input.h"
 #include "resource_pool.h"
+#include "trace.h"
 #include "util.h"
 #include "ycbcr_conversion_effect.h"
 
@@ -32,6 +36,31 @@ using namespace std;
 
 namespace movit {
 
+namespace {
+
+// Number of timer queries per phase (see Phase::timer_query_objects).
+// This is how many frames the GPU can lag behind before we start dropping
+// measurements.
+const unsigned num_timer_queries_per_phase = 8;
+
+// Number of recent GPU times per phase kept for the percentile.
+const unsigned num_recent_times_per_phase = 1024;
+
+// A name for the phase in traces; the effects in it, in order.
+string get_phase_trace_name(const Phase *phase)
+{
+	string name;
+	for (unsigned effect_num = 0; effect_num < phase->effects.size(); ++effect_num) {
+		if (effect_num != 0) {
+			name += ", ";
+		}
+		name += phase->effects[effect_num]->effect->effect_type_id();
+	}
+	return name;
+}
+
+}  // namespace
+
 EffectChain::EffectChain(float aspect_nom, float aspect_denom, ResourcePool *resource_pool)
 	: aspect_nom(aspect_nom),
 	  aspect_denom(aspect_denom),
@@ -39,10 +68,19 @@ EffectChain::EffectChain(float aspect_nom, float aspect_denom, ResourcePool *res
 	  output_color_ycbcr(false),
 	  dither_effect(NULL),
 	  num_dither_bits(0),
+	  lut_size(0),
+	  do_common_subexpression_elimination(false),
+	  use_phase_cost_model(false),
 	  output_origin(OUTPUT_ORIGIN_BOTTOM_LEFT),
+	  intermediate_format_policy(INTERMEDIATE_FORMAT_ALWAYS_FP16),
 	  finalized(false),
+	  compile_programs_async(false),
 	  resource_pool(resource_pool),
-	  do_phase_timing(false) {
+	  do_phase_timing(false),
+	  peak_intermediate_bytes(0),
+	  num_frames_in_flight(1),
+	  frame_num(0),
+	  phase_cache_budget(0) {
 	if (resource_pool == NULL) {
 		this->resource_pool = new ResourcePool();
 		owns_resource_pool = true;
@@ -57,6 +95,15 @@ EffectChain::EffectChain(float aspect_nom, float aspect_denom, ResourcePool *res
 		2.0f, 0.0f
 	};
 	vbo = generate_vbo(2, GL_FLOAT, sizeof(vertices), vertices);
+
+	rtt_sampler_objects[0] = rtt_sampler_objects[1] = 0;
+
+	phase_cache_stats.num_phases_executed = 0;
+	phase_cache_stats.num_phases_skipped = 0;
+	phase_cache_stats.num_phases_skipped_last_frame = 0;
+	phase_cache_stats.cached_bytes = 0;
+
+	pthread_mutex_init(&committed_changes_lock, NULL);
 }
 
 EffectChain::~EffectChain()
@@ -65,15 +112,45 @@ EffectChain::~EffectChain()
 		delete nodes[i]->effect;
 		delete nodes[i];
 	}
+	for (unsigned i = 0; i < frame_slots.size(); ++i) {
+		// No need to wait; the pool can have the textures back right away,
+		// since any later use will be properly ordered after ours.
+		if (frame_slots[i].fence != 0) {
+			glDeleteSync(frame_slots[i].fence);
+			check_error();
+		}
+		for (unsigned j = 0; j < frame_slots[i].textures_to_release.size(); ++j) {
+			resource_pool->release_2d_texture(frame_slots[i].textures_to_release[j]);
+		}
+	}
 	for (unsigned i = 0; i < phases.size(); ++i) {
+		drop_cached_output(phases[i], NULL);
 		resource_pool->release_glsl_program(phases[i]->glsl_program_num);
+		if (!phases[i]->timer_query_objects.empty()) {
+			glDeleteQueries(phases[i]->timer_query_objects.size(), &phases[i]->timer_query_objects[0]);
+			check_error();
+		}
+		if (phases[i]->uniform_buffer != 0) {
+			glDeleteBuffers(1, &phases[i]->uniform_buffer);
+			check_error();
+		}
 		delete phases[i];
 	}
+	for (map<void *, GLuint>::const_iterator vao_it = vaos.begin();
+	     vao_it != vaos.end();
+	     ++vao_it) {
+		resource_pool->release_vec2_vao(vao_it->first, vao_it->second);
+	}
+	if (rtt_sampler_objects[0] != 0) {
+		glDeleteSamplers(2, rtt_sampler_objects);
+		check_error();
+	}
 	if (owns_resource_pool) {
 		delete resource_pool;
 	}
 	glDeleteBuffers(1, &vbo);
 	check_error();
+	pthread_mutex_destroy(&committed_changes_lock);
 }
 
 Input *EffectChain::add_input(Input *input)
@@ -122,6 +199,10 @@ Node *EffectChain::add_node(Effect *effect)
 	node->output_alpha_type = ALPHA_INVALID;
 	node->needs_mipmaps = false;
 	node->one_to_one_sampling = false;
+	node->merged_generation = 0;
+	node->recompute_in_each_phase = false;
+	node->bypassable = false;
+	node->bypassed = false;
 
 	nodes.push_back(node);
 	node_map[effect] = node;
@@ -227,6 +308,28 @@ Effect *EffectChain::add_effect(Effect *effect, const vector<Effect *> &inputs)
 	return effect;
 }
 
+void EffectChain::set_bypassable(Effect *effect)
+{
+	assert(!finalized);
+	Node *node = find_node_for_effect(effect);
+	assert(node != NULL);
+	node->bypassable = true;
+}
+
+void EffectChain::set_bypass(Effect *effect, bool bypass)
+{
+	Node *node = find_node_for_effect(effect);
+	assert(node != NULL);
+	assert(node->bypassable);
+	if (node->bypassed != bypass) {
+		node->bypassed = bypass;
+
+		// Make sure cached phase outputs (see set_phase_cache_budget())
+		// are not reused.
+		effect->bump_generation();
+	}
+}
+
 // ESSL doesn't support token pasting. Replace PREFIX(x) with <effect_id>_x.
 string replace_prefix(const string &text, const string &prefix)
 {
@@ -270,19 +373,72 @@ string replace_prefix(const string &text, const string &prefix)
 
 namespace {
 
+// The name of the uniform block (if any) in the generated shaders.
+// It is always bound to uniform buffer binding point 0.
+const char uniform_block_name[] = "MovitUniforms";
+
+// A std140 uniform block that is being built up, one member at a time.
+struct UniformBlockLayout {
+	string declarations;
+	size_t size;
+};
+
+// Find the std140 base alignment and size of a non-array member
+// of the given type.
+void get_std140_layout(const string &type_specifier, size_t *alignment, size_t *size)
+{
+	if (type_specifier == "bool" || type_specifier == "int" || type_specifier == "float") {
+		*alignment = *size = 4;
+	} else if (type_specifier == "vec2") {
+		*alignment = *size = 8;
+	} else if (type_specifier == "vec3") {
+		*alignment = 16;
+		*size = 12;
+	} else if (type_specifier == "vec4") {
+		*alignment = *size = 16;
+	} else if (type_specifier == "mat3") {
+		// Stored as three vec3 columns, each padded out to a vec4.
+		*alignment = 16;
+		*size = 48;
+	} else {
+		assert(false);
+	}
+}
+
+// Returns the offset of the new member.
+GLint add_uniform_block_member(UniformBlockLayout *block, const string &declaration,
+                               size_t alignment, size_t size)
+{
+	size_t offset = (block->size + alignment - 1) & ~(alignment - 1);
+	block->declarations += "\t" + declaration;
+	block->size = offset + size;
+	return offset;
+}
+
+// If <block> is non-NULL, the uniforms are added to it instead of being
+// declared individually.
 template<class T>
 void extract_uniform_declarations(const vector<Uniform<T> > &effect_uniforms,
                                   const string &type_specifier,
                                   const string &effect_id,
                                   vector<Uniform<T> > *phase_uniforms,
-                                  string *glsl_string)
+                                  string *glsl_string,
+                                  UniformBlockLayout *block)
 {
 	for (unsigned i = 0; i < effect_uniforms.size(); ++i) {
 		phase_uniforms->push_back(effect_uniforms[i]);
 		phase_uniforms->back().prefix = effect_id;
 
-		*glsl_string += string("uniform ") + type_specifier + " " + effect_id
+		const string declaration = type_specifier + " " + effect_id
 			+ "_" + effect_uniforms[i].name + ";\n";
+		if (block == NULL) {
+			*glsl_string += string("uniform ") + declaration;
+		} else {
+			size_t alignment, size;
+			get_std140_layout(type_specifier, &alignment, &size);
+			phase_uniforms->back().ubo_offset =
+				add_uniform_block_member(block, declaration, alignment, size);
+		}
 	}
 }
 
@@ -291,19 +447,87 @@ void extract_uniform_array_declarations(const vector<Uniform<T> > &effect_unifor
                                         const string &type_specifier,
                                         const string &effect_id,
                                         vector<Uniform<T> > *phase_uniforms,
-                                        string *glsl_string)
+                                        string *glsl_string,
+                                        UniformBlockLayout *block)
 {
 	for (unsigned i = 0; i < effect_uniforms.size(); ++i) {
 		phase_uniforms->push_back(effect_uniforms[i]);
 		phase_uniforms->back().prefix = effect_id;
 
 		char buf[256];
-		snprintf(buf, sizeof(buf), "uniform %s %s_%s[%d];\n",
+		snprintf(buf, sizeof(buf), "%s %s_%s[%d];\n",
 			type_specifier.c_str(), effect_id.c_str(),
 			effect_uniforms[i].name.c_str(),
 			int(effect_uniforms[i].num_values));
-		*glsl_string += buf;
+		if (block == NULL) {
+			*glsl_string += string("uniform ") + buf;
+		} else {
+			// In std140, every array element is padded out to a vec4.
+			phase_uniforms->back().ubo_offset =
+				add_uniform_block_member(block, buf, 16, 16 * effect_uniforms[i].num_values);
+		}
+	}
+}
+
+// Parameters that the effect wants frozen (see Effect::freeze_parameter())
+// are declared as constants with their current values instead of as
+// uniforms, and those values are remembered in <frozen_values>, so that
+// we can notice when they change. The other uniforms are copied to
+// <live_uniforms>, for extract_uniform_declarations().
+string output_glsl_constant(const string &name, const int *values, unsigned num_components)
+{
+	assert(num_components == 1);
+	return output_glsl_int(name, values[0]);
+}
+
+string output_glsl_constant(const string &name, const float *values, unsigned num_components)
+{
+	switch (num_components) {
+	case 1:
+		return output_glsl_float(name, values[0]);
+	case 2:
+		return output_glsl_vec2(name, values[0], values[1]);
+	case 3:
+		return output_glsl_vec3(name, values[0], values[1], values[2]);
+	case 4:
+		return output_glsl_vec4(name, values[0], values[1], values[2], values[3]);
+	default:
+		assert(false);
+		return "";
+	}
+}
+
+template<class T>
+void extract_frozen_uniforms(const Effect *effect,
+                             const vector<Uniform<T> > &effect_uniforms,
+                             unsigned num_components,
+                             const string &effect_id,
+                             vector<Uniform<T> > *live_uniforms,
+                             vector<pair<const T *, T> > *frozen_values,
+                             string *glsl_string)
+{
+	for (unsigned i = 0; i < effect_uniforms.size(); ++i) {
+		const Uniform<T> &uniform = effect_uniforms[i];
+		if (!effect->is_parameter_frozen(uniform.name)) {
+			live_uniforms->push_back(uniform);
+			continue;
+		}
+		*glsl_string += output_glsl_constant(effect_id + "_" + uniform.name, uniform.value, num_components);
+		for (unsigned j = 0; j < num_components; ++j) {
+			frozen_values->push_back(make_pair(uniform.value + j, uniform.value[j]));
+		}
+	}
+}
+
+template<class T>
+bool frozen_values_changed(const vector<pair<const T *, T> > &frozen_values)
+{
+	for (unsigned i = 0; i < frozen_values.size(); ++i) {
+		if (*frozen_values[i].first != frozen_values[i].second) {
+			return true;
+		}
 	}
+	return false;
 }
 
 template<class T>
@@ -311,18 +535,63 @@ void collect_uniform_locations(GLuint glsl_program_num, vector<Uniform<T> > *pha
 {
 	for (unsigned i = 0; i < phase_uniforms->size(); ++i) {
 		Uniform<T> &uniform = (*phase_uniforms)[i];
-		uniform.location = get_uniform_location(glsl_program_num, uniform.prefix, uniform.name);
+		if (uniform.ubo_offset == -1) {
+			uniform.location = get_uniform_location(glsl_program_num, uniform.prefix, uniform.name);
+		}
+	}
+}
+
+// Copy the values of the given uniforms into their place in a std140 block.
+// Booleans and integers are both stored as 32-bit integers; array elements
+// have a stride of 16 bytes.
+template<class T, class Stored>
+void pack_uniform_block_members(const vector<Uniform<T> > &uniforms,
+                                unsigned components,
+                                unsigned char *block)
+{
+	for (unsigned i = 0; i < uniforms.size(); ++i) {
+		const Uniform<T> &uniform = uniforms[i];
+		if (uniform.ubo_offset == -1) {
+			continue;
+		}
+		for (unsigned j = 0; j < uniform.num_values; ++j) {
+			unsigned char *dst = block + uniform.ubo_offset + j * 16;
+			for (unsigned k = 0; k < components; ++k) {
+				Stored value = uniform.value[j * components + k];
+				memcpy(dst + k * sizeof(Stored), &value, sizeof(Stored));
+			}
+		}
+	}
+}
+
+void pack_uniform_block_matrices(const vector<Uniform<Matrix3d> > &uniforms,
+                                 unsigned char *block)
+{
+	for (unsigned i = 0; i < uniforms.size(); ++i) {
+		const Uniform<Matrix3d> &uniform = uniforms[i];
+		assert(uniform.num_values == 1);
+		if (uniform.ubo_offset == -1) {
+			continue;
+		}
+		// Convert to float (GLSL has no double matrices), column by column.
+		for (unsigned x = 0; x < 3; ++x) {
+			float column[3];
+			for (unsigned y = 0; y < 3; ++y) {
+				column[y] = (*uniform.value)(y, x);
+			}
+			memcpy(block + uniform.ubo_offset + x * 16, column, sizeof(column));
+		}
 	}
 }
 
 }  // namespace
 
-void EffectChain::compile_glsl_program(Phase *phase)
+void EffectChain::generate_fragment_shader(Phase *phase)
 {
 	string frag_shader_header = read_version_dependent_file("header", "frag");
 	string frag_shader = "";
 
-	// Create functions and uniforms for all the texture inputs that we need.
+	// Create functions for all the texture inputs that we need.
 	for (unsigned i = 0; i < phase->inputs.size(); ++i) {
 		Node *input = phase->inputs[i]->output_node;
 		char effect_id[256];
@@ -334,14 +603,6 @@ void EffectChain::compile_glsl_program(Phase *phase)
 		frag_shader += "\treturn tex2D(tex_" + string(effect_id) + ", tc);\n";
 		frag_shader += "}\n";
 		frag_shader += "\n";
-
-		Uniform<int> uniform;
-		uniform.name = effect_id;
-		uniform.value = &phase->input_samplers[i];
-		uniform.prefix = "tex";
-		uniform.num_values = 1;
-		uniform.location = -1;
-		phase->uniforms_sampler2d.push_back(uniform);
 	}
 
 	// Give each effect in the phase its own ID.
@@ -366,8 +627,22 @@ void EffectChain::compile_glsl_program(Phase *phase)
 		}
 	
 		frag_shader += "\n";
-		frag_shader += string("#define FUNCNAME ") + effect_id + "\n";
+		if (node->bypassable) {
+			// The effect gets another name, and <effect_id> becomes
+			// a wrapper that can skip it (see set_bypassable()).
+			frag_shader += string("#define FUNCNAME ") + effect_id + "_unbypassed\n";
+		} else {
+			frag_shader += string("#define FUNCNAME ") + effect_id + "\n";
+		}
 		frag_shader += replace_prefix(node->effect->output_fragment_shader(), effect_id);
+		if (node->bypassable) {
+			frag_shader += string("vec4 ") + effect_id + "(vec2 tc) {\n";
+			frag_shader += string("\tif (") + effect_id + "_bypass) {\n";
+			frag_shader += "\t\treturn INPUT(tc);\n";
+			frag_shader += "\t}\n";
+			frag_shader += string("\treturn ") + effect_id + "_unbypassed(tc);\n";
+			frag_shader += "}\n";
+		}
 		frag_shader += "#undef PREFIX\n";
 		frag_shader += "#undef FUNCNAME\n";
 		if (node->incoming_links.size() == 1) {
@@ -416,32 +691,88 @@ void EffectChain::compile_glsl_program(Phase *phase)
 	}
 	frag_shader.append(read_file("footer.frag"));
 
+	phase->frag_shader_header = frag_shader_header;
+	phase->frag_shader_body = frag_shader;
+	phase->frag_shader_outputs = frag_shader_outputs;
+}
+
+void EffectChain::compile_glsl_program(Phase *phase)
+{
+	TraceScope trace("finalize", "compile_glsl_program");
+	if (phase->frag_shader_body.empty()) {
+		generate_fragment_shader(phase);
+	}
+
+	// Uniforms for all the texture inputs.
+	for (unsigned i = 0; i < phase->inputs.size(); ++i) {
+		Uniform<int> uniform;
+		uniform.name = phase->effect_ids[phase->inputs[i]->output_node];
+		uniform.value = &phase->input_samplers[i];
+		uniform.prefix = "tex";
+		uniform.num_values = 1;
+		uniform.location = -1;
+		uniform.ubo_offset = -1;
+		phase->uniforms_sampler2d.push_back(uniform);
+	}
+
 	// Collect uniforms from all effects and output them. Note that this needs
 	// to happen after output_fragment_shader(), even though the uniforms come
 	// before in the output source, since output_fragment_shader() is allowed
 	// to register new uniforms (e.g. arrays that are of unknown length until
 	// finalization time).
-	// TODO: Make a uniform block for platforms that support it.
+	//
+	// On platforms that support it, everything except the samplers goes into
+	// a uniform block, so that we can update the values in bulk
+	// (see upload_uniform_block()).
 	string frag_shader_uniforms = "";
+	UniformBlockLayout uniform_block;
+	uniform_block.size = 0;
+	UniformBlockLayout *block = NULL;
+	if (movit_shader_model == MOVIT_GLSL_150 || movit_shader_model == MOVIT_ESSL_300) {
+		block = &uniform_block;
+	}
 	for (unsigned i = 0; i < phase->effects.size(); ++i) {
 		Node *node = phase->effects[i];
 		Effect *effect = node->effect;
 		const string effect_id = phase->effect_ids[node];
-		extract_uniform_declarations(effect->uniforms_sampler2d, "sampler2D", effect_id, &phase->uniforms_sampler2d, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_bool, "bool", effect_id, &phase->uniforms_bool, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_int, "int", effect_id, &phase->uniforms_int, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_float, "float", effect_id, &phase->uniforms_float, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_vec2, "vec2", effect_id, &phase->uniforms_vec2, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_vec3, "vec3", effect_id, &phase->uniforms_vec3, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_vec4, "vec4", effect_id, &phase->uniforms_vec4, &frag_shader_uniforms);
-		extract_uniform_array_declarations(effect->uniforms_float_array, "float", effect_id, &phase->uniforms_float, &frag_shader_uniforms);
-		extract_uniform_array_declarations(effect->uniforms_vec2_array, "vec2", effect_id, &phase->uniforms_vec2, &frag_shader_uniforms);
-		extract_uniform_array_declarations(effect->uniforms_vec3_array, "vec3", effect_id, &phase->uniforms_vec3, &frag_shader_uniforms);
-		extract_uniform_array_declarations(effect->uniforms_vec4_array, "vec4", effect_id, &phase->uniforms_vec4, &frag_shader_uniforms);
-		extract_uniform_declarations(effect->uniforms_mat3, "mat3", effect_id, &phase->uniforms_mat3, &frag_shader_uniforms);
-	}
-
-	frag_shader = frag_shader_header + frag_shader_uniforms + frag_shader;
+		vector<Uniform<int> > uniforms_int;
+		vector<Uniform<float> > uniforms_float, uniforms_vec2, uniforms_vec3, uniforms_vec4;
+		extract_frozen_uniforms(effect, effect->uniforms_int, 1, effect_id, &uniforms_int, &phase->frozen_ints, &frag_shader_uniforms);
+		extract_frozen_uniforms(effect, effect->uniforms_float, 1, effect_id, &uniforms_float, &phase->frozen_floats, &frag_shader_uniforms);
+		extract_frozen_uniforms(effect, effect->uniforms_vec2, 2, effect_id, &uniforms_vec2, &phase->frozen_floats, &frag_shader_uniforms);
+		extract_frozen_uniforms(effect, effect->uniforms_vec3, 3, effect_id, &uniforms_vec3, &phase->frozen_floats, &frag_shader_uniforms);
+		extract_frozen_uniforms(effect, effect->uniforms_vec4, 4, effect_id, &uniforms_vec4, &phase->frozen_floats, &frag_shader_uniforms);
+
+		extract_uniform_declarations(effect->uniforms_sampler2d, "sampler2D", effect_id, &phase->uniforms_sampler2d, &frag_shader_uniforms, NULL);
+		extract_uniform_declarations(effect->uniforms_bool, "bool", effect_id, &phase->uniforms_bool, &frag_shader_uniforms, block);
+		extract_uniform_declarations(uniforms_int, "int", effect_id, &phase->uniforms_int, &frag_shader_uniforms, block);
+		extract_uniform_declarations(uniforms_float, "float", effect_id, &phase->uniforms_float, &frag_shader_uniforms, block);
+		extract_uniform_declarations(uniforms_vec2, "vec2", effect_id, &phase->uniforms_vec2, &frag_shader_uniforms, block);
+		extract_uniform_declarations(uniforms_vec3, "vec3", effect_id, &phase->uniforms_vec3, &frag_shader_uniforms, block);
+		extract_uniform_declarations(uniforms_vec4, "vec4", effect_id, &phase->uniforms_vec4, &frag_shader_uniforms, block);
+		extract_uniform_array_declarations(effect->uniforms_float_array, "float", effect_id, &phase->uniforms_float, &frag_shader_uniforms, block);
+		extract_uniform_array_declarations(effect->uniforms_vec2_array, "vec2", effect_id, &phase->uniforms_vec2, &frag_shader_uniforms, block);
+		extract_uniform_array_declarations(effect->uniforms_vec3_array, "vec3", effect_id, &phase->uniforms_vec3, &frag_shader_uniforms, block);
+		extract_uniform_array_declarations(effect->uniforms_vec4_array, "vec4", effect_id, &phase->uniforms_vec4, &frag_shader_uniforms, block);
+		extract_uniform_declarations(effect->uniforms_mat3, "mat3", effect_id, &phase->uniforms_mat3, &frag_shader_uniforms, block);
+		if (node->bypassable) {
+			vector<Uniform<bool> > bypass_uniforms(1);
+			bypass_uniforms[0].name = "bypass";
+			bypass_uniforms[0].value = &node->bypassed;
+			bypass_uniforms[0].num_values = 1;
+			bypass_uniforms[0].location = -1;
+			bypass_uniforms[0].ubo_offset = -1;
+			extract_uniform_declarations(bypass_uniforms, "bool", effect_id, &phase->uniforms_bool, &frag_shader_uniforms, block);
+		}
+	}
+	if (uniform_block.size > 0) {
+		frag_shader_uniforms += string("layout(std140) uniform ") + uniform_block_name + " {\n";
+		frag_shader_uniforms += uniform_block.declarations;
+		frag_shader_uniforms += "};\n";
+	}
+
+	const string frag_shader = phase->frag_shader_header + frag_shader_uniforms + phase->frag_shader_body;
+	const vector<string> &frag_shader_outputs = phase->frag_shader_outputs;
 
 	string vert_shader = read_version_dependent_file("vs", "vert");
 
@@ -455,7 +786,69 @@ void EffectChain::compile_glsl_program(Phase *phase)
 		vert_shader[pos + needle.size() - 1] = '1';
 	}
 
-	phase->glsl_program_num = resource_pool->compile_glsl_program(vert_shader, frag_shader, frag_shader_outputs);
+	phase->program_hash = ResourcePool::hash_glsl_program(vert_shader, frag_shader, frag_shader_outputs);
+	if (compile_programs_async) {
+		phase->glsl_program_num = resource_pool->compile_glsl_program_async(vert_shader, frag_shader, frag_shader_outputs, phase->program_hash);
+	} else {
+		phase->glsl_program_num = resource_pool->compile_glsl_program(vert_shader, frag_shader, frag_shader_outputs, phase->program_hash);
+	}
+
+	// Set up the buffer for the uniform block, if any. We round the size
+	// up to a whole number of vec4s, which is also the granularity we use
+	// when looking for changed values. Binding it to the program has to
+	// wait until the program is linked; see finish_glsl_program().
+	phase->uniform_buffer = 0;
+	phase->uniform_block_uploaded = false;
+	if (uniform_block.size > 0) {
+		size_t size = (uniform_block.size + 15) & ~15;
+		phase->uniform_block_data.assign(size, 0);
+		phase->uniform_block_scratch.assign(size, 0);
+
+		glGenBuffers(1, &phase->uniform_buffer);
+		check_error();
+		glBindBuffer(GL_UNIFORM_BUFFER, phase->uniform_buffer);
+		check_error();
+		glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+		check_error();
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		check_error();
+	}
+
+	phase->program_ready = false;
+	if (!compile_programs_async) {
+		finish_glsl_program(phase);
+	}
+}
+
+void EffectChain::recompile_glsl_program(Phase *phase)
+{
+	TraceScope trace("frame", "recompile_glsl_program");
+	resource_pool->release_glsl_program(phase->glsl_program_num);
+	if (phase->uniform_buffer != 0) {
+		glDeleteBuffers(1, &phase->uniform_buffer);
+		check_error();
+	}
+
+	// Everything that compile_glsl_program() fills in, except for
+	// what generate_fragment_shader() did.
+	phase->attribute_indexes.clear();
+	phase->uniforms_sampler2d.clear();
+	phase->uniforms_bool.clear();
+	phase->uniforms_int.clear();
+	phase->uniforms_float.clear();
+	phase->uniforms_vec2.clear();
+	phase->uniforms_vec3.clear();
+	phase->uniforms_vec4.clear();
+	phase->uniforms_mat3.clear();
+	phase->frozen_ints.clear();
+	phase->frozen_floats.clear();
+
+	compile_glsl_program(phase);
+}
+
+void EffectChain::finish_glsl_program(Phase *phase)
+{
+	assert(!phase->program_ready);
 	GLint position_attribute_index = glGetAttribLocation(phase->glsl_program_num, "position");
 	GLint texcoord_attribute_index = glGetAttribLocation(phase->glsl_program_num, "texcoord");
 	if (position_attribute_index != -1) {
@@ -474,6 +867,15 @@ void EffectChain::compile_glsl_program(Phase *phase)
 	collect_uniform_locations(phase->glsl_program_num, &phase->uniforms_vec3);
 	collect_uniform_locations(phase->glsl_program_num, &phase->uniforms_vec4);
 	collect_uniform_locations(phase->glsl_program_num, &phase->uniforms_mat3);
+
+	if (phase->uniform_buffer != 0) {
+		GLuint block_index = glGetUniformBlockIndex(phase->glsl_program_num, uniform_block_name);
+		check_error();
+		assert(block_index != GL_INVALID_INDEX);
+		glUniformBlockBinding(phase->glsl_program_num, block_index, 0);
+		check_error();
+	}
+	phase->program_ready = true;
 }
 
 // Construct GLSL programs, starting at the given effect and following
@@ -486,6 +888,7 @@ void EffectChain::compile_glsl_program(Phase *phase)
 // without recursing explicitly within each phase.
 Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *completed_effects)
 {
+	TraceScope trace("finalize", "construct_phase");
 	if (completed_effects->count(output)) {
 		return (*completed_effects)[output];
 	}
@@ -514,9 +917,10 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 		}
 
 		// This should currently only happen for effects that are inputs
-		// (either true inputs or phase outputs). We special-case inputs,
-		// and then deduplicate phase outputs below.
-		if (node->effect->num_inputs() == 0) {
+		// (either true inputs or phase outputs), or that the cost model
+		// has chosen to recompute in each phase that needs them. We
+		// special-case those, and then deduplicate phase outputs below.
+		if (node->effect->num_inputs() == 0 || node->recompute_in_each_phase) {
 			if (find(phase->effects.begin(), phase->effects.end(), node) != phase->effects.end()) {
 				continue;
 			}
@@ -553,7 +957,9 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 				}
 			}
 
-			if (deps[i]->outgoing_links.size() > 1) {
+			// Unless the cost model says that it is cheaper to compute
+			// it again here (see choose_nodes_to_recompute()).
+			if (deps[i]->outgoing_links.size() > 1 && !deps[i]->recompute_in_each_phase) {
 				if (!deps[i]->effect->is_single_texture()) {
 					// More than one effect uses this as the input,
 					// and it is not a texture itself.
@@ -589,7 +995,15 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 				start_new_phase = true;
 			}
 
+			// Nodes that are recomputed in several phases can pull in
+			// nodes that some earlier phase has already rendered to
+			// a texture; if so, just read that.
+			if (completed_effects->count(deps[i])) {
+				start_new_phase = true;
+			}
+
 			if (start_new_phase) {
+				assert(!deps[i]->recompute_in_each_phase);
 				phase->inputs.push_back(construct_phase(deps[i], completed_effects));
 			} else {
 				effects_todo_this_phase.push(deps[i]);
@@ -647,15 +1061,40 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 		phase->effects[i]->containing_phase = phase;
 	}
 
+	phase->intermediate_format = choose_intermediate_format(phase->output_node);
+	phase->cached_output_texture = 0;
+	phase->cached_output_bytes = 0;
+
+	// Effects that need texture bounce are allowed to change the sampler
+	// state of their inputs (see get_input_sampler()), which our sampler
+	// objects would override.
+	phase->use_sampler_objects = movit_sampler_objects_supported;
+	for (unsigned i = 0; i < phase->effects.size(); ++i) {
+		if (phase->effects[i]->effect->needs_texture_bounce()) {
+			phase->use_sampler_objects = false;
+		}
+	}
+
 	// Actually make the shader for this phase.
 	compile_glsl_program(phase);
 
 	// Initialize timer objects.
 	if (movit_timer_queries_supported) {
-		glGenQueries(1, &phase->timer_query_object);
-		phase->time_elapsed_ns = 0;
-		phase->num_measured_iterations = 0;
+		phase->timer_query_objects.resize(num_timer_queries_per_phase);
+		phase->timer_query_submit_ns.resize(num_timer_queries_per_phase);
+		glGenQueries(num_timer_queries_per_phase, &phase->timer_query_objects[0]);
+		check_error();
 	}
+	phase->next_timer_query = 0;
+	phase->num_timer_queries_pending = 0;
+	phase->num_timer_queries_to_discard = 0;
+	phase->time_elapsed_ns = 0;
+	phase->min_time_elapsed_ns = 0;
+	phase->max_time_elapsed_ns = 0;
+	phase->num_measured_iterations = 0;
+	phase->next_recent_time = 0;
+	phase->set_gl_state_time_ns.resize(phase->effects.size(), 0);
+	phase->num_timed_executions = 0;
 
 	assert(completed_effects->count(output) == 0);
 	completed_effects->insert(make_pair(output, phase));
@@ -663,6 +1102,73 @@ Phase *EffectChain::construct_phase(Node *output, map<Node *, Phase *> *complete
 	return phase;
 }
 
+// Since <phases> is in execution order, the output of any given phase is dead
+// once the last phase that reads from it has run. Give it back to the pool
+// right after that point, so that later phases can reuse the texture
+// (this is a very simple form of register allocation).
+void EffectChain::compute_texture_lifetimes()
+{
+	map<Phase *, unsigned> last_use;
+	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+		Phase *phase = phases[phase_num];
+		phase->inputs_to_release.clear();
+		for (unsigned i = 0; i < phase->inputs.size(); ++i) {
+			last_use[phase->inputs[i]] = phase_num;
+		}
+	}
+	for (map<Phase *, unsigned>::const_iterator use_it = last_use.begin();
+	     use_it != last_use.end();
+	     ++use_it) {
+		phases[use_it->second]->inputs_to_release.push_back(use_it->first);
+	}
+}
+
+// Since <phases> is in execution order, all inputs of a phase have been
+// handled by the time we get to it.
+void EffectChain::compute_upstream_nodes()
+{
+	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+		Phase *phase = phases[phase_num];
+		set<Node *> upstream_nodes(phase->effects.begin(), phase->effects.end());
+		for (unsigned i = 0; i < phase->effects.size(); ++i) {
+			const vector<Node *> &folded_nodes = phase->effects[i]->folded_nodes;
+			upstream_nodes.insert(folded_nodes.begin(), folded_nodes.end());
+		}
+		for (unsigned i = 0; i < phase->inputs.size(); ++i) {
+			const vector<Node *> &input_nodes = phase->inputs[i]->upstream_nodes;
+			upstream_nodes.insert(input_nodes.begin(), input_nodes.end());
+		}
+		phase->upstream_nodes.assign(upstream_nodes.begin(), upstream_nodes.end());
+		phase->executed_generations.clear();
+	}
+}
+
+GLint EffectChain::choose_intermediate_format(const Node *output)
+{
+	if (intermediate_format_policy == INTERMEDIATE_FORMAT_ALWAYS_FP16) {
+		return GL_RGBA16F;
+	}
+
+	const bool gamma_compressed = (output->output_gamma_curve != GAMMA_LINEAR);
+	const bool blank_alpha = (output->output_alpha_type == ALPHA_BLANK);
+	const bool aggressive = (intermediate_format_policy == INTERMEDIATE_FORMAT_AGGRESSIVE);
+
+	// We only know the final precision if dither is on.
+	const bool output_is_8bit = (num_dither_bits >= 1 && num_dither_bits <= 8);
+
+	if (gamma_compressed && blank_alpha && output_is_8bit) {
+		return GL_RGB10_A2;
+	}
+	if (aggressive && gamma_compressed) {
+		return GL_RGBA8;
+	}
+	if (aggressive && blank_alpha && epoxy_is_desktop_gl()) {
+		// Not color-renderable on GLES without extensions.
+		return GL_R11F_G11F_B10F;
+	}
+	return GL_RGBA16F;
+}
+
 void EffectChain::output_dot(const char *filename)
 {
 	if (movit_debug_level != MOVIT_DEBUG_ON) {
@@ -675,7 +1181,17 @@ void EffectChain::output_dot(const char *filename)
 		exit(1);
 	}
 
+	// The number of nodes that are actually in use, so that one can
+	// see e.g. how many conversions were removed between two steps.
+	unsigned num_active_nodes = 0;
+	for (unsigned i = 0; i < nodes.size(); ++i) {
+		if (!nodes[i]->disabled) {
+			++num_active_nodes;
+		}
+	}
+
 	fprintf(fp, "digraph G {\n");
+	fprintf(fp, "  label=\"%s: %u active nodes\";\n", filename, num_active_nodes);
 	fprintf(fp, "  output [shape=box label=\"(output)\"];\n");
 	for (unsigned i = 0; i < nodes.size(); ++i) {
 		// Find out which phase this event belongs to.
@@ -776,6 +1292,31 @@ vector<string> EffectChain::get_labels_for_edge(const Node *from, const Node *to
 		break;
 	}
 
+	// If this edge crosses a phase boundary, show what format the
+	// intermediate texture is stored in.
+	for (unsigned i = 0; i + 1 < phases.size(); ++i) {
+		if (phases[i]->output_node != from) {
+			continue;
+		}
+		switch (phases[i]->intermediate_format) {
+		case GL_RGBA16F:
+			labels.push_back("fmt[rgba16f]");
+			break;
+		case GL_RGB10_A2:
+			labels.push_back("fmt[rgb10_a2]");
+			break;
+		case GL_RGBA8:
+			labels.push_back("fmt[rgba8]");
+			break;
+		case GL_R11F_G11F_B10F:
+			labels.push_back("fmt[r11f_g11f_b10f]");
+			break;
+		default:
+			labels.push_back("fmt[unknown]");
+			break;
+		}
+	}
+
 	return labels;
 }
 
@@ -865,6 +1406,11 @@ void EffectChain::inform_input_sizes(Phase *phase)
 		for (unsigned j = 0; j < node->incoming_links.size(); ++j) {
 			Node *input = node->incoming_links[j];
 			node->effect->inform_input_size(j, input->output_width, input->output_height);
+			for (unsigned k = 0; k < node->merged_nodes.size(); ++k) {
+				// Keep anything derived from the size (e.g. in a parent
+				// effect) in sync with ours; see render().
+				node->merged_nodes[k]->effect->inform_input_size(j, input->output_width, input->output_height);
+			}
 			if (j == 0) {
 				this_output_width = input->output_width;
 				this_output_height = input->output_height;
@@ -1581,56 +2127,450 @@ void EffectChain::add_ycbcr_conversion_if_needed()
 	connect_nodes(output, ycbcr);
 }
 	
-// If the user has requested dither, add a DitherEffect right at the end
-// (after GammaCompressionEffect etc.). This needs to be done after everything else,
-// since dither is about the only effect that can _not_ be done in linear space.
-void EffectChain::add_dither_if_needed()
+void EffectChain::set_phase_cost_model(const PhaseCostModel &model)
 {
-	if (num_dither_bits == 0) {
-		return;
+	assert(!finalized);
+	use_phase_cost_model = true;
+	phase_cost_model = model;
+}
+
+bool EffectChain::can_recompute_in_each_phase(Node *node)
+{
+	if (node->disabled ||
+	    node->outgoing_links.size() <= 1 ||
+	    node->effect->num_inputs() == 0 ||
+	    node->effect->is_single_texture() ||
+	    !node->effect->one_to_one_sampling() ||
+	    node->effect->changes_output_size() ||
+	    node->effect->needs_texture_bounce() ||
+	    node->effect->needs_mipmaps()) {
+		return false;
 	}
-	Node *output = find_output_node();
-	Node *dither = add_node(new DitherEffect());
-	CHECK(dither->effect->set_int("num_bits", num_dither_bits));
-	connect_nodes(output, dither);
+	for (unsigned i = 0; i < node->outgoing_links.size(); ++i) {
+		Effect *receiver = node->outgoing_links[i]->effect;
+		if (receiver->needs_texture_bounce() || receiver->needs_mipmaps()) {
+			return false;
+		}
+	}
+	return true;
+}
 
-	dither_effect = dither->effect;
+// The cost per pixel of computing the output of <node> within a phase,
+// including any nodes that would be computed along with it, and reading
+// the textures that those again read from (in the format they would be
+// bounced to; for inputs, this is only an approximation).
+double EffectChain::estimate_recompute_cost(Node *node)
+{
+	double cost = node->effect->estimated_alu_ops() * phase_cost_model.alu_op_cost +
+		node->effect->estimated_texture_fetches() * phase_cost_model.texture_fetch_cost;
+	for (unsigned i = 0; i < node->incoming_links.size(); ++i) {
+		Node *input = node->incoming_links[i];
+		if (input->recompute_in_each_phase ||
+		    (input->outgoing_links.size() == 1 &&
+		     input->effect->num_inputs() > 0 &&
+		     !input->effect->changes_output_size() &&
+		     !node->effect->needs_texture_bounce())) {
+			cost += estimate_recompute_cost(input);
+		} else {
+			const double texel_bytes =
+				ResourcePool::estimate_texture_size(choose_intermediate_format(input), 1, 1);
+			cost += phase_cost_model.texture_fetch_cost + texel_bytes * phase_cost_model.byte_cost;
+		}
+	}
+	return cost;
 }
 
-// Find the output node. This is, simply, one that has no outgoing links.
-// If there are multiple ones, the graph is malformed (we do not support
-// multiple outputs right now).
-Node *EffectChain::find_output_node()
+// Rendering the output of a node to a texture costs a write, and then a read
+// for each of its <k> users. Computing it in each user's phase instead costs
+// the node itself (and whatever it pulls in) k - 1 more times. We go in
+// topological order, so that the decisions for a node's inputs are known
+// when we estimate its cost.
+void EffectChain::choose_nodes_to_recompute()
 {
-	vector<Node *> output_nodes;
+	if (!use_phase_cost_model) {
+		return;
+	}
+	sort_all_nodes_topologically();
+
 	for (unsigned i = 0; i < nodes.size(); ++i) {
 		Node *node = nodes[i];
-		if (node->disabled) {
+		if (!can_recompute_in_each_phase(node)) {
 			continue;
 		}
-		if (node->outgoing_links.empty()) {
-			output_nodes.push_back(node);
-		}
+		const unsigned num_users = node->outgoing_links.size();
+		const double texel_bytes =
+			ResourcePool::estimate_texture_size(choose_intermediate_format(node), 1, 1);
+		const double bounce_cost = texel_bytes * phase_cost_model.byte_cost +
+			num_users * (phase_cost_model.texture_fetch_cost + texel_bytes * phase_cost_model.byte_cost);
+		const double recompute_cost = (num_users - 1) * estimate_recompute_cost(node);
+		node->recompute_in_each_phase = (recompute_cost < bounce_cost);
 	}
-	assert(output_nodes.size() == 1);
-	return output_nodes[0];
 }
 
-void EffectChain::finalize()
+bool EffectChain::is_conversion_node(Node *node)
 {
-	// Output the graph as it is before we do any conversions on it.
-	output_dot("step0-start.dot");
-
-	// Give each effect in turn a chance to rewrite its own part of the graph.
-	// Note that if more effects are added as part of this, they will be
-	// picked up as part of the same for loop, since they are added at the end.
-	for (unsigned i = 0; i < nodes.size(); ++i) {
-		nodes[i]->effect->rewrite_graph(this, nodes[i]);
+	if (node->disabled) {
+		return false;
 	}
-	output_dot("step1-rewritten.dot");
+	const string type = node->effect->effect_type_id();
+	return type == "ColorspaceConversionEffect" ||
+	       type == "GammaCompressionEffect" ||
+	       type == "GammaExpansionEffect" ||
+	       type == "AlphaMultiplicationEffect" ||
+	       type == "AlphaDivisionEffect";
+}
 
-	find_color_spaces_for_inputs();
-	output_dot("step2-input-colorspace.dot");
+// Removes a node with a single input from the graph, connecting its
+// receivers directly to that input instead. The node is disabled,
+// not deleted.
+void EffectChain::bypass_node(Node *node)
+{
+	assert(node->incoming_links.size() == 1);
+	Node *sender = node->incoming_links[0];
+	sender->outgoing_links.erase(find(sender->outgoing_links.begin(), sender->outgoing_links.end(), node));
+	for (unsigned i = 0; i < node->outgoing_links.size(); ++i) {
+		Node *receiver = node->outgoing_links[i];
+		replace(receiver->incoming_links.begin(), receiver->incoming_links.end(), node, sender);
+		sender->outgoing_links.push_back(receiver);
+	}
+	node->incoming_links.clear();
+	node->outgoing_links.clear();
+	node->disabled = true;
+}
+
+// The fixups insert conversions one link at a time, so they can end up
+// back-to-back; e.g., when premultiplied output is requested from
+// a postmultiplied input, the alpha multiplication at the output is
+// followed by the division that GammaCompressionEffect needs. Each
+// conversion changes only one of color space, gamma curve and alpha type,
+// so if two consecutive conversions get us back to exactly what we started
+// with, they are each other's inverse and can both go.
+//
+// Colorspace conversions never end up next to each other (the ones to sRGB
+// always feed the effect that needed them, and the one to the output color
+// space comes last), so they are not handled specially.
+void EffectChain::remove_redundant_conversions()
+{
+	bool found_any;
+	do {
+		found_any = false;
+		for (unsigned i = 0; i < nodes.size(); ++i) {
+			Node *node = nodes[i];
+			if (!is_conversion_node(node)) {
+				continue;
+			}
+			assert(node->incoming_links.size() == 1);
+			Node *input = node->incoming_links[0];
+			if (!is_conversion_node(input) || input->outgoing_links.size() != 1) {
+				continue;
+			}
+			Node *source = input->incoming_links[0];
+
+			// If we are the output node, whatever takes over our role
+			// must not have any other users.
+			if (source->output_color_space == node->output_color_space &&
+			    source->output_gamma_curve == node->output_gamma_curve &&
+			    source->output_alpha_type == node->output_alpha_type &&
+			    (!node->outgoing_links.empty() || source->outgoing_links.size() == 1)) {
+				bypass_node(node);
+				bypass_node(input);
+				found_any = true;
+				break;
+			}
+		}
+	} while (found_any);
+}
+
+bool EffectChain::nodes_are_identical(Node *node, Node *other)
+{
+	// The output node cannot be merged away (or into).
+	return node != other &&
+	       !other->disabled &&
+	       !other->bypassable &&
+	       !other->outgoing_links.empty() &&
+	       other->effect->is_mergeable() &&
+	       other->effect->effect_type_id() == node->effect->effect_type_id() &&
+	       other->incoming_links == node->incoming_links &&
+	       other->effect->has_same_parameters(node->effect);
+}
+
+// Conservative; if this returns false, the output might still end up
+// in a texture, e.g. if an effect further down changes the output size.
+bool EffectChain::output_is_bounced(Node *node)
+{
+	if (node->outgoing_links.size() > 1 || node->effect->sets_virtual_output_size()) {
+		return true;
+	}
+	for (unsigned i = 0; i < node->outgoing_links.size(); ++i) {
+		Node *receiver = node->outgoing_links[i];
+		if (receiver->effect->needs_texture_bounce() && !node->effect->override_disable_bounce()) {
+			return true;
+		}
+		if (node->effect->changes_output_size() && !receiver->effect->one_to_one_sampling()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Merged nodes will have several outgoing links, and thus be bounced to
+// a texture. We only merge if that does not cost us an extra bounce,
+// ie., if at least one of them would be bounced anyway; for e.g. two
+// identical colorspace conversions that each feed into a different effect
+// in the same phase, recomputing is cheaper than going through memory.
+//
+// Nodes are visited in topological order, so that once two nodes are merged,
+// their identical consumers are found next.
+void EffectChain::eliminate_common_subexpressions()
+{
+	if (!do_common_subexpression_elimination) {
+		return;
+	}
+	sort_all_nodes_topologically();
+
+	for (unsigned i = 0; i < nodes.size(); ++i) {
+		Node *node = nodes[i];
+		if (node->disabled ||
+		    node->bypassable ||
+		    node->effect->num_inputs() == 0 ||
+		    node->outgoing_links.empty() ||
+		    !node->effect->is_mergeable()) {
+			continue;
+		}
+		for (unsigned j = 0; j < i; ++j) {
+			Node *other = nodes[j];
+			if (!nodes_are_identical(node, other) ||
+			    !(output_is_bounced(node) || output_is_bounced(other))) {
+				continue;
+			}
+
+			for (unsigned k = 0; k < node->incoming_links.size(); ++k) {
+				vector<Node *> &links = node->incoming_links[k]->outgoing_links;
+				links.erase(find(links.begin(), links.end(), node));
+			}
+			for (unsigned k = 0; k < node->outgoing_links.size(); ++k) {
+				Node *receiver = node->outgoing_links[k];
+				replace(receiver->incoming_links.begin(), receiver->incoming_links.end(), node, other);
+				other->outgoing_links.push_back(receiver);
+			}
+			node->incoming_links.clear();
+			node->outgoing_links.clear();
+			node->disabled = true;
+			node->merged_generation = node->effect->get_generation();
+			other->merged_generation = other->effect->get_generation();
+			other->merged_nodes.push_back(node);
+			break;
+		}
+	}
+}
+
+bool EffectChain::is_color_matrix_node(Node *node)
+{
+	if (node->disabled ||
+	    node->bypassable ||
+	    node->effect->num_inputs() != 1 ||
+	    node->incoming_links.size() != 1) {
+		return false;
+	}
+	Matrix3d matrix;
+	float alpha_factor;
+	return node->effect->get_color_matrix(&matrix, &alpha_factor);
+}
+
+bool EffectChain::is_lut_node(Node *node)
+{
+	if (node->disabled ||
+	    node->bypassable ||
+	    node->effect->num_inputs() != 1 ||
+	    node->incoming_links.size() != 1 ||
+	    !node->effect->is_pointwise()) {
+		return false;
+	}
+
+	// With blank alpha in and out, the output is a function
+	// of the input RGB only, which is what we can put in the LUT.
+	return node->output_alpha_type == ALPHA_BLANK &&
+	       node->incoming_links[0]->output_alpha_type == ALPHA_BLANK;
+}
+
+void EffectChain::find_runs(bool (EffectChain::*is_member)(Node *), vector<vector<Node *> > *runs)
+{
+	for (unsigned i = 0; i < nodes.size(); ++i) {
+		Node *node = nodes[i];
+		if (!(this->*is_member)(node)) {
+			continue;
+		}
+
+		// Only start at the beginning of a run.
+		Node *sender = node->incoming_links[0];
+		if ((this->*is_member)(sender) && sender->outgoing_links.size() == 1) {
+			continue;
+		}
+
+		vector<Node *> run;
+		run.push_back(node);
+		while (run.back()->outgoing_links.size() == 1 &&
+		       (this->*is_member)(run.back()->outgoing_links[0])) {
+			run.push_back(run.back()->outgoing_links[0]);
+		}
+		if (run.size() >= 2) {
+			runs->push_back(run);
+		}
+	}
+}
+
+// This runs after all the colorspace, gamma and alpha fixups, so that the
+// conversions inserted by them can be baked, too. The effects are moved
+// to the BakedLUTEffect's own chain, along with the formats we found for them
+// (the conversions are special-cased when propagating formats), so that
+// finalizing that chain will not need to insert anything; what goes into
+// the LUT is exactly what we would otherwise have computed.
+void EffectChain::bake_luts()
+{
+	if (lut_size == 0) {
+		return;
+	}
+	vector<vector<Node *> > runs;
+	find_runs(&EffectChain::is_lut_node, &runs);
+
+	for (unsigned run_num = 0; run_num < runs.size(); ++run_num) {
+		const vector<Node *> &run = runs[run_num];
+		const Node *sender = run.front()->incoming_links[0];
+
+		ImageFormat input_format, output_format;
+		input_format.color_space = sender->output_color_space;
+		input_format.gamma_curve = sender->output_gamma_curve;
+		output_format.color_space = run.back()->output_color_space;
+		output_format.gamma_curve = run.back()->output_gamma_curve;
+
+		BakedLUTEffect *lut_effect = new BakedLUTEffect(lut_size, input_format, resource_pool);
+		EffectChain *bake_chain = lut_effect->bake_chain;
+		for (unsigned i = 0; i < run.size(); ++i) {
+			Effect *effect = run[i]->effect;
+			bake_chain->add_effect(effect);
+			Node *baked_node = bake_chain->find_node_for_effect(effect);
+			baked_node->output_color_space = run[i]->output_color_space;
+			baked_node->output_gamma_curve = run[i]->output_gamma_curve;
+			lut_effect->effects.push_back(effect);
+		}
+		bake_chain->add_output(output_format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+		bake_chain->finalize();
+
+		Node *lut_node = add_node(lut_effect);
+		lut_node->output_color_space = run.back()->output_color_space;
+		lut_node->output_gamma_curve = run.back()->output_gamma_curve;
+		lut_node->output_alpha_type = ALPHA_BLANK;
+		replace_receiver(run.front(), lut_node);
+		replace_sender(run.back(), lut_node);
+		baked_lut_effects.push_back(lut_effect);
+
+		// The effects now belong to bake_chain, so the nodes must go.
+		for (unsigned i = 0; i < run.size(); ++i) {
+			node_map.erase(run[i]->effect);
+			nodes.erase(find(nodes.begin(), nodes.end(), run[i]));
+			delete run[i];
+		}
+	}
+}
+
+// Like bake_luts(), this runs after all the fixups. Nothing after this looks
+// at the effects' requirements again; the new node simply inherits
+// the output format of the last node in the run.
+void EffectChain::fold_color_matrices()
+{
+	vector<vector<Node *> > runs;
+	find_runs(&EffectChain::is_color_matrix_node, &runs);
+
+	for (unsigned run_num = 0; run_num < runs.size(); ++run_num) {
+		const vector<Node *> &run = runs[run_num];
+		vector<Effect *> effects;
+		for (unsigned j = 0; j < run.size(); ++j) {
+			effects.push_back(run[j]->effect);
+		}
+		Node *folded = add_node(new ColorMatrixEffect(effects));
+		folded->output_color_space = run.back()->output_color_space;
+		folded->output_gamma_curve = run.back()->output_gamma_curve;
+		folded->output_alpha_type = run.back()->output_alpha_type;
+		folded->folded_nodes = run;
+
+		replace_receiver(run.front(), folded);
+		replace_sender(run.back(), folded);
+		for (unsigned j = 0; j < run.size(); ++j) {
+			run[j]->incoming_links.clear();
+			run[j]->outgoing_links.clear();
+			run[j]->disabled = true;
+		}
+	}
+}
+
+// If the user has requested dither, add a DitherEffect right at the end
+// (after GammaCompressionEffect etc.). This needs to be done after everything else,
+// since dither is about the only effect that can _not_ be done in linear space.
+void EffectChain::add_dither_if_needed()
+{
+	if (num_dither_bits == 0) {
+		return;
+	}
+	Node *output = find_output_node();
+	Node *dither = add_node(new DitherEffect());
+	CHECK(dither->effect->set_int("num_bits", num_dither_bits));
+	connect_nodes(output, dither);
+
+	dither_effect = dither->effect;
+}
+
+// Find the output node. This is, simply, one that has no outgoing links.
+// If there are multiple ones, the graph is malformed (we do not support
+// multiple outputs right now).
+Node *EffectChain::find_output_node()
+{
+	vector<Node *> output_nodes;
+	for (unsigned i = 0; i < nodes.size(); ++i) {
+		Node *node = nodes[i];
+		if (node->disabled) {
+			continue;
+		}
+		if (node->outgoing_links.empty()) {
+			output_nodes.push_back(node);
+		}
+	}
+	assert(output_nodes.size() == 1);
+	return output_nodes[0];
+}
+
+void EffectChain::finalize()
+{
+	TraceScope trace("finalize", "EffectChain::finalize");
+
+	// Output the graph as it is before we do any conversions on it.
+	output_dot("step0-start.dot");
+
+	// Give each effect in turn a chance to rewrite its own part of the graph.
+	// Note that if more effects are added as part of this, they will be
+	// picked up as part of the same for loop, since they are added at the end.
+	uint64_t step_start_ns = get_monotonic_time_ns();
+	for (unsigned i = 0; i < nodes.size(); ++i) {
+		nodes[i]->effect->rewrite_graph(this, nodes[i]);
+	}
+	for (unsigned i = 0; i < nodes.size(); ++i) {
+		Node *node = nodes[i];
+		if (node->bypassable) {
+			// See set_bypassable().
+			assert(!node->disabled);
+			assert(node->incoming_links.size() == 1);
+			assert(!node->effect->changes_output_size());
+			assert(!node->effect->sets_virtual_output_size());
+			assert(node->effect->alpha_handling() != Effect::OUTPUT_BLANK_ALPHA);
+			assert(node->effect->alpha_handling() != Effect::OUTPUT_POSTMULTIPLIED_ALPHA);
+		}
+	}
+	add_trace_event("finalize", "rewrite_graph", step_start_ns, get_monotonic_time_ns() - step_start_ns);
+	output_dot("step1-rewritten.dot");
+
+	step_start_ns = get_monotonic_time_ns();
+
+	find_color_spaces_for_inputs();
+	output_dot("step2-input-colorspace.dot");
 
 	propagate_alpha();
 	output_dot("step3-propagated-alpha.dot");
@@ -1662,132 +2602,934 @@ void EffectChain::finalize()
 	fix_internal_gamma_by_asking_inputs(15);
 	fix_internal_gamma_by_inserting_nodes(16);
 
-	output_dot("step17-before-ycbcr.dot");
+	output_dot("step17-before-conversion-removal.dot");
+	remove_redundant_conversions();
+
+	output_dot("step18-before-common-subexpression-elimination.dot");
+	eliminate_common_subexpressions();
+
+	output_dot("step19-before-lut-baking.dot");
+	bake_luts();
+
+	output_dot("step20-before-color-matrix-folding.dot");
+	fold_color_matrices();
+
+	output_dot("step21-before-ycbcr.dot");
 	add_ycbcr_conversion_if_needed();
 
-	output_dot("step18-before-dither.dot");
+	output_dot("step22-before-dither.dot");
 	add_dither_if_needed();
+	add_trace_event("finalize", "graph fixups", step_start_ns, get_monotonic_time_ns() - step_start_ns);
+
+	output_dot("step23-final.dot");
+	
+	choose_nodes_to_recompute();
+
+	// Construct all needed GLSL programs, starting at the output.
+	// We need to keep track of which effects have already been computed,
+	// as an effect with multiple users could otherwise be calculated
+	// multiple times.
+	map<Node *, Phase *> completed_effects;
+	construct_phase(find_output_node(), &completed_effects);
+
+	output_dot("step24-split-to-phases.dot");
+
+	assert(phases[0]->inputs.empty());
+
+	compute_texture_lifetimes();
+	compute_upstream_nodes();
+
+	if (movit_sampler_objects_supported) {
+		glGenSamplers(2, rtt_sampler_objects);
+		check_error();
+		for (unsigned i = 0; i < 2; ++i) {
+			glSamplerParameteri(rtt_sampler_objects[i], GL_TEXTURE_MIN_FILTER, i == 1 ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR);
+			check_error();
+			glSamplerParameteri(rtt_sampler_objects[i], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			check_error();
+			glSamplerParameteri(rtt_sampler_objects[i], GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			check_error();
+			glSamplerParameteri(rtt_sampler_objects[i], GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			check_error();
+		}
+	}
+	
+	finalized = true;
+}
+
+void EffectChain::finalize_async()
+{
+	compile_programs_async = true;
+	finalize();
+}
+
+bool EffectChain::is_ready()
+{
+	assert(finalized);
+	for (unsigned i = 0; i < phases.size(); ++i) {
+		Phase *phase = phases[i];
+		if (phase->program_ready) {
+			continue;
+		}
+		if (!resource_pool->is_program_ready(phase->glsl_program_num)) {
+			return false;
+		}
+		finish_glsl_program(phase);
+	}
+	return true;
+}
+
+void EffectChain::wait_until_ready()
+{
+	assert(finalized);
+	for (unsigned i = 0; i < phases.size(); ++i) {
+		Phase *phase = phases[i];
+		if (!phase->program_ready) {
+			resource_pool->wait_for_program(phase->glsl_program_num);
+			finish_glsl_program(phase);
+		}
+	}
+}
+
+void EffectChain::commit(ParameterTransaction *transaction)
+{
+	pthread_mutex_lock(&committed_changes_lock);
+	committed_changes.insert(committed_changes.end(), transaction->changes.begin(), transaction->changes.end());
+	pthread_mutex_unlock(&committed_changes_lock);
+	transaction->clear();
+}
+
+void EffectChain::latch_committed_changes()
+{
+	pthread_mutex_lock(&committed_changes_lock);
+	swap(committed_changes, latched_changes);
+	pthread_mutex_unlock(&committed_changes_lock);
+
+	for (unsigned i = 0; i < latched_changes.size(); ++i) {
+		const ParameterTransaction::Change &change = latched_changes[i];
+		bool ok = change.int_handle.is_valid() ?
+			change.int_handle.set(change.int_value) :
+			change.float_handle.set_vec(change.float_values);
+		if (!ok) {
+			// Dropped; see ParameterTransaction.
+			fprintf(stderr, "Effect rejected a committed parameter value; ignoring.\n");
+		}
+	}
+	latched_changes.clear();
+}
+
+bool ParameterTransaction::set_int(Effect *effect, const string &key, int value)
+{
+	ParamHandle<int> handle = effect->get_int_handle(key);
+	if (!handle.is_valid()) {
+		return false;
+	}
+	set(handle, value);
+	return true;
+}
+
+bool ParameterTransaction::set_float(Effect *effect, const string &key, float value)
+{
+	ParamHandle<float> handle = effect->get_float_handle(key);
+	if (!handle.is_valid()) {
+		return false;
+	}
+	set(handle, value);
+	return true;
+}
+
+bool ParameterTransaction::set_vec2(Effect *effect, const string &key, const float *values)
+{
+	ParamHandle<float> handle = effect->get_vec2_handle(key);
+	if (!handle.is_valid()) {
+		return false;
+	}
+	set_vec(handle, values);
+	return true;
+}
+
+bool ParameterTransaction::set_vec3(Effect *effect, const string &key, const float *values)
+{
+	ParamHandle<float> handle = effect->get_vec3_handle(key);
+	if (!handle.is_valid()) {
+		return false;
+	}
+	set_vec(handle, values);
+	return true;
+}
+
+bool ParameterTransaction::set_vec4(Effect *effect, const string &key, const float *values)
+{
+	ParamHandle<float> handle = effect->get_vec4_handle(key);
+	if (!handle.is_valid()) {
+		return false;
+	}
+	set_vec(handle, values);
+	return true;
+}
+
+void ParameterTransaction::set(const ParamHandle<int> &handle, int value)
+{
+	assert(handle.is_valid());
+	assert(handle.get_num_values() == 1);
+	Change change;
+	change.int_handle = handle;
+	change.int_value = value;
+	changes.push_back(change);
+}
+
+void ParameterTransaction::set(const ParamHandle<float> &handle, float value)
+{
+	assert(handle.get_num_values() == 1);
+	set_vec(handle, &value);
+}
+
+void ParameterTransaction::set_vec(const ParamHandle<float> &handle, const float *values)
+{
+	assert(handle.is_valid());
+	Change change;
+	change.float_handle = handle;
+	change.int_value = 0;
+	memcpy(change.float_values, values, sizeof(float) * handle.get_num_values());
+	changes.push_back(change);
+}
+
+GLuint EffectChain::get_vao_for_current_context()
+{
+	void *context = get_gl_context_identifier();
+	map<void *, GLuint>::const_iterator vao_it = vaos.find(context);
+	if (vao_it != vaos.end()) {
+		return vao_it->second;
+	}
+
+	// Enabling an attribute that a given program doesn't use is harmless,
+	// so we can share one VAO between all the phases.
+	set<GLint> attribute_indexes;
+	for (unsigned i = 0; i < phases.size(); ++i) {
+		attribute_indexes.insert(phases[i]->attribute_indexes.begin(), phases[i]->attribute_indexes.end());
+	}
+	GLuint vao = resource_pool->create_vec2_vao(attribute_indexes, vbo);
+	vaos.insert(make_pair(context, vao));
+	return vao;
+}
+
+void EffectChain::render_to_fbo(GLuint dest_fbo, unsigned width, unsigned height)
+{
+	render(dest_fbo, width, height, NULL);
+}
+
+void EffectChain::render_to_fbo_region(GLuint dest_fbo, unsigned width, unsigned height,
+                                       unsigned region_x, unsigned region_y,
+                                       unsigned region_width, unsigned region_height)
+{
+	const unsigned region[] = { region_x, region_y, region_width, region_height };
+	render(dest_fbo, width, height, region);
+}
+
+void EffectChain::render(GLuint dest_fbo, unsigned width, unsigned height, const unsigned *region)
+{
+	assert(finalized);
+	TraceScope trace("frame", "EffectChain::render");
+
+	// This needs to come before anything looks at the parameters.
+	latch_committed_changes();
+
+	// Programs with frozen parameters (see Effect::freeze_parameter())
+	// that have changed since they were compiled need to be compiled anew.
+	for (unsigned i = 0; i < phases.size(); ++i) {
+		Phase *phase = phases[i];
+		if (frozen_values_changed(phase->frozen_ints) ||
+		    frozen_values_changed(phase->frozen_floats)) {
+			recompile_glsl_program(phase);
+		}
+	}
+
+	// If finalized with finalize_async(), the programs may not be done yet.
+	wait_until_ready();
+
+	// This needs to be set anew, in case we are coming from a different context
+	// from when we initialized.
+	check_error();
+	glDisable(GL_DITHER);
+	check_error();
+
+	// Save original viewport.
+	GLuint x = 0, y = 0;
+
+	if (width == 0 && height == 0) {
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		x = viewport[0];
+		y = viewport[1];
+		width = viewport[2];
+		height = viewport[3];
+	}
+
+	// Merged effects must keep having the same parameters
+	// (see enable_common_subexpression_elimination()). Parameters are
+	// only compared again if any of the effects have changed since
+	// the last time.
+	for (unsigned i = 0; i < nodes.size(); ++i) {
+		Node *node = nodes[i];
+		if (node->merged_nodes.empty()) {
+			continue;
+		}
+		bool changed = (node->effect->get_generation() != node->merged_generation);
+		for (unsigned j = 0; j < node->merged_nodes.size(); ++j) {
+			Node *merged = node->merged_nodes[j];
+			changed |= (merged->effect->get_generation() != merged->merged_generation);
+		}
+		if (!changed) {
+			continue;
+		}
+		for (unsigned j = 0; j < node->merged_nodes.size(); ++j) {
+			Node *merged = node->merged_nodes[j];
+			if (!node->effect->has_same_parameters(merged->effect)) {
+				fprintf(stderr, "Two merged %s effects no longer have the same parameters.\n",
+					node->effect->effect_type_id().c_str());
+				fprintf(stderr, "See EffectChain::enable_common_subexpression_elimination().\n");
+				exit(1);
+			}
+			merged->merged_generation = merged->effect->get_generation();
+		}
+		node->merged_generation = node->effect->get_generation();
+	}
+
+	// Bring the LUTs up to date with their effects' parameters. This renders
+	// (using its own chain), so it needs to come before we set up any state;
+	// it also needs to come before we check the phase cache.
+	for (unsigned i = 0; i < baked_lut_effects.size(); ++i) {
+		baked_lut_effects[i]->update_lut();
+	}
+
+	// Basic state.
+	check_error();
+	glDisable(GL_BLEND);
+	check_error();
+	glDisable(GL_DEPTH_TEST);
+	check_error();
+	glDepthMask(GL_FALSE);
+	check_error();
+
+	// If we are pipelining, make sure the GPU is done with the frame
+	// that last used this slot, so that we can reuse its textures.
+	FrameSlot *slot = NULL;
+	if (!frame_slots.empty()) {
+		slot = &frame_slots[frame_num % num_frames_in_flight];
+		recycle_frame_slot(slot);
+	}
+
+	// The VAO has all the attributes we need already set up.
+	glBindVertexArray(get_vao_for_current_context());
+	check_error();
+	unsigned num_bound_sampler_objects = 0;
+
+	set<Phase *> generated_mipmaps;
+
+	// If the phase cache budget has been lowered, make room.
+	for (unsigned phase_num = 0;
+	     phase_num < phases.size() && phase_cache_stats.cached_bytes > phase_cache_budget;
+	     ++phase_num) {
+		drop_cached_output(phases[phase_num], slot);
+	}
+
+	// Intermediate textures are allocated when a phase runs, and given back
+	// to the pool once their last consumer has run (see compute_texture_lifetimes()),
+	// unless they are kept in the phase cache. Phases that can be taken
+	// from the cache are not run at all.
+	map<Phase *, GLuint> output_textures;
+	set<Phase *> phases_to_execute;
+	find_phases_to_execute(&phases_to_execute, &output_textures);
+
+	// For region-of-interest rendering, we need to know the sizes of all
+	// phases up front, which are normally only computed as we go.
+	map<Phase *, Region> phase_regions;
+	if (region != NULL) {
+		assert(region[0] + region[2] <= width && region[1] + region[3] <= height);
+		for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+			inform_input_sizes(phases[phase_num]);
+			if (phase_num != phases.size() - 1) {
+				find_output_size(phases[phase_num]);
+			}
+		}
+
+		// Convert to texture coordinates of the final output.
+		Region output_region(float(region[0]) / width, float(region[1]) / height,
+		                     float(region[0] + region[2]) / width, float(region[1] + region[3]) / height);
+		if (output_origin == OUTPUT_ORIGIN_TOP_LEFT) {
+			output_region = Region(output_region.left, 1.0f - output_region.top,
+			                       output_region.right, 1.0f - output_region.bottom);
+		}
+		compute_phase_regions(output_region, &phase_regions);
+		glEnable(GL_SCISSOR_TEST);
+		check_error();
+	}
+	size_t uncached_intermediate_bytes = 0;
+	peak_intermediate_bytes = phase_cache_stats.cached_bytes;
+	phase_cache_stats.num_phases_skipped_last_frame = 0;
+
+	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+		Phase *phase = phases[phase_num];
+		if (phases_to_execute.count(phase) == 0) {
+			++phase_cache_stats.num_phases_skipped;
+			++phase_cache_stats.num_phases_skipped_last_frame;
+			continue;
+		}
+		++phase_cache_stats.num_phases_executed;
+
+		// If all of this phase's timer queries are still in flight,
+		// we skip measuring it this time instead of waiting.
+		bool measure_phase = false;
+		if (do_phase_timing) {
+			collect_phase_timing(phase, false);
+			if (phase->num_timer_queries_pending < phase->timer_query_objects.size()) {
+				glBeginQuery(GL_TIME_ELAPSED, phase->timer_query_objects[phase->next_timer_query]);
+				check_error();
+				measure_phase = true;
+			}
+		}
+		if (phase_num == phases.size() - 1) {
+			// Last phase goes to the output the user specified.
+			glBindFramebuffer(GL_FRAMEBUFFER, dest_fbo);
+			check_error();
+			GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+			assert(status == GL_FRAMEBUFFER_COMPLETE);
+			glViewport(x, y, width, height);
+			if (dither_effect != NULL) {
+				CHECK(dither_effect->set_int("output_width", width));
+				CHECK(dither_effect->set_int("output_height", height));
+			}
+			if (region != NULL) {
+				glScissor(x + region[0], y + region[1], region[2], region[3]);
+				check_error();
+			}
+		} else if (region != NULL) {
+			// Pad by a texel, in case of rounding and bilinear filtering.
+			const Region &r = phase_regions[phase];
+			int x0 = max<int>(lrintf(floor(r.left * phase->output_width)) - 1, 0);
+			int y0 = max<int>(lrintf(floor(r.bottom * phase->output_height)) - 1, 0);
+			int x1 = min<int>(lrintf(ceil(r.right * phase->output_width)) + 1, phase->output_width);
+			int y1 = min<int>(lrintf(ceil(r.top * phase->output_height)) + 1, phase->output_height);
+			glScissor(x0, y0, max(x1 - x0, 0), max(y1 - y0, 0));
+			check_error();
+		}
+		// Reading the clock is not free, so only do it if we are tracing.
+		uint64_t phase_start_ns = trace_recording_enabled() ? get_monotonic_time_ns() : 0;
+		execute_phase(phase, phase_num == phases.size() - 1, &num_bound_sampler_objects, &output_textures, &generated_mipmaps);
+		if (trace_recording_enabled()) {
+			add_trace_event("frame", get_phase_trace_name(phase), phase_start_ns, get_monotonic_time_ns() - phase_start_ns);
+		}
+		if (measure_phase) {
+			glEndQuery(GL_TIME_ELAPSED);
+			check_error();
+			phase->timer_query_submit_ns[phase->next_timer_query] = phase_start_ns;
+			phase->next_timer_query = (phase->next_timer_query + 1) % phase->timer_query_objects.size();
+			++phase->num_timer_queries_pending;
+		}
+
+		if (phase_num != phases.size() - 1) {
+			// Partially rendered outputs are of no use for later frames.
+			bool cached = false;
+			if (region == NULL) {
+				cached = update_phase_cache(phase, slot, output_textures[phase]);
+			} else {
+				drop_cached_output(phase, slot);
+			}
+			if (!cached) {
+				uncached_intermediate_bytes += ResourcePool::estimate_texture_size(
+					phase->intermediate_format, phase->output_width, phase->output_height);
+			}
+		}
+		peak_intermediate_bytes = max(peak_intermediate_bytes,
+			uncached_intermediate_bytes + phase_cache_stats.cached_bytes);
+
+		for (unsigned i = 0; i < phase->inputs_to_release.size(); ++i) {
+			Phase *input = phase->inputs_to_release[i];
+			map<Phase *, GLuint>::iterator texture_it = output_textures.find(input);
+			assert(texture_it != output_textures.end());
+			if (texture_it->second != input->cached_output_texture) {
+				release_intermediate_texture(slot, texture_it->second);
+				uncached_intermediate_bytes -= ResourcePool::estimate_texture_size(
+					input->intermediate_format, input->output_width, input->output_height);
+			}
+			output_textures.erase(texture_it);
+		}
+	}
+
+	// If the last consumer of an output was skipped, it is still around.
+	for (map<Phase *, GLuint>::const_iterator texture_it = output_textures.begin();
+	     texture_it != output_textures.end();
+	     ++texture_it) {
+		if (texture_it->second != texture_it->first->cached_output_texture) {
+			release_intermediate_texture(slot, texture_it->second);
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+	glUseProgram(0);
+	check_error();
+	if (region != NULL) {
+		glDisable(GL_SCISSOR_TEST);
+		check_error();
+	}
+
+	for (unsigned i = 0; i < num_bound_sampler_objects; ++i) {
+		glBindSampler(i, 0);
+		check_error();
+	}
+	glBindVertexArray(0);
+	check_error();
+
+	if (slot != NULL) {
+		slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		check_error();
+	}
+	++frame_num;
+}
+
+unsigned EffectChain::get_num_output_planes() const
+{
+	if (!output_color_ycbcr) {
+		return 1;
+	}
+	unsigned num_planes;
+	switch (output_ycbcr_splitting) {
+	case YCBCR_OUTPUT_INTERLEAVED:
+		num_planes = 1;
+		break;
+	case YCBCR_OUTPUT_SPLIT_Y_AND_CBCR:
+		num_planes = 2;
+		break;
+	case YCBCR_OUTPUT_PLANAR:
+		num_planes = 3;
+		break;
+	default:
+		assert(false);
+	}
+	if (output_color_rgba) {
+		++num_planes;
+	}
+	return num_planes;
+}
+
+namespace {
+
+// Number of bytes per pixel glReadPixels() will give us for the given format and type.
+size_t bytes_per_pixel_for_readback(GLenum format, GLenum type)
+{
+	switch (type) {
+	case GL_UNSIGNED_INT_2_10_10_10_REV:
+	case GL_UNSIGNED_INT_10F_11F_11F_REV:
+	case GL_UNSIGNED_INT_8_8_8_8_REV:
+		return 4;
+	case GL_UNSIGNED_SHORT_5_6_5:
+		return 2;
+	default:
+		break;
+	}
+
+	size_t num_components;
+	switch (format) {
+	case GL_RED:
+	case GL_GREEN:
+	case GL_BLUE:
+	case GL_ALPHA:
+		num_components = 1;
+		break;
+	case GL_RG:
+		num_components = 2;
+		break;
+	case GL_RGB:
+	case GL_BGR:
+		num_components = 3;
+		break;
+	case GL_RGBA:
+	case GL_BGRA:
+		num_components = 4;
+		break;
+	default:
+		// TODO: Add more here as needed.
+		assert(false);
+	}
+
+	size_t bytes_per_component;
+	switch (type) {
+	case GL_UNSIGNED_BYTE:
+		bytes_per_component = 1;
+		break;
+	case GL_UNSIGNED_SHORT:
+	case GL_HALF_FLOAT:
+		bytes_per_component = 2;
+		break;
+	case GL_FLOAT:
+		bytes_per_component = 4;
+		break;
+	default:
+		// TODO: Add more here as needed.
+		assert(false);
+	}
+	return num_components * bytes_per_component;
+}
+
+}  // namespace
+
+ReadbackTicket *EffectChain::render_to_buffer(GLint internal_format, unsigned width, unsigned height,
+                                              GLenum format, GLenum type)
+{
+	return render_to_buffer(internal_format, width, height, vector<GLenum>(get_num_output_planes(), format), type);
+}
+
+ReadbackTicket *EffectChain::render_to_buffer(GLint internal_format, unsigned width, unsigned height,
+                                              const vector<GLenum> &plane_formats, GLenum type)
+{
+	assert(finalized);
+	assert(movit_sync_objects_supported);
+	assert(width > 0 && height > 0);
+
+	const unsigned num_planes = get_num_output_planes();
+	assert(plane_formats.size() == num_planes);
+	assert(num_planes <= 4);
+
+	GLuint textures[4] = { 0, 0, 0, 0 };
+	for (unsigned i = 0; i < num_planes; ++i) {
+		textures[i] = resource_pool->create_2d_texture(internal_format, width, height);
+	}
+	GLuint fbo = resource_pool->create_fbo(textures[0], textures[1], textures[2], textures[3]);
+
+	render_to_fbo(fbo, width, height);
+
+	ReadbackTicket *ticket = new ReadbackTicket(resource_pool);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+
+	// The planes are sized for tightly packed rows, so make sure the
+	// pack state asks for that, whatever the application has set.
+	GLint old_pack_alignment, old_pack_row_length;
+	glGetIntegerv(GL_PACK_ALIGNMENT, &old_pack_alignment);
+	check_error();
+	glGetIntegerv(GL_PACK_ROW_LENGTH, &old_pack_row_length);
+	check_error();
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	check_error();
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+	check_error();
+
+	for (unsigned i = 0; i < num_planes; ++i) {
+		size_t plane_size = width * height * bytes_per_pixel_for_readback(plane_formats[i], type);
+		GLuint pbo = resource_pool->create_pbo(plane_size);
+		ticket->pbos.push_back(pbo);
+		ticket->plane_sizes.push_back(plane_size);
+
+		glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+		check_error();
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+		check_error();
+		glReadPixels(0, 0, width, height, plane_formats[i], type, BUFFER_OFFSET(0));
+		check_error();
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	check_error();
+	glPixelStorei(GL_PACK_ALIGNMENT, old_pack_alignment);
+	check_error();
+	glPixelStorei(GL_PACK_ROW_LENGTH, old_pack_row_length);
+	check_error();
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+
+	ticket->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	check_error();
 
-	output_dot("step19-final.dot");
-	
-	// Construct all needed GLSL programs, starting at the output.
-	// We need to keep track of which effects have already been computed,
-	// as an effect with multiple users could otherwise be calculated
-	// multiple times.
-	map<Node *, Phase *> completed_effects;
-	construct_phase(find_output_node(), &completed_effects);
+	// Make sure the fence actually gets to the GPU, or poll() could
+	// wait forever.
+	glFlush();
+	check_error();
 
-	output_dot("step20-split-to-phases.dot");
+	// The copies are queued up after the rendering, so the textures can
+	// safely be reused by anything coming after us.
+	resource_pool->release_fbo(fbo);
+	for (unsigned i = 0; i < num_planes; ++i) {
+		release_texture_when_idle(textures[i]);
+	}
 
-	assert(phases[0]->inputs.empty());
-	
-	finalized = true;
+	return ticket;
 }
 
-void EffectChain::render_to_fbo(GLuint dest_fbo, unsigned width, unsigned height)
+ReadbackTicket::~ReadbackTicket()
 {
-	assert(finalized);
+	for (unsigned i = 0; i < mapped_planes.size(); ++i) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+		check_error();
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		check_error();
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	check_error();
+	if (fence != 0) {
+		glDeleteSync(fence);
+		check_error();
+	}
+	for (unsigned i = 0; i < pbos.size(); ++i) {
+		resource_pool->release_pbo(pbos[i]);
+	}
+}
 
-	// This needs to be set anew, in case we are coming from a different context
-	// from when we initialized.
+bool ReadbackTicket::poll()
+{
+	if (done) {
+		return true;
+	}
+	GLenum status = glClientWaitSync(fence, 0, 0);
 	check_error();
-	glDisable(GL_DITHER);
+	assert(status != GL_WAIT_FAILED);
+	if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+		done = true;
+	}
+	return done;
+}
+
+const vector<const void *> &ReadbackTicket::wait()
+{
+	if (!mapped_planes.empty()) {
+		return mapped_planes;
+	}
+	if (!done) {
+		GLenum status;
+		do {
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);  // 1 second.
+			check_error();
+			assert(status != GL_WAIT_FAILED);
+		} while (status == GL_TIMEOUT_EXPIRED);
+		done = true;
+	}
+	for (unsigned i = 0; i < pbos.size(); ++i) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+		check_error();
+		const void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, plane_sizes[i], GL_MAP_READ_BIT);
+		check_error();
+		assert(ptr != NULL);
+		mapped_planes.push_back(ptr);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 	check_error();
+	return mapped_planes;
+}
 
-	// Save original viewport.
-	GLuint x = 0, y = 0;
+void EffectChain::set_frames_in_flight(unsigned num_frames)
+{
+	assert(!finalized);
+	assert(num_frames >= 1);
+	if (num_frames > 1) {
+		assert(movit_sync_objects_supported);
+	}
+	num_frames_in_flight = num_frames;
+	frame_slots.clear();
+	if (num_frames > 1) {
+		FrameSlot empty_slot;
+		empty_slot.fence = 0;
+		frame_slots.resize(num_frames, empty_slot);
+	}
+}
 
-	if (width == 0 && height == 0) {
-		GLint viewport[4];
-		glGetIntegerv(GL_VIEWPORT, viewport);
-		x = viewport[0];
-		y = viewport[1];
-		width = viewport[2];
-		height = viewport[3];
+void EffectChain::release_texture_when_idle(GLuint texture_num)
+{
+	if (frame_slots.empty() || frame_num == 0) {
+		resource_pool->release_2d_texture(texture_num);
+	} else {
+		// The texture could have been used by the last frame we rendered.
+		FrameSlot *slot = &frame_slots[(frame_num - 1) % num_frames_in_flight];
+		slot->textures_to_release.push_back(texture_num);
 	}
+}
 
-	// Basic state.
-	check_error();
-	glDisable(GL_BLEND);
-	check_error();
-	glDisable(GL_DEPTH_TEST);
-	check_error();
-	glDepthMask(GL_FALSE);
-	check_error();
+void EffectChain::recycle_frame_slot(FrameSlot *slot)
+{
+	if (slot->fence != 0) {
+		GLenum status;
+		do {
+			status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);  // 1 second.
+			check_error();
+			assert(status != GL_WAIT_FAILED);
+		} while (status == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(slot->fence);
+		check_error();
+		slot->fence = 0;
+	}
+	for (unsigned i = 0; i < slot->textures_to_release.size(); ++i) {
+		resource_pool->release_2d_texture(slot->textures_to_release[i]);
+	}
+	slot->textures_to_release.clear();
+}
 
-	// Generate a VAO that will be used during the entire execution,
-	// and bind the VBO, since it contains all the data.
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	check_error();
-	glBindVertexArray(vao);
-	check_error();
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	check_error();
-	set<GLint> bound_attribute_indices;
+namespace {
 
-	set<Phase *> generated_mipmaps;
+Region union_region(const Region &a, const Region &b)
+{
+	return Region(min(a.left, b.left), min(a.bottom, b.bottom),
+	              max(a.right, b.right), max(a.top, b.top));
+}
 
-	// We choose the simplest option of having one texture per output,
-	// since otherwise this turns into an (albeit simple) register allocation problem.
-	map<Phase *, GLuint> output_textures;
+}  // namespace
 
-	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+void EffectChain::compute_phase_regions(const Region &output_region,
+                                        map<Phase *, Region> *phase_regions)
+{
+	(*phase_regions)[phases.back()] = output_region;
+
+	// Since <phases> is in execution order, all consumers of a phase have
+	// been handled by the time we get to it when going backwards.
+	for (int phase_num = phases.size() - 1; phase_num >= 0; --phase_num) {
 		Phase *phase = phases[phase_num];
+		assert(phase_regions->count(phase));
+
+		// Go backwards through the effects in the phase, too, growing
+		// the region as needed for each one.
+		map<Node *, Region> node_regions;
+		node_regions[phase->output_node] = (*phase_regions)[phase];
+		for (int i = phase->effects.size() - 1; i >= 0; --i) {
+			Node *node = phase->effects[i];
+			if (node_regions.count(node) == 0) {
+				continue;
+			}
+			for (unsigned j = 0; j < node->incoming_links.size(); ++j) {
+				Node *input = node->incoming_links[j];
+				Region input_region = node->effect->get_input_footprint(j, node_regions[node]);
+
+				Phase *input_phase = NULL;
+				if (find(phase->effects.begin(), phase->effects.end(), input) == phase->effects.end()) {
+					// Comes from an earlier phase.
+					for (unsigned k = 0; k < phase->inputs.size(); ++k) {
+						if (phase->inputs[k]->output_node == input) {
+							input_phase = phase->inputs[k];
+						}
+					}
+					assert(input_phase != NULL);
+					if (phase->input_needs_mipmaps) {
+						// Every mipmap level needs to be correct, so play it safe.
+						input_region = Region(0.0f, 0.0f, 1.0f, 1.0f);
+					}
+				}
 
-		if (do_phase_timing) {
-			glBeginQuery(GL_TIME_ELAPSED, phase->timer_query_object);
-		}
-		if (phase_num == phases.size() - 1) {
-			// Last phase goes to the output the user specified.
-			glBindFramebuffer(GL_FRAMEBUFFER, dest_fbo);
-			check_error();
-			GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
-			assert(status == GL_FRAMEBUFFER_COMPLETE);
-			glViewport(x, y, width, height);
-			if (dither_effect != NULL) {
-				CHECK(dither_effect->set_int("output_width", width));
-				CHECK(dither_effect->set_int("output_height", height));
+				if (input_phase != NULL) {
+					map<Phase *, Region>::iterator region_it = phase_regions->find(input_phase);
+					if (region_it == phase_regions->end()) {
+						phase_regions->insert(make_pair(input_phase, input_region));
+					} else {
+						region_it->second = union_region(region_it->second, input_region);
+					}
+				} else {
+					map<Node *, Region>::iterator region_it = node_regions.find(input);
+					if (region_it == node_regions.end()) {
+						node_regions.insert(make_pair(input, input_region));
+					} else {
+						region_it->second = union_region(region_it->second, input_region);
+					}
+				}
 			}
 		}
-		execute_phase(phase, phase_num == phases.size() - 1, &bound_attribute_indices, &output_textures, &generated_mipmaps);
-		if (do_phase_timing) {
-			glEndQuery(GL_TIME_ELAPSED);
-		}
 	}
+}
 
-	for (map<Phase *, GLuint>::const_iterator texture_it = output_textures.begin();
-	     texture_it != output_textures.end();
-	     ++texture_it) {
-		resource_pool->release_2d_texture(texture_it->second);
+bool EffectChain::phase_cache_is_valid(Phase *phase) const
+{
+	if (phase->cached_output_texture == 0) {
+		return false;
+	}
+	assert(phase->executed_generations.size() == phase->upstream_nodes.size());
+	for (unsigned i = 0; i < phase->upstream_nodes.size(); ++i) {
+		if (phase->upstream_nodes[i]->effect->get_generation() != phase->executed_generations[i]) {
+			return false;
+		}
 	}
+	return true;
+}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	check_error();
-	glUseProgram(0);
-	check_error();
+void EffectChain::find_phases_to_execute(set<Phase *> *phases_to_execute,
+                                         map<Phase *, GLuint> *output_textures)
+{
+	// Work backwards from the output; a phase needs to run if a phase
+	// that runs reads from it, and there is no valid cached output for it.
+	phases_to_execute->insert(phases.back());
+	for (int phase_num = phases.size() - 1; phase_num >= 0; --phase_num) {
+		Phase *phase = phases[phase_num];
+		if (phases_to_execute->count(phase) == 0) {
+			continue;
+		}
+		for (unsigned i = 0; i < phase->inputs.size(); ++i) {
+			Phase *input = phase->inputs[i];
+			if (output_textures->count(input)) {
+				continue;
+			}
+			if (phase_cache_is_valid(input)) {
+				output_textures->insert(make_pair(input, input->cached_output_texture));
+			} else {
+				phases_to_execute->insert(input);
+			}
+		}
+	}
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	check_error();
-	glBindVertexArray(0);
-	check_error();
-	glDeleteVertexArrays(1, &vao);
-	check_error();
+bool EffectChain::update_phase_cache(Phase *phase, FrameSlot *slot, GLuint output_texture)
+{
+	// If we had a cached output, it was stale, or we would not have run the phase.
+	drop_cached_output(phase, slot);
+	if (phase_cache_budget == 0) {
+		return false;
+	}
 
-	if (do_phase_timing) {
-		// Get back the timer queries.
-		for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
-			Phase *phase = phases[phase_num];
-			GLint available = 0;
-			while (!available) {
-				glGetQueryObjectiv(phase->timer_query_object, GL_QUERY_RESULT_AVAILABLE, &available);
+	// Record what the new output depends on, and see if any of it changed
+	// since the last time we ran (if we have done so at all).
+	bool changed = false;
+	if (phase->executed_generations.empty()) {
+		phase->executed_generations.resize(phase->upstream_nodes.size());
+		for (unsigned i = 0; i < phase->upstream_nodes.size(); ++i) {
+			phase->executed_generations[i] = phase->upstream_nodes[i]->effect->get_generation();
+		}
+	} else {
+		for (unsigned i = 0; i < phase->upstream_nodes.size(); ++i) {
+			unsigned generation = phase->upstream_nodes[i]->effect->get_generation();
+			if (generation != phase->executed_generations[i]) {
+				phase->executed_generations[i] = generation;
+				changed = true;
 			}
-			GLuint64 time_elapsed;
-			glGetQueryObjectui64v(phase->timer_query_object, GL_QUERY_RESULT, &time_elapsed);
-			phase->time_elapsed_ns += time_elapsed;
-			++phase->num_measured_iterations;
 		}
 	}
+	if (changed) {
+		return false;
+	}
+
+	size_t bytes = ResourcePool::estimate_texture_size(
+		phase->intermediate_format, phase->output_width, phase->output_height);
+	if (phase_cache_stats.cached_bytes + bytes > phase_cache_budget) {
+		return false;
+	}
+	phase->cached_output_texture = output_texture;
+	phase->cached_output_bytes = bytes;
+	phase_cache_stats.cached_bytes += bytes;
+	return true;
+}
+
+void EffectChain::drop_cached_output(Phase *phase, FrameSlot *slot)
+{
+	if (phase->cached_output_texture == 0) {
+		return;
+	}
+	release_intermediate_texture(slot, phase->cached_output_texture);
+	phase_cache_stats.cached_bytes -= phase->cached_output_bytes;
+	phase->cached_output_texture = 0;
+	phase->cached_output_bytes = 0;
+}
+
+void EffectChain::release_intermediate_texture(FrameSlot *slot, GLuint texture_num)
+{
+	if (slot == NULL) {
+		resource_pool->release_2d_texture(texture_num);
+	} else {
+		slot->textures_to_release.push_back(texture_num);
+	}
 }
 
 void EffectChain::enable_phase_timing(bool enable)
@@ -1802,9 +3544,179 @@ void EffectChain::reset_phase_timing()
 {
 	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
 		Phase *phase = phases[phase_num];
+		phase->num_timer_queries_to_discard = phase->num_timer_queries_pending;
 		phase->time_elapsed_ns = 0;
+		phase->min_time_elapsed_ns = 0;
+		phase->max_time_elapsed_ns = 0;
 		phase->num_measured_iterations = 0;
+		phase->recent_time_elapsed_ns.clear();
+		phase->next_recent_time = 0;
+		fill(phase->set_gl_state_time_ns.begin(), phase->set_gl_state_time_ns.end(), 0);
+		phase->num_timed_executions = 0;
+	}
+}
+
+void EffectChain::collect_phase_timing(Phase *phase, bool wait)
+{
+	while (phase->num_timer_queries_pending > 0) {
+		unsigned num_queries = phase->timer_query_objects.size();
+		unsigned query_index = (phase->next_timer_query + num_queries - phase->num_timer_queries_pending) % num_queries;
+		GLuint query = phase->timer_query_objects[query_index];
+		if (!wait) {
+			GLint available = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			check_error();
+			if (!available) {
+				break;
+			}
+		}
+		GLuint64 time_elapsed;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &time_elapsed);
+		check_error();
+		--phase->num_timer_queries_pending;
+		if (trace_recording_enabled() && phase->timer_query_submit_ns[query_index] != 0) {
+			add_gpu_trace_event("gpu", get_phase_trace_name(phase),
+			                    phase->timer_query_submit_ns[query_index], time_elapsed);
+		}
+		if (phase->num_timer_queries_to_discard > 0) {
+			--phase->num_timer_queries_to_discard;
+			continue;
+		}
+
+		if (phase->num_measured_iterations == 0) {
+			phase->min_time_elapsed_ns = phase->max_time_elapsed_ns = time_elapsed;
+		} else {
+			phase->min_time_elapsed_ns = min<uint64_t>(phase->min_time_elapsed_ns, time_elapsed);
+			phase->max_time_elapsed_ns = max<uint64_t>(phase->max_time_elapsed_ns, time_elapsed);
+		}
+		phase->time_elapsed_ns += time_elapsed;
+		++phase->num_measured_iterations;
+
+		if (phase->recent_time_elapsed_ns.size() < num_recent_times_per_phase) {
+			phase->recent_time_elapsed_ns.push_back(time_elapsed);
+		} else {
+			phase->recent_time_elapsed_ns[phase->next_recent_time] = time_elapsed;
+			phase->next_recent_time = (phase->next_recent_time + 1) % num_recent_times_per_phase;
+		}
+	}
+}
+
+vector<PhaseTiming> EffectChain::get_phase_timing()
+{
+	vector<PhaseTiming> timings;
+	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+		Phase *phase = phases[phase_num];
+		collect_phase_timing(phase, false);
+
+		PhaseTiming timing;
+		for (unsigned effect_num = 0; effect_num < phase->effects.size(); ++effect_num) {
+			timing.effects.push_back(phase->effects[effect_num]->effect);
+			if (phase->num_timed_executions == 0) {
+				timing.avg_set_gl_state_ms.push_back(0.0);
+			} else {
+				timing.avg_set_gl_state_ms.push_back(
+					phase->set_gl_state_time_ns[effect_num] * 1e-6 / phase->num_timed_executions);
+			}
+		}
+
+		timing.num_measured_iterations = phase->num_measured_iterations;
+		if (phase->num_measured_iterations == 0) {
+			timing.min_gpu_ms = timing.avg_gpu_ms = timing.p95_gpu_ms = timing.max_gpu_ms = 0.0;
+		} else {
+			timing.min_gpu_ms = phase->min_time_elapsed_ns * 1e-6;
+			timing.avg_gpu_ms = phase->time_elapsed_ns * 1e-6 / phase->num_measured_iterations;
+			timing.max_gpu_ms = phase->max_time_elapsed_ns * 1e-6;
+
+			vector<uint64_t> recent = phase->recent_time_elapsed_ns;
+			vector<uint64_t>::iterator p95_it = recent.begin() + (recent.size() * 95) / 100;
+			if (p95_it == recent.end()) {
+				--p95_it;
+			}
+			nth_element(recent.begin(), p95_it, recent.end());
+			timing.p95_gpu_ms = *p95_it * 1e-6;
+		}
+		timings.push_back(timing);
+	}
+	return timings;
+}
+
+PhaseCostModel EffectChain::estimate_phase_cost_model()
+{
+	assert(finalized);
+	vector<PhaseTiming> timings = get_phase_timing();
+
+	// For each phase that has been measured, the estimated number of
+	// ALU operations, texture fetches and texture bytes per pixel,
+	// and the measured time per pixel.
+	vector<Eigen::Vector3d> work;
+	vector<double> time_ns;
+	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
+		Phase *phase = phases[phase_num];
+		if (timings[phase_num].num_measured_iterations == 0 ||
+		    phase->output_width == 0 || phase->output_height == 0) {
+			continue;
+		}
+		Eigen::Vector3d phase_work(0.0, 0.0, 0.0);
+		for (unsigned i = 0; i < phase->effects.size(); ++i) {
+			Effect *effect = phase->effects[i]->effect;
+			if (effect->num_inputs() == 0) {
+				phase_work[1] += 1.0;
+				phase_work[2] += ResourcePool::estimate_texture_size(GL_RGBA8, 1, 1);
+			} else {
+				phase_work[0] += effect->estimated_alu_ops();
+				phase_work[1] += effect->estimated_texture_fetches();
+			}
+		}
+		for (unsigned i = 0; i < phase->inputs.size(); ++i) {
+			phase_work[1] += 1.0;
+			phase_work[2] += ResourcePool::estimate_texture_size(phase->inputs[i]->intermediate_format, 1, 1);
+		}
+		if (phase_num == phases.size() - 1) {
+			phase_work[2] += ResourcePool::estimate_texture_size(GL_RGBA8, 1, 1);
+		} else {
+			phase_work[2] += ResourcePool::estimate_texture_size(phase->intermediate_format, 1, 1);
+		}
+		work.push_back(phase_work);
+		time_ns.push_back(timings[phase_num].avg_gpu_ms * 1e6 / (double(phase->output_width) * phase->output_height));
+	}
+
+	PhaseCostModel model = phase_cost_model;
+	if (work.empty()) {
+		return model;
+	}
+
+	// Least-squares fit of the three costs, if we have enough phases
+	// (and they differ enough) to give a sensible answer.
+	if (work.size() >= 3) {
+		Eigen::Matrix3d ata = Eigen::Matrix3d::Zero();
+		Eigen::Vector3d atb = Eigen::Vector3d::Zero();
+		for (unsigned i = 0; i < work.size(); ++i) {
+			ata += work[i] * work[i].transpose();
+			atb += work[i] * time_ns[i];
+		}
+		Eigen::Vector3d costs = ata.ldlt().solve(atb);
+		if (costs[0] > 0.0 && costs[1] > 0.0 && costs[2] > 0.0) {
+			model.alu_op_cost = costs[0];
+			model.texture_fetch_cost = costs[1];
+			model.byte_cost = costs[2];
+			return model;
+		}
 	}
+
+	// If not, keep the ratios, and only scale to match the total time.
+	const Eigen::Vector3d costs(model.alu_op_cost, model.texture_fetch_cost, model.byte_cost);
+	double estimated_ns = 0.0, measured_ns = 0.0;
+	for (unsigned i = 0; i < work.size(); ++i) {
+		estimated_ns += work[i].dot(costs);
+		measured_ns += time_ns[i];
+	}
+	if (estimated_ns > 0.0 && measured_ns > 0.0) {
+		const double scale = measured_ns / estimated_ns;
+		model.alu_op_cost *= scale;
+		model.texture_fetch_cost *= scale;
+		model.byte_cost *= scale;
+	}
+	return model;
 }
 
 void EffectChain::print_phase_timing()
@@ -1812,7 +3724,11 @@ void EffectChain::print_phase_timing()
 	double total_time_ms = 0.0;
 	for (unsigned phase_num = 0; phase_num < phases.size(); ++phase_num) {
 		Phase *phase = phases[phase_num];
-		double avg_time_ms = phase->time_elapsed_ns * 1e-6 / phase->num_measured_iterations;
+		collect_phase_timing(phase, true);
+		double avg_time_ms = 0.0;
+		if (phase->num_measured_iterations > 0) {
+			avg_time_ms = phase->time_elapsed_ns * 1e-6 / phase->num_measured_iterations;
+		}
 		printf("Phase %d: %5.1f ms  [", phase_num, avg_time_ms);
 		for (unsigned effect_num = 0; effect_num < phase->effects.size(); ++effect_num) {
 			if (effect_num != 0) {
@@ -1827,7 +3743,7 @@ void EffectChain::print_phase_timing()
 }
 
 void EffectChain::execute_phase(Phase *phase, bool last_phase,
-                                set<GLint> *bound_attribute_indices,
+                                unsigned *num_bound_sampler_objects,
                                 map<Phase *, GLuint> *output_textures,
                                 set<Phase *> *generated_mipmaps)
 {
@@ -1838,7 +3754,7 @@ void EffectChain::execute_phase(Phase *phase, bool last_phase,
 	if (!last_phase) {
 		find_output_size(phase);
 
-		GLuint tex_num = resource_pool->create_2d_texture(GL_RGBA16F, phase->output_width, phase->output_height);
+		GLuint tex_num = resource_pool->create_2d_texture(phase->intermediate_format, phase->output_width, phase->output_height);
 		output_textures->insert(make_pair(phase, tex_num));
 	}
 
@@ -1857,10 +3773,24 @@ void EffectChain::execute_phase(Phase *phase, bool last_phase,
 			check_error();
 			generated_mipmaps->insert(input);
 		}
-		setup_rtt_sampler(sampler, phase->input_needs_mipmaps);
+		if (phase->use_sampler_objects) {
+			glBindSampler(sampler, rtt_sampler_objects[phase->input_needs_mipmaps]);
+			check_error();
+		} else {
+			setup_rtt_sampler(sampler, phase->input_needs_mipmaps);
+		}
 		phase->input_samplers[sampler] = sampler;  // Bind the sampler to the right uniform.
 	}
 
+	// Unbind any sampler objects left over from earlier phases, so that they
+	// do not override the state of the textures bound by the effects.
+	unsigned num_needed_sampler_objects = phase->use_sampler_objects ? phase->inputs.size() : 0;
+	for (unsigned i = num_needed_sampler_objects; i < *num_bound_sampler_objects; ++i) {
+		glBindSampler(i, 0);
+		check_error();
+	}
+	*num_bound_sampler_objects = num_needed_sampler_objects;
+
 	// And now the output. (Already set up for us if it is the last phase.)
 	if (!last_phase) {
 		fbo = resource_pool->create_fbo((*output_textures)[phase]);
@@ -1873,8 +3803,12 @@ void EffectChain::execute_phase(Phase *phase, bool last_phase,
 	for (unsigned i = 0; i < phase->effects.size(); ++i) {
 		Node *node = phase->effects[i];
 		unsigned old_sampler_num = sampler_num;
+		uint64_t start_ns = do_phase_timing ? get_monotonic_time_ns() : 0;
 		node->effect->set_gl_state(phase->glsl_program_num, phase->effect_ids[node], &sampler_num);
 		check_error();
+		if (do_phase_timing) {
+			phase->set_gl_state_time_ns[i] += get_monotonic_time_ns() - start_ns;
+		}
 
 		if (node->effect->is_single_texture()) {
 			assert(sampler_num - old_sampler_num == 1);
@@ -1884,35 +3818,14 @@ void EffectChain::execute_phase(Phase *phase, bool last_phase,
 		}
 	}
 
+	if (do_phase_timing) {
+		++phase->num_timed_executions;
+	}
+
 	// Uniforms need to come after set_gl_state(), since they can be updated
 	// from there.
 	setup_uniforms(phase);
 
-	// Clean up old attributes if they are no longer needed.
-	for (set<GLint>::iterator attr_it = bound_attribute_indices->begin();
-	     attr_it != bound_attribute_indices->end(); ) {
-		if (phase->attribute_indexes.count(*attr_it) == 0) {
-			glDisableVertexAttribArray(*attr_it);
-			check_error();
-			bound_attribute_indices->erase(attr_it++);
-		} else {
-			++attr_it;
-		}
-	}
-
-	// Set up the new attributes, if needed.
-	for (set<GLint>::iterator attr_it = phase->attribute_indexes.begin();
-	     attr_it != phase->attribute_indexes.end();
-	     ++attr_it) {
-		if (bound_attribute_indices->count(*attr_it) == 0) {
-			glEnableVertexAttribArray(*attr_it);
-			check_error();
-			glVertexAttribPointer(*attr_it, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-			check_error();
-			bound_attribute_indices->insert(*attr_it);
-		}
-	}
-
 	glDrawArrays(GL_TRIANGLES, 0, 3);
 	check_error();
 	
@@ -1928,7 +3841,12 @@ void EffectChain::execute_phase(Phase *phase, bool last_phase,
 
 void EffectChain::setup_uniforms(Phase *phase)
 {
-	// TODO: Use UBO blocks.
+	if (phase->uniform_buffer != 0) {
+		upload_uniform_block(phase);
+	}
+
+	// Anything not in the uniform block (at least the samplers)
+	// still needs to be set one by one.
 	for (size_t i = 0; i < phase->uniforms_sampler2d.size(); ++i) {
 		const Uniform<int> &uniform = phase->uniforms_sampler2d[i];
 		if (uniform.location != -1) {
@@ -1988,6 +3906,48 @@ void EffectChain::setup_uniforms(Phase *phase)
 	}
 }
 
+void EffectChain::upload_uniform_block(Phase *phase)
+{
+	unsigned char *block = &phase->uniform_block_scratch[0];
+	pack_uniform_block_members<bool, int>(phase->uniforms_bool, 1, block);
+	pack_uniform_block_members<int, int>(phase->uniforms_int, 1, block);
+	pack_uniform_block_members<float, float>(phase->uniforms_float, 1, block);
+	pack_uniform_block_members<float, float>(phase->uniforms_vec2, 2, block);
+	pack_uniform_block_members<float, float>(phase->uniforms_vec3, 3, block);
+	pack_uniform_block_members<float, float>(phase->uniforms_vec4, 4, block);
+	pack_uniform_block_matrices(phase->uniforms_mat3, block);
+
+	// Upload each run of changed vec4s with a single call. Most effects
+	// keep their parameters constant from frame to frame, so usually,
+	// there is nothing to do at all.
+	glBindBuffer(GL_UNIFORM_BUFFER, phase->uniform_buffer);
+	check_error();
+	const unsigned char *old_block = &phase->uniform_block_data[0];
+	const size_t size = phase->uniform_block_scratch.size();
+	size_t pos = 0;
+	while (pos < size) {
+		if (phase->uniform_block_uploaded && memcmp(block + pos, old_block + pos, 16) == 0) {
+			pos += 16;
+			continue;
+		}
+		size_t start = pos;
+		while (pos < size &&
+		       (!phase->uniform_block_uploaded || memcmp(block + pos, old_block + pos, 16) != 0)) {
+			pos += 16;
+		}
+		glBufferSubData(GL_UNIFORM_BUFFER, start, pos - start, block + start);
+		check_error();
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	check_error();
+
+	swap(phase->uniform_block_data, phase->uniform_block_scratch);
+	phase->uniform_block_uploaded = true;
+
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, phase->uniform_buffer);
+	check_error();
+}
+
 void EffectChain::setup_rtt_sampler(int sampler_num, bool use_mipmaps)
 {
 	glActiveTexture(GL_TEXTURE0 + sampler_num);
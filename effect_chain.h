@@ -22,10 +22,13 @@
 // allocate your own ResourcePool, but let EffectChain hold its own.
 
 #include <epoxy/gl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <map>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 #include <Eigen/Core>
 
@@ -35,6 +38,7 @@
 
 namespace movit {
 
+class BakedLUTEffect;
 class Effect;
 class Input;
 struct Phase;
@@ -98,6 +102,37 @@ enum OutputOrigin {
 	OUTPUT_ORIGIN_TOP_LEFT,
 };
 
+// What storage format to use for intermediate (RTT) textures between phases.
+// The default is to always use fp16 RGBA, which has plenty of precision and
+// range for anything Movit does. However, it costs eight bytes per pixel
+// of bandwidth both to write and read, so if you know what you are doing,
+// you can ask EffectChain to choose a narrower format per phase, based on
+// the alpha and gamma information it knows about the phase's output.
+// The chosen format is shown in the graphs written by output_dot()
+// when debugging is turned on.
+enum IntermediateFormatPolicy {
+	// Always GL_RGBA16F.
+	INTERMEDIATE_FORMAT_ALWAYS_FP16,
+
+	// Use GL_RGB10_A2 for gamma-compressed phase outputs with blank alpha,
+	// if we know the final output has at most eight bits per channel
+	// (ie., set_dither_bits() has been called with a value from 1 to 8).
+	// Gamma-compressed values are perceptually spaced, so ten bits is
+	// more than enough not to affect an eight-bit result. Note that
+	// values outside [0,1] will be clamped, which could matter for
+	// effects that work in gamma-compressed space and overshoot.
+	INTERMEDIATE_FORMAT_NARROW_WHEN_SAFE,
+
+	// As INTERMEDIATE_FORMAT_NARROW_WHEN_SAFE, but also use GL_RGBA8 for
+	// gamma-compressed outputs with alpha, and (on desktop OpenGL)
+	// GL_R11F_G11F_B10F for linear-light outputs with blank alpha.
+	// The latter has only six or five bits of mantissa and no sign,
+	// so this will lose visible precision in some cases and clamp
+	// out-of-gamut colors; only use it if you have tested that the
+	// results are good enough for your chains.
+	INTERMEDIATE_FORMAT_AGGRESSIVE,
+};
+
 // A node in the graph; basically an effect and some associated information.
 class Node {
 public:
@@ -139,6 +174,28 @@ private:
 	// (in the same phase) have one_to_one_sampling() set.
 	bool one_to_one_sampling;
 
+	// If this node is a ColorMatrixEffect, the (now disabled) nodes
+	// it replaced; their parameters still affect our output.
+	std::vector<Node *> folded_nodes;
+
+	// Identical (now disabled) nodes that were merged into this one
+	// (see EffectChain::enable_common_subexpression_elimination()).
+	std::vector<Node *> merged_nodes;
+
+	// For nodes that were merged and the nodes they were merged into,
+	// effect->get_generation() as of when we last checked that
+	// their parameters are still the same.
+	unsigned merged_generation;
+
+	// Set if this node is used by more than one other node, but is
+	// cheap enough to compute again in each phase that needs it,
+	// instead of rendering it to a texture once (see PhaseCostModel).
+	bool recompute_in_each_phase;
+
+	// See EffectChain::set_bypassable() and EffectChain::set_bypass().
+	// <bypassed> is the value of the uniform in the shader.
+	bool bypassable, bypassed;
+
 	friend class EffectChain;
 };
 
@@ -147,6 +204,8 @@ struct Phase {
 	Node *output_node;
 
 	GLuint glsl_program_num;  // Owned by the resource_pool.
+	bool program_ready;  // See EffectChain::finalize_async().
+	uint64_t program_hash;  // See ResourcePool::hash_glsl_program().
 
 	// Position and texcoord attribute indexes, although it doesn't matter
 	// which is which, because they contain the same data.
@@ -154,9 +213,19 @@ struct Phase {
 
 	bool input_needs_mipmaps;
 
+	// Whether the RTT inputs can be sampled through the chain's sampler
+	// objects, instead of setting texture parameters every frame. This is
+	// not the case if any effect could change the sampler state through
+	// get_input_sampler().
+	bool use_sampler_objects;
+
 	// Inputs are only inputs from other phases (ie., those that come from RTT);
 	// input textures are counted as part of <effects>.
 	std::vector<Phase *> inputs;
+	// Phases whose output textures are not used by any later phase,
+	// and can thus be given back to the pool as soon as this phase
+	// has been executed. Computed in finalize().
+	std::vector<Phase *> inputs_to_release;
 	// Bound sampler numbers for each input. Redundant in a sense
 	// (it always corresponds to the index), but we need somewhere
 	// to hold the value for the uniform.
@@ -164,10 +233,37 @@ struct Phase {
 	std::vector<Node *> effects;  // In order.
 	unsigned output_width, output_height, virtual_output_width, virtual_output_height;
 
+	// Internal format of the texture this phase renders to
+	// (see IntermediateFormatPolicy). Unused for the last phase.
+	GLint intermediate_format;
+
+	// All nodes that can influence the output of this phase; the effects
+	// in it, and those in all the phases it reads from, recursively.
+	// Computed in finalize().
+	std::vector<Node *> upstream_nodes;
+
+	// The generations (see Effect::get_generation()) of <upstream_nodes>
+	// as of the last time this phase was executed; empty if it never was.
+	std::vector<unsigned> executed_generations;
+
+	// The output of this phase from an earlier frame, if it is kept in
+	// the phase cache (see EffectChain::set_phase_cache_budget()); else 0.
+	// Can be reused as long as <executed_generations> are current.
+	GLuint cached_output_texture;
+	size_t cached_output_bytes;
+
 	// Identifier used to create unique variables in GLSL.
 	// Unique per-phase to increase cacheability of compiled shaders.
 	std::map<Node *, std::string> effect_ids;
 
+	// The fragment shader, except for the uniform declarations that go
+	// between <frag_shader_header> and <frag_shader_body>, and the outputs
+	// it writes to (see generate_fragment_shader()). Kept so that the
+	// program can be recompiled without calling output_fragment_shader()
+	// again.
+	std::string frag_shader_header, frag_shader_body;
+	std::vector<std::string> frag_shader_outputs;
+
 	// Uniforms for this phase; combined from all the effects.
 	std::vector<Uniform<int> > uniforms_sampler2d;
 	std::vector<Uniform<bool> > uniforms_bool;
@@ -178,10 +274,182 @@ struct Phase {
 	std::vector<Uniform<float> > uniforms_vec4;
 	std::vector<Uniform<Eigen::Matrix3d> > uniforms_mat3;
 
-	// For measurement of GPU time used.
-	GLuint timer_query_object;
-	uint64_t time_elapsed_ns;
+	// Parameters compiled into the program as constants (see
+	// Effect::freeze_parameter()), as pointers to where their values
+	// are kept, and the values that were compiled in.
+	std::vector<std::pair<const int *, int> > frozen_ints;
+	std::vector<std::pair<const float *, float> > frozen_floats;
+
+	// If the shader model supports it, all uniforms except samplers are
+	// laid out in a single std140 uniform block, backed by this buffer
+	// object; otherwise, it is 0. <uniform_block_data> holds what was last
+	// uploaded to the buffer, so that we only need to send the parts that
+	// actually changed each frame; <uniform_block_scratch> is where the new
+	// values are packed before comparing.
+	GLuint uniform_buffer;
+	bool uniform_block_uploaded;
+	std::vector<unsigned char> uniform_block_data;
+	std::vector<unsigned char> uniform_block_scratch;
+
+	// For measurement of GPU time used (see EffectChain::enable_phase_timing()).
+	// Queries are issued round-robin from <timer_query_objects>, and their
+	// results are only picked up once the GPU has made them available, so
+	// that rendering never needs to wait for them. The last
+	// <num_timer_queries_pending> queries issued (before <next_timer_query>)
+	// are still outstanding; the oldest <num_timer_queries_to_discard> of
+	// those were issued before the last reset_phase_timing().
+	// <timer_query_submit_ns> holds when each query was issued, for tracing
+	// (see trace.h), or 0 if tracing was off at the time.
+	std::vector<GLuint> timer_query_objects;
+	std::vector<uint64_t> timer_query_submit_ns;
+	unsigned next_timer_query, num_timer_queries_pending, num_timer_queries_to_discard;
+
+	// GPU time measurements since the last reset_phase_timing().
+	// <recent_time_elapsed_ns> is a ring of the most recent ones,
+	// with <next_recent_time> being the oldest once it is full.
+	uint64_t time_elapsed_ns, min_time_elapsed_ns, max_time_elapsed_ns;
+	uint64_t num_measured_iterations;
+	std::vector<uint64_t> recent_time_elapsed_ns;
+	unsigned next_recent_time;
+
+	// CPU time spent in set_gl_state() for each of <effects>, summed over
+	// the <num_timed_executions> times the phase ran with timing enabled.
+	std::vector<uint64_t> set_gl_state_time_ns;
+	uint64_t num_timed_executions;
+};
+
+// Timing statistics for one phase; see EffectChain::get_phase_timing().
+struct PhaseTiming {
+	// The effects in the phase, in order.
+	std::vector<Effect *> effects;
+
+	// GPU time for the phase, in milliseconds, over <num_measured_iterations>
+	// frames. The 95th percentile is only over the most recent measurements
+	// (up to a thousand or so). All zero if nothing has been measured yet.
 	uint64_t num_measured_iterations;
+	double min_gpu_ms, avg_gpu_ms, p95_gpu_ms, max_gpu_ms;
+
+	// Average CPU time spent in set_gl_state() for each of <effects>,
+	// per frame the phase was executed, in milliseconds.
+	std::vector<double> avg_set_gl_state_ms;
+};
+
+// Relative costs for the cost model that decides whether the output of
+// an effect used by more than one other effect is rendered to a texture
+// once, or computed again in each phase that needs it; see
+// EffectChain::set_phase_cost_model(). All costs are per pixel, in the same
+// (arbitrary) unit; only their ratios matter. The defaults are a guess
+// for a typical desktop GPU, where memory bandwidth is what hurts
+// the most; EffectChain::estimate_phase_cost_model() can fit them to
+// actual measurements instead.
+struct PhaseCostModel {
+	PhaseCostModel()
+		: alu_op_cost(1.0), texture_fetch_cost(4.0), byte_cost(2.0) {}
+
+	double alu_op_cost;  // Per arithmetic instruction (see Effect::estimated_alu_ops()).
+	double texture_fetch_cost;  // Per texture lookup.
+	double byte_cost;  // Per byte written to or read from a texture.
+};
+
+// Statistics for the phase cache; see EffectChain::set_phase_cache_budget().
+struct PhaseCacheStats {
+	// Totals over all calls to render_to_fbo() so far. A phase is
+	// skipped if its output could be taken from the cache, or if
+	// nothing that needed to be rendered read from it.
+	uint64_t num_phases_executed;
+	uint64_t num_phases_skipped;
+
+	// Number of phases skipped in the last call to render_to_fbo().
+	unsigned num_phases_skipped_last_frame;
+
+	// Texture memory currently held by the cache, as estimated by
+	// ResourcePool::estimate_texture_size().
+	size_t cached_bytes;
+};
+
+// A set of parameter changes that are applied all at once, at the start
+// of a frame, when committed to an EffectChain (see EffectChain::commit()).
+// This lets a control thread change parameters while another thread is
+// rendering, without locking around the rendering, and without any frame
+// seeing only some of the changes. Setting parameters directly on the
+// effects is not safe while the chain might be rendering.
+//
+// Staging changes only touches the transaction itself, so it can be done
+// without any locking; a transaction should only be used from one thread
+// at a time, though. Parameters are looked up when staged (see
+// ParamHandle); values the effect does not accept (e.g. an odd number of
+// taps for BlurEffect) are dropped, with a message on stderr, when the
+// transaction is applied.
+class ParameterTransaction {
+public:
+	// Return false if there is no such parameter.
+	bool set_int(Effect *effect, const std::string &key, int value) MUST_CHECK_RESULT;
+	bool set_float(Effect *effect, const std::string &key, float value) MUST_CHECK_RESULT;
+	bool set_vec2(Effect *effect, const std::string &key, const float *values) MUST_CHECK_RESULT;
+	bool set_vec3(Effect *effect, const std::string &key, const float *values) MUST_CHECK_RESULT;
+	bool set_vec4(Effect *effect, const std::string &key, const float *values) MUST_CHECK_RESULT;
+
+	// The same, for handles you have already looked up.
+	void set(const ParamHandle<int> &handle, int value);
+	void set(const ParamHandle<float> &handle, float value);
+	void set_vec(const ParamHandle<float> &handle, const float *values);
+
+	bool empty() const { return changes.empty(); }
+	void clear() { changes.clear(); }
+
+private:
+	friend class EffectChain;
+
+	// Exactly one of the handles is valid.
+	struct Change {
+		ParamHandle<int> int_handle;
+		ParamHandle<float> float_handle;
+		int int_value;
+		float float_values[4];
+	};
+	std::vector<Change> changes;
+};
+
+// An asynchronous readback of a rendered frame, as returned by
+// EffectChain::render_to_buffer(). The pixels are copied into pixel pack
+// buffers (from the EffectChain's ResourcePool) on the GPU, and a fence
+// is inserted after the copy, so the caller does not need to stall until
+// the GPU has caught up; e.g. an encoder can keep a couple of tickets around
+// and pick up frame N-2 while frame N is rendering.
+//
+// All member functions, including the destructor, must be called with
+// an OpenGL context current that shares resources with the one used
+// for rendering.
+class ReadbackTicket {
+public:
+	// Unmaps and returns the pixel pack buffers to the pool.
+	// Any pointers returned from wait() are invalid after this.
+	~ReadbackTicket();
+
+	// Returns true if the data is ready, ie., wait() will not block.
+	// Never blocks itself.
+	bool poll();
+
+	// Blocks until the data is ready, then returns one pointer per output
+	// plane (see EffectChain::render_to_buffer()). Rows are tightly packed,
+	// and come bottom-first unless the chain has OUTPUT_ORIGIN_TOP_LEFT.
+	// Calling wait() more than once is fine; the mapping is kept until
+	// the ticket is deleted.
+	const std::vector<const void *> &wait();
+
+	unsigned get_num_planes() const { return pbos.size(); }
+	size_t get_plane_size(unsigned plane) const { return plane_sizes[plane]; }
+
+private:
+	friend class EffectChain;
+	ReadbackTicket(ResourcePool *resource_pool) : resource_pool(resource_pool), fence(0), done(false) {}
+
+	ResourcePool *resource_pool;
+	GLsync fence;
+	bool done;
+	std::vector<GLuint> pbos;
+	std::vector<size_t> plane_sizes;
+	std::vector<const void *> mapped_planes;
 };
 
 class EffectChain {
@@ -244,6 +512,26 @@ public:
 	}
 	Effect *add_effect(Effect *effect, const std::vector<Effect *> &inputs);
 
+	// Allow <effect> (which must already be in the chain) to be switched
+	// off and on with set_bypass() after finalize(), without compiling
+	// anything anew; its shader gets a branch on a uniform, passing the
+	// input through unchanged when set. This costs a little on every frame,
+	// and keeps the effect from being merged, folded or baked together with
+	// others (see set_lut_baking() etc.), so only use it for effects you
+	// actually intend to toggle.
+	//
+	// Only effects with a single input that do not change the output size
+	// (or alpha type) can be bypassed. In particular, composite effects
+	// that replace themselves in rewrite_graph(), like BlurEffect or
+	// UnsharpMaskEffect, cannot. This is checked in finalize().
+	// Must be called before finalize().
+	void set_bypassable(Effect *effect);
+
+	// Bypass (or stop bypassing) an effect given to set_bypassable().
+	// Effects start out not bypassed. Can be called at any time,
+	// also between frames; it only changes a uniform.
+	void set_bypass(Effect *effect, bool bypass);
+
 	// Adds an RGBA output. Note that you can have at most one RGBA output and one
 	// Y'CbCr output (see below for details).
 	void add_output(const ImageFormat &format, OutputAlphaFormat alpha_format);
@@ -267,6 +555,40 @@ public:
 		this->num_dither_bits = num_bits;
 	}
 
+	// Merge effects that compute the same thing, ie., that are of the same
+	// type, have the same inputs and the same parameters (see
+	// Effect::is_mergeable()), so that the work is only done once.
+	// This happens e.g. if you have two GlowEffects with the same settings
+	// on the same input; with this, their blurs are only computed once.
+	// Only effects whose output would be bounced to a texture anyway
+	// are merged, so this never adds passes.
+	//
+	// Merged effects must keep having the same parameters afterwards
+	// (e.g. because you always set them together); if you change only
+	// one of them, rendering will print an error and exit.
+	// The default is off.
+	// Must be called before finalize().
+	void enable_common_subexpression_elimination(bool enable)
+	{
+		assert(!finalized);
+		do_common_subexpression_elimination = enable;
+	}
+
+	// Replace runs of two or more pointwise effects (see Effect::is_pointwise())
+	// with blank alpha by a lookup into a 3D LUT of lut_size³ entries
+	// (typically 33 or 65), computed whenever the effects' parameters change;
+	// see BakedLUTEffect. This is an approximation, and input values outside
+	// [0,1] will be clamped, so only use it if you have checked that the
+	// results are good enough for your chains (effect_chain_bench can report
+	// the error for a typical color correction chain). The default, 0,
+	// disables baking. Must be called before finalize().
+	void set_lut_baking(unsigned lut_size)
+	{
+		assert(!finalized);
+		assert(lut_size == 0 || lut_size >= 2);
+		this->lut_size = lut_size;
+	}
+
 	// Set where (0,0) is taken to be in the output. The default is
 	// OUTPUT_ORIGIN_BOTTOM_LEFT, which is usually what you want
 	// (see OutputOrigin above for more details).
@@ -275,15 +597,103 @@ public:
 		this->output_origin = output_origin;
 	}
 
+	// Set how to choose storage formats for intermediate textures
+	// (see IntermediateFormatPolicy above). Must be called before finalize().
+	void set_intermediate_format_policy(IntermediateFormatPolicy policy)
+	{
+		assert(!finalized);
+		this->intermediate_format_policy = policy;
+	}
+
 	void finalize();
 
-	// Measure the GPU time used for each actual phase during rendering.
+	// Like finalize(), but does not wait for the GLSL programs to be
+	// compiled, if the driver can compile them in the background (see
+	// movit_parallel_shader_compile_supported); otherwise, the same as
+	// finalize(). is_ready() tells whether they are done, without
+	// blocking; wait_until_ready() blocks until they are. Rendering
+	// before that is allowed, but waits for them too. To compile several
+	// chains at once, see ResourcePool::prewarm().
+	void finalize_async();
+	bool is_ready();
+	void wait_until_ready();
+
+	// Keep up to <num_frames> frames in flight on the GPU (the default is 1,
+	// ie., no pipelining). With more than one, every frame gets its own
+	// set of intermediate textures, and textures given back by inputs
+	// (e.g. when you call set_pixel_data() on a FlatInput) are held on to
+	// until the GPU is done with the frame that used them. This means that
+	// uploading the next frame's input does not have to wait for the
+	// previous frame to finish rendering, at the cost of more texture memory.
+	// render_to_fbo() will block if the GPU falls more than <num_frames>
+	// frames behind.
+	//
+	// Note that in this mode, intermediate textures are not reused
+	// between phases within the same frame (see get_peak_intermediate_bytes()).
+	//
+	// Requires GL_ARB_sync (see movit_sync_objects_supported).
+	// Must be called before finalize().
+	void set_frames_in_flight(unsigned num_frames);
+
+	// Keep the outputs of phases around between frames, and do not render
+	// a phase again if none of the effects it depends on (including inputs)
+	// have changed since; see Effect::get_generation(). This can save a lot
+	// of work for still images, graphics overlays, paused sources and the like.
+	// The cache will use at most <max_bytes> of texture memory; the default
+	// is zero, which disables it. The last phase is always rendered.
+	//
+	// Phases are only admitted into the cache if nothing they depend on
+	// changed since the previous time they ran, so that e.g. a live video
+	// source does not push out a still image that would benefit more.
+	//
+	// Can be changed at any time; if you lower the budget, cached outputs
+	// are thrown out on the next render.
+	void set_phase_cache_budget(size_t max_bytes) { phase_cache_budget = max_bytes; }
+	PhaseCacheStats get_phase_cache_stats() const { return phase_cache_stats; }
+
+	// Use <model> to decide how to handle effects (or small groups of
+	// effects) whose output is used by more than one other effect, such as
+	// a color correction feeding into several MixEffects or OverlayEffects.
+	// By default, such outputs are always rendered to a texture once, and
+	// then read by each user. If the cost model finds it cheaper to compute
+	// them again in each of the phases that need them (which saves a write
+	// and a read of a full-size texture per user), it will do that instead,
+	// which can also save entire phases.
+	//
+	// Only effects with one_to_one_sampling() whose users do not need
+	// texture bounce are ever recomputed; see Effect::estimated_alu_ops()
+	// for how the cost of each effect is estimated.
+	// Must be called before finalize().
+	void set_phase_cost_model(const PhaseCostModel &model);
+
+	// Fit a PhaseCostModel to the GPU time measured for this chain's phases
+	// (see enable_phase_timing()), for use with set_phase_cost_model()
+	// on chains finalized later. If there are too few measured phases to
+	// tell the different costs apart, the current model (or the default)
+	// is only scaled to match the total time. Costs are in nanoseconds.
+	PhaseCostModel estimate_phase_cost_model();
+
+	// Measure the GPU time used for each actual phase during rendering,
+	// and the CPU time used for setting up each effect (in set_gl_state()).
 	// Note that this is only available if GL_ARB_timer_query
-	// (or, equivalently, OpenGL 3.3) is available. Also note that measurement
-	// will incur a performance cost, as we wait for the measurements to
-	// complete at the end of rendering.
+	// (or, equivalently, OpenGL 3.3) is available.
+	//
+	// Rendering never waits for the GPU measurements; they are picked up
+	// a few frames later, when the GPU is done with them. If the GPU falls
+	// so far behind that there are no free timer queries for a phase,
+	// that phase is simply not measured for the frame. Thus, the cost of
+	// leaving timing on is small, although the statistics will lag behind
+	// by a few frames.
 	void enable_phase_timing(bool enable);
 	void reset_phase_timing();
+
+	// Get the statistics since the last reset_phase_timing(), one element
+	// per phase in execution order. Picks up any measurements that are ready,
+	// but never blocks.
+	std::vector<PhaseTiming> get_phase_timing();
+
+	// Print the average GPU time for each phase to stdout. Unlike
+	// get_phase_timing(), this waits for all outstanding measurements.
 	void print_phase_timing();
 
 	//void render(unsigned char *src, unsigned char *dst);
@@ -296,6 +706,61 @@ public:
 	// the current viewport.
 	void render_to_fbo(GLuint fbo, unsigned width, unsigned height);
 
+	// Like render_to_fbo(), but only render the part of the output inside
+	// the given rectangle (in pixels, relative to the lower-left corner of
+	// the output), leaving the rest of the FBO untouched. Earlier phases
+	// are scissored down to what is needed to compute that rectangle,
+	// as far as the effects can tell (see Effect::get_input_footprint()),
+	// so the fill rate goes down roughly in proportion to the region.
+	// Phases whose output is sampled with mipmaps are still rendered in full.
+	//
+	// Partially rendered phase outputs are never put in the phase cache
+	// (see set_phase_cache_budget()), but outputs already in it can be used.
+	void render_to_fbo_region(GLuint fbo, unsigned width, unsigned height,
+	                          unsigned region_x, unsigned region_y,
+	                          unsigned region_width, unsigned region_height);
+
+	// Render the effect chain into textures of the given internal format
+	// (taken from the ResourcePool), and start an asynchronous readback of
+	// the result into memory, as if by glReadPixels() with the given
+	// <format> and <type>. Returns immediately; you own the returned ticket,
+	// and must delete it when you are done with the data.
+	//
+	// If the chain has Y'CbCr output split over several outputs
+	// (YCBCR_OUTPUT_SPLIT_Y_AND_CBCR or YCBCR_OUTPUT_PLANAR), every output
+	// gets its own plane in the ticket, in the same order as the draw
+	// buffers would have had with render_to_fbo() (ie., Y', then chroma,
+	// then RGBA if you have that too). The second form lets you give
+	// a different <format> for each plane, e.g. GL_RED for Y' and GL_RG
+	// for the interleaved chroma.
+	//
+	// Requires GL_ARB_sync (see movit_sync_objects_supported).
+	ReadbackTicket *render_to_buffer(GLint internal_format, unsigned width, unsigned height,
+	                                 GLenum format, GLenum type);
+	ReadbackTicket *render_to_buffer(GLint internal_format, unsigned width, unsigned height,
+	                                 const std::vector<GLenum> &plane_formats, GLenum type);
+
+	// Number of outputs (draw buffers) the last phase writes to.
+	unsigned get_num_output_planes() const;
+
+	// Queue the changes in <transaction> to be applied at the start of
+	// the next frame (ie., the next call to render_to_fbo() etc.), all at
+	// once, and clear the transaction. Can be called from any thread, also
+	// while another thread is rendering; it only takes a lock for as long
+	// as it takes to queue the changes, and rendering never holds that lock
+	// for longer than it takes to pick them up. Changes from several commits
+	// are applied in the order they were committed, so the last value for
+	// any given parameter wins.
+	void commit(ParameterTransaction *transaction);
+
+	// The maximum number of bytes held in intermediate (RTT) textures
+	// at any one point during the last call to render_to_fbo(),
+	// as estimated by ResourcePool::estimate_texture_size().
+	// Intermediate textures are given back to the pool as soon as their
+	// last consumer has run, so this is usually less than the sum of
+	// all the phase outputs.
+	size_t get_peak_intermediate_bytes() const { return peak_intermediate_bytes; }
+
 	Effect *last_added_effect() {
 		if (nodes.empty()) {
 			return NULL;
@@ -338,6 +803,13 @@ public:
 	// no later than in the Effect's destructor.
 	ResourcePool *get_resource_pool() { return resource_pool; }
 
+	// Give a texture from the resource pool back, when it may still be read
+	// by frames in flight (see set_frames_in_flight()). If pipelining is not
+	// enabled, this is the same as ResourcePool::release_2d_texture();
+	// otherwise, the texture goes back to the pool once the GPU is done
+	// with the last frame rendered.
+	void release_texture_when_idle(GLuint texture_num);
+
 private:
 	// Make sure the output rectangle is at least large enough to hold
 	// the given input rectangle in both dimensions, and is of the
@@ -356,23 +828,103 @@ private:
 	// output gamma different from GAMMA_LINEAR.
 	void find_all_nonlinear_inputs(Node *effect, std::vector<Node *> *nonlinear_inputs);
 
+	// Generate the fragment shader for this phase, less the uniform
+	// declarations, and store it in the phase. This calls
+	// output_fragment_shader() on all the effects, which may register
+	// new uniforms, so it must only be done once.
+	void generate_fragment_shader(Phase *phase);
+
 	// Create a GLSL program computing the effects for this phase in order.
 	void compile_glsl_program(Phase *phase);
 
+	// Look up attribute and uniform locations in the phase's program,
+	// once it is linked.
+	void finish_glsl_program(Phase *phase);
+
+	// Compile the program for this phase again, since frozen parameters
+	// (see Effect::freeze_parameter()) have changed.
+	void recompile_glsl_program(Phase *phase);
+
 	// Create all GLSL programs needed to compute the given effect, and all outputs
 	// that depend on it (whenever possible). Returns the phase that has <output>
 	// as the last effect. Also pushes all phases in order onto <phases>.
 	Phase *construct_phase(Node *output, std::map<Node *, Phase *> *completed_effects);
 
+	// Find out, for each phase, which intermediate textures can be
+	// released after it has run (see Phase::inputs_to_release).
+	void compute_texture_lifetimes();
+
+	// Fill in Phase::upstream_nodes for all phases.
+	void compute_upstream_nodes();
+
+	// Choose the intermediate texture format for a phase with the given
+	// output node, according to <intermediate_format_policy>.
+	GLint choose_intermediate_format(const Node *output);
+
+	// Textures and a fence for one of the frames that may be in flight.
+	struct FrameSlot {
+		GLsync fence;  // 0 if no frame has been rendered in this slot.
+		std::vector<GLuint> textures_to_release;
+	};
+
+	// Whether the phase has a cached output that is still valid.
+	bool phase_cache_is_valid(Phase *phase) const;
+
+	// The common part of render_to_fbo() and render_to_fbo_region().
+	// <region> is either NULL (render everything), or x, y, width and height
+	// in pixels, relative to the viewport.
+	void render(GLuint dest_fbo, unsigned width, unsigned height, const unsigned *region);
+
+	// For render_to_fbo_region(): Find the part of each phase's output
+	// (in normalized coordinates) that is needed to compute <output_region>
+	// of the final output. All phase sizes must be known.
+	void compute_phase_regions(const Region &output_region,
+	                           std::map<Phase *, Region> *phase_regions);
+
+	// Find out which phases need to run for the current frame; the others
+	// are either not needed at all, or their output can be taken from
+	// the phase cache. The textures for the latter are put into <output_textures>.
+	void find_phases_to_execute(std::set<Phase *> *phases_to_execute,
+	                            std::map<Phase *, GLuint> *output_textures);
+
+	// Called after a (non-last) phase has been executed. Records what it
+	// depends on, throws out any stale cached output, and returns true if
+	// <output_texture> should be kept in the phase cache.
+	bool update_phase_cache(Phase *phase, FrameSlot *slot, GLuint output_texture);
+
+	// Give the phase's cached output (if any) back to the pool.
+	void drop_cached_output(Phase *phase, FrameSlot *slot);
+
+	// Wait until the GPU is done with the frame last rendered in <slot>,
+	// and then give its textures back to the pool.
+	void recycle_frame_slot(FrameSlot *slot);
+
+	// Give the texture back to the pool, or to the slot if we are pipelining.
+	void release_intermediate_texture(FrameSlot *slot, GLuint texture_num);
+
+	// Get the VAO for the current context, creating it if needed.
+	// It has the attributes of all phases enabled, all pointing to <vbo>.
+	GLuint get_vao_for_current_context();
+
 	// Execute one phase, ie. set up all inputs, effects and outputs, and render the quad.
+	// <num_bound_sampler_objects> is the number of texture units (counting from zero)
+	// that have one of our sampler objects bound, and is updated as needed.
 	void execute_phase(Phase *phase, bool last_phase,
-	                   std::set<GLint> *bound__attribute_indices,
+	                   unsigned *num_bound_sampler_objects,
 	                   std::map<Phase *, GLuint> *output_textures,
 	                   std::set<Phase *> *generated_mipmaps);
 
+	// Pick up the results of the phase's outstanding timer queries, oldest
+	// first. If <wait> is false, stops at the first one that is not ready.
+	void collect_phase_timing(Phase *phase, bool wait);
+
 	// Set up uniforms for one phase. The program must already be bound.
 	void setup_uniforms(Phase *phase);
 
+	// Pack the phase's uniform block and upload the parts that differ
+	// from last time. Called from setup_uniforms().
+	void upload_uniform_block(Phase *phase);
+
 	// Set up the given sampler number for sampling from an RTT texture.
 	void setup_rtt_sampler(int sampler_num, bool use_mipmaps);
 
@@ -418,9 +970,44 @@ private:
 	void fix_internal_gamma_by_asking_inputs(unsigned step);
 	void fix_internal_gamma_by_inserting_nodes(unsigned step);
 	void fix_output_gamma();
+
+	// Removes conversion nodes inserted by the fixups above that undo
+	// each other (e.g. AlphaMultiplicationEffect followed by
+	// AlphaDivisionEffect).
+	bool is_conversion_node(Node *node);
+	void bypass_node(Node *node);
+	void remove_redundant_conversions();
+
+	// Merges identical nodes, if enable_common_subexpression_elimination()
+	// has been called.
+	bool nodes_are_identical(Node *node, Node *other);
+	bool output_is_bounced(Node *node);
+	void eliminate_common_subexpressions();
+
+	// Find all maximal chains of two or more nodes for which <is_member>
+	// returns true, where each node but the last has only one outgoing link.
+	void find_runs(bool (EffectChain::*is_member)(Node *), std::vector<std::vector<Node *> > *runs);
+
+	// Replaces runs of pointwise effects with a single BakedLUTEffect,
+	// if set_lut_baking() has been called.
+	bool is_lut_node(Node *node);
+	void bake_luts();
+
+	// Replaces runs of two or more effects that can be expressed as
+	// a color matrix (see Effect::get_color_matrix()) with a single
+	// ColorMatrixEffect.
+	bool is_color_matrix_node(Node *node);
+	void fold_color_matrices();
+
 	void add_ycbcr_conversion_if_needed();
 	void add_dither_if_needed();
 
+	// Sets Node::recompute_in_each_phase according to the phase cost model,
+	// if set_phase_cost_model() has been called.
+	bool can_recompute_in_each_phase(Node *node);
+	double estimate_recompute_cost(Node *node);
+	void choose_nodes_to_recompute();
+
 	float aspect_nom, aspect_denom;
 	ImageFormat output_format;
 	OutputAlphaFormat output_alpha_format;
@@ -432,19 +1019,56 @@ private:
 	std::vector<Node *> nodes;
 	std::map<Effect *, Node *> node_map;
 	Effect *dither_effect;
+	std::vector<BakedLUTEffect *> baked_lut_effects;
 
 	std::vector<Input *> inputs;  // Also contained in nodes.
 	std::vector<Phase *> phases;
 
 	unsigned num_dither_bits;
+	unsigned lut_size;  // See set_lut_baking().
+	bool do_common_subexpression_elimination;
+	bool use_phase_cost_model;  // See set_phase_cost_model().
+	PhaseCostModel phase_cost_model;
 	OutputOrigin output_origin;
+	IntermediateFormatPolicy intermediate_format_policy;
 	bool finalized;
+	bool compile_programs_async;  // See finalize_async().
 	GLuint vbo;  // Contains vertex and texture coordinate data.
 
+	// Vertex array objects are not shareable between contexts,
+	// so we keep one per context we have rendered in.
+	std::map<void *, GLuint> vaos;
+
+	// Sampler objects for RTT inputs, without and with mipmaps,
+	// respectively. Zero if sampler objects are not supported.
+	GLuint rtt_sampler_objects[2];
+
 	ResourcePool *resource_pool;
 	bool owns_resource_pool;
 
 	bool do_phase_timing;
+	size_t peak_intermediate_bytes;
+
+	// See set_frames_in_flight(). <frame_slots> is only filled if
+	// num_frames_in_flight is larger than one; frame_num counts
+	// calls to render_to_fbo().
+	unsigned num_frames_in_flight;
+	std::vector<FrameSlot> frame_slots;
+	unsigned frame_num;
+
+	// See set_phase_cache_budget().
+	size_t phase_cache_budget;
+	PhaseCacheStats phase_cache_stats;
+
+	// Changes given to commit() since the last frame started, and the ones
+	// being applied now (kept around only to reuse the memory). Protected by
+	// <committed_changes_lock>, except that <latched_changes> is only
+	// touched by the rendering thread.
+	pthread_mutex_t committed_changes_lock;
+	std::vector<ParameterTransaction::Change> committed_changes, latched_changes;
+
+	// Apply the changes from commit() to the effects.
+	void latch_committed_changes();
 };
 
 }  // namespace movit
@@ -0,0 +1,668 @@
+// Throughput benchmarks for EffectChain: one chain per tested effect, plus
+// a few representative composite chains, each rendered at 720p, 1080p
+// and 2160p. For each, we report frames per second, CPU time spent
+// in render_to_fbo(), input upload rate and per-phase GPU time
+// (see EffectChain::get_phase_timing()).
+//
+// Usage: effect_chain_bench [--frames N] [--resolution 720p|1080p|2160p] [name...]
+//
+// Any names given restrict the run to benchmarks whose name contains
+// one of them as a substring. Shaders are read from the current directory.
+//
+// Finally, unless filtered out, we report how far the output of
+// a color grading chain is from the original when it is baked into
+// a LUT (see EffectChain::set_lut_baking()), as "lut_accuracy".
+//
+// This needs an OpenGL context, but not a GPU or a display; to run on
+// Mesa's software rasterizer on a headless machine, use something like
+//
+//   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run -a ./effect_chain_bench
+//
+// or, with a recent SDL2, SDL_VIDEODRIVER=offscreen instead of xvfb-run.
+// Numbers from llvmpipe are only useful relative to each other, but that
+// is enough for tracking regressions.
+
+#ifdef HAVE_SDL2
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_error.h>
+#include <SDL2/SDL_video.h>
+#else
+#include <SDL/SDL.h>
+#include <SDL/SDL_error.h>
+#include <SDL/SDL_video.h>
+#endif
+#include <epoxy/gl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "blur_effect.h"
+#include "deconvolution_sharpen_effect.h"
+#include "deinterlace_effect.h"
+#include "diffusion_effect.h"
+#include "effect_chain.h"
+#include "fft_convolution_effect.h"
+#include "flat_input.h"
+#include "glow_effect.h"
+#include "image_format.h"
+#include "init.h"
+#include "lift_gamma_gain_effect.h"
+#include "luma_mix_effect.h"
+#include "mix_effect.h"
+#include "overlay_effect.h"
+#include "padding_effect.h"
+#include "resample_effect.h"
+#include "resource_pool.h"
+#include "saturation_effect.h"
+#include "slice_effect.h"
+#include "trace.h"
+#include "unsharp_mask_effect.h"
+#include "util.h"
+#include "vignette_effect.h"
+#include "white_balance_effect.h"
+#include "ycbcr_input.h"
+
+using namespace std;
+using namespace movit;
+
+namespace {
+
+enum InputType {
+	// 8-bit RGBA, postmultiplied alpha; the most common input in practice.
+	INPUT_RGBA8,
+	// Same, but premultiplied alpha.
+	INPUT_RGBA8_PREMULTIPLIED,
+	// 8-bit 4:2:0 planar Rec. 709 Y'CbCr, as from a typical video decoder.
+	INPUT_YCBCR420,
+};
+
+struct Benchmark {
+	// For the TESTED_EFFECTS entries, the same as in the Makefile.
+	const char *name;
+
+	unsigned num_inputs;
+	InputType input_type;
+	Colorspace input_color_space;
+	GammaCurve input_gamma_curve;
+
+	// Output is always 8-bit, to a texture of the same size as the input.
+	Colorspace output_color_space;
+	GammaCurve output_gamma_curve;
+	OutputAlphaFormat output_alpha_format;
+	bool ycbcr_output;
+	unsigned dither_bits;
+
+	// Adds the effects (if any) after the inputs.
+	void (*add_effects)(EffectChain *chain, const vector<Effect *> &inputs,
+	                    unsigned width, unsigned height);
+};
+
+void add_lift_gamma_gain(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *effect = chain->add_effect(new LiftGammaGainEffect());
+	float gain[] = { 1.1f, 1.0f, 0.9f };
+	CHECK(effect->set_vec3("gain", gain));
+}
+
+void add_white_balance(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *effect = chain->add_effect(new WhiteBalanceEffect());
+	CHECK(effect->set_float("output_color_temperature", 5000.0f));
+}
+
+void add_saturation(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *effect = chain->add_effect(new SaturationEffect());
+	CHECK(effect->set_float("saturation", 0.5f));
+}
+
+void add_blur(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *effect = chain->add_effect(new BlurEffect());
+	CHECK(effect->set_float("radius", 10.0f));
+}
+
+void add_diffusion(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	chain->add_effect(new DiffusionEffect());
+}
+
+void add_glow(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	chain->add_effect(new GlowEffect());
+}
+
+void add_unsharp_mask(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	chain->add_effect(new UnsharpMaskEffect());
+}
+
+void add_mix(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *effect = chain->add_effect(new MixEffect(), inputs[0], inputs[1]);
+	CHECK(effect->set_float("strength_first", 0.5f));
+	CHECK(effect->set_float("strength_second", 0.5f));
+}
+
+void add_overlay(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	chain->add_effect(new OverlayEffect(), inputs[0], inputs[1]);
+}
+
+void add_padding(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	// Letterbox the input into the output.
+	Effect *resample = chain->add_effect(new ResampleEffect());
+	CHECK(resample->set_int("width", width));
+	CHECK(resample->set_int("height", height * 3 / 4));
+	Effect *padding = chain->add_effect(new PaddingEffect());
+	CHECK(padding->set_int("width", width));
+	CHECK(padding->set_int("height", height));
+	CHECK(padding->set_float("top", height / 8));
+}
+
+void add_resample(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	// Downscale by 2/3 and back up, which is about as expensive as it gets.
+	Effect *down = chain->add_effect(new ResampleEffect());
+	CHECK(down->set_int("width", width * 2 / 3));
+	CHECK(down->set_int("height", height * 2 / 3));
+	Effect *up = chain->add_effect(new ResampleEffect());
+	CHECK(up->set_int("width", width));
+	CHECK(up->set_int("height", height));
+}
+
+void add_deconvolution_sharpen(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	chain->add_effect(new DeconvolutionSharpenEffect());
+}
+
+void add_vignette(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	chain->add_effect(new VignetteEffect());
+}
+
+void add_slice(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *effect = chain->add_effect(new SliceEffect());
+	CHECK(effect->set_int("input_slice_size", 64));
+	CHECK(effect->set_int("output_slice_size", 64));
+	CHECK(effect->set_int("offset", 1));
+	CHECK(effect->set_int("direction", SliceEffect::HORIZONTAL));
+}
+
+void add_luma_mix(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *effect = chain->add_effect(new LumaMixEffect(), inputs[0], inputs[1], inputs[2]);
+	CHECK(effect->set_float("transition_width", 1.0f));
+	CHECK(effect->set_float("progress", 0.5f));
+}
+
+void add_fft_convolution(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	const int convolve_size = 16;
+	FFTConvolutionEffect *effect = new FFTConvolutionEffect(width, height, convolve_size, convolve_size);
+	chain->add_effect(effect);
+	float kernel[convolve_size * convolve_size];
+	for (int i = 0; i < convolve_size * convolve_size; ++i) {
+		kernel[i] = 1.0f / (convolve_size * convolve_size);
+	}
+	effect->set_convolution_kernel(kernel);
+}
+
+void add_deinterlace(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *effect = chain->add_effect(new DeinterlaceEffect(), inputs[0], inputs[1], inputs[2], inputs[3], inputs[4]);
+	CHECK(effect->set_int("current_field_position", 0));
+}
+
+// The typical playout chain: decoded video, scaled to the output size,
+// color corrected and sent out as Y'CbCr.
+void add_playout_chain(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *resample = chain->add_effect(new ResampleEffect());
+	CHECK(resample->set_int("width", width));
+	CHECK(resample->set_int("height", height));
+	add_lift_gamma_gain(chain, inputs, width, height);
+}
+
+// Color grading of decoded video; all of it can be baked into a LUT,
+// including the gamma conversions on both sides.
+void add_color_grade(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *lgg = chain->add_effect(new LiftGammaGainEffect());
+	float lift[] = { 0.02f, 0.0f, 0.01f };
+	float gamma[] = { 1.1f, 1.0f, 0.9f };
+	float gain[] = { 0.9f, 1.0f, 1.05f };
+	CHECK(lgg->set_vec3("lift", lift));
+	CHECK(lgg->set_vec3("gamma", gamma));
+	CHECK(lgg->set_vec3("gain", gain));
+	add_saturation(chain, inputs, width, height);
+	add_white_balance(chain, inputs, width, height);
+}
+
+void add_color_grade_lut33(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	chain->set_lut_baking(33);
+	add_color_grade(chain, inputs, width, height);
+}
+
+void add_color_grade_lut65(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	chain->set_lut_baking(65);
+	add_color_grade(chain, inputs, width, height);
+}
+
+// A two-layer composite: picture-in-picture over a blurred background.
+void add_pip_chain(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *background = chain->add_effect(new BlurEffect(), inputs[0]);
+	CHECK(background->set_float("radius", 5.0f));
+	Effect *pip = chain->add_effect(new ResampleEffect(), inputs[1]);
+	CHECK(pip->set_int("width", width / 3));
+	CHECK(pip->set_int("height", height / 3));
+	Effect *padding = chain->add_effect(new PaddingEffect(), pip);
+	CHECK(padding->set_int("width", width));
+	CHECK(padding->set_int("height", height));
+	CHECK(padding->set_float("left", width / 2));
+	CHECK(padding->set_float("top", height / 8));
+	float transparent[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	CHECK(padding->set_vec4("border_color", transparent));
+	chain->add_effect(new OverlayEffect(), background, padding);
+}
+
+// A color correction shared by two mixes, which are then overlaid;
+// by default, the color correction gets a phase of its own.
+void add_fanout_chain(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	Effect *graded = chain->add_effect(new LiftGammaGainEffect(), inputs[0]);
+	float gain[] = { 0.9f, 1.0f, 1.05f };
+	CHECK(graded->set_vec3("gain", gain));
+	Effect *mix1 = chain->add_effect(new MixEffect(), graded, inputs[1]);
+	CHECK(mix1->set_float("strength_first", 0.7f));
+	CHECK(mix1->set_float("strength_second", 0.3f));
+	Effect *mix2 = chain->add_effect(new MixEffect(), graded, inputs[2]);
+	CHECK(mix2->set_float("strength_first", 0.3f));
+	CHECK(mix2->set_float("strength_second", 0.7f));
+	chain->add_effect(new OverlayEffect(), mix1, mix2);
+}
+
+void add_fanout_chain_cost_model(EffectChain *chain, const vector<Effect *> &inputs, unsigned width, unsigned height)
+{
+	chain->set_phase_cost_model(PhaseCostModel());
+	add_fanout_chain(chain, inputs, width, height);
+}
+
+#define RGBA8_sRGB INPUT_RGBA8, COLORSPACE_sRGB, GAMMA_sRGB
+#define TO_sRGB COLORSPACE_sRGB, GAMMA_sRGB, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, false, 0
+
+const Benchmark benchmarks[] = {
+	{ "lift_gamma_gain_effect", 1, RGBA8_sRGB, TO_sRGB, add_lift_gamma_gain },
+	{ "white_balance_effect", 1, RGBA8_sRGB, TO_sRGB, add_white_balance },
+
+	// These are inserted by EffectChain itself, so we provoke them
+	// with the right input and output formats.
+	{ "gamma_expansion_effect", 1, RGBA8_sRGB,
+	  COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, false, 0, NULL },
+	{ "gamma_compression_effect", 1, INPUT_RGBA8, COLORSPACE_sRGB, GAMMA_LINEAR, TO_sRGB, NULL },
+	{ "colorspace_conversion_effect", 1, INPUT_RGBA8, COLORSPACE_REC_601_625, GAMMA_LINEAR,
+	  COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, false, 0, NULL },
+	{ "alpha_multiplication_effect", 1, INPUT_RGBA8, COLORSPACE_sRGB, GAMMA_LINEAR,
+	  COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED, false, 0, NULL },
+	{ "alpha_division_effect", 1, INPUT_RGBA8_PREMULTIPLIED, COLORSPACE_sRGB, GAMMA_LINEAR,
+	  COLORSPACE_sRGB, GAMMA_LINEAR, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, false, 0, NULL },
+
+	{ "saturation_effect", 1, RGBA8_sRGB, TO_sRGB, add_saturation },
+	{ "blur_effect", 1, RGBA8_sRGB, TO_sRGB, add_blur },
+	{ "diffusion_effect", 1, RGBA8_sRGB, TO_sRGB, add_diffusion },
+	{ "glow_effect", 1, RGBA8_sRGB, TO_sRGB, add_glow },
+	{ "unsharp_mask_effect", 1, RGBA8_sRGB, TO_sRGB, add_unsharp_mask },
+	{ "mix_effect", 2, RGBA8_sRGB, TO_sRGB, add_mix },
+	{ "overlay_effect", 2, RGBA8_sRGB, TO_sRGB, add_overlay },
+	{ "padding_effect", 1, RGBA8_sRGB, TO_sRGB, add_padding },
+	{ "resample_effect", 1, RGBA8_sRGB, TO_sRGB, add_resample },
+	{ "dither_effect", 1, RGBA8_sRGB, COLORSPACE_sRGB, GAMMA_sRGB, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, false, 8, add_saturation },
+	{ "deconvolution_sharpen_effect", 1, RGBA8_sRGB, TO_sRGB, add_deconvolution_sharpen },
+	{ "vignette_effect", 1, RGBA8_sRGB, TO_sRGB, add_vignette },
+	{ "slice_effect", 1, RGBA8_sRGB, TO_sRGB, add_slice },
+	{ "luma_mix_effect", 3, RGBA8_sRGB, TO_sRGB, add_luma_mix },
+
+	// fft_pass_effect and complex_modulate_effect are only usable as part
+	// of an FFT convolution, so they are measured by this one.
+	{ "fft_convolution_effect", 1, RGBA8_sRGB, TO_sRGB, add_fft_convolution },
+	{ "ycbcr_conversion_effect", 1, RGBA8_sRGB,
+	  COLORSPACE_REC_709, GAMMA_REC_709, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, true, 0, NULL },
+	{ "deinterlace_effect", 5, RGBA8_sRGB, TO_sRGB, add_deinterlace },
+
+	// Composite chains.
+	{ "playout_ycbcr_resample_lgg_ycbcr", 1, INPUT_YCBCR420, COLORSPACE_REC_709, GAMMA_REC_709,
+	  COLORSPACE_REC_709, GAMMA_REC_709, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, true, 0, add_playout_chain },
+	{ "composite_pip_over_blur", 2, RGBA8_sRGB, TO_sRGB, add_pip_chain },
+	{ "composite_fanout_mix_overlay", 3, RGBA8_sRGB, TO_sRGB, add_fanout_chain },
+	{ "composite_fanout_mix_overlay_cost_model", 3, RGBA8_sRGB, TO_sRGB, add_fanout_chain_cost_model },
+	{ "color_grade_ycbcr", 1, INPUT_YCBCR420, COLORSPACE_REC_709, GAMMA_REC_709, TO_sRGB, add_color_grade },
+	{ "color_grade_ycbcr_lut33", 1, INPUT_YCBCR420, COLORSPACE_REC_709, GAMMA_REC_709, TO_sRGB, add_color_grade_lut33 },
+	{ "color_grade_ycbcr_lut65", 1, INPUT_YCBCR420, COLORSPACE_REC_709, GAMMA_REC_709, TO_sRGB, add_color_grade_lut65 },
+};
+
+#undef RGBA8_sRGB
+#undef TO_sRGB
+
+struct Resolution {
+	const char *name;
+	unsigned width, height;
+};
+
+const Resolution resolutions[] = {
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "2160p", 3840, 2160 },
+};
+
+YCbCrFormat get_rec709_ycbcr_format(unsigned chroma_subsampling)
+{
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_709;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 256;
+	ycbcr_format.chroma_subsampling_x = chroma_subsampling;
+	ycbcr_format.chroma_subsampling_y = chroma_subsampling;
+	ycbcr_format.cb_x_position = 0.0f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.0f;
+	ycbcr_format.cr_y_position = 0.5f;
+	return ycbcr_format;
+}
+
+// Fill <data> with something that is not constant, so that no driver
+// can take any shortcuts.
+void fill_with_noise(vector<unsigned char> *data)
+{
+	unsigned seed = 1234;
+	for (size_t i = 0; i < data->size(); ++i) {
+		seed = seed * 1103515245 + 12345;
+		(*data)[i] = seed >> 24;
+	}
+}
+
+// Builds the given chain, renders it <num_frames> times and prints the results.
+void run_benchmark(const Benchmark &benchmark, const Resolution &resolution,
+                   unsigned num_frames, ResourcePool *resource_pool)
+{
+	const unsigned width = resolution.width, height = resolution.height;
+	EffectChain chain(width, height, resource_pool);
+
+	ImageFormat format;
+	format.color_space = benchmark.input_color_space;
+	format.gamma_curve = benchmark.input_gamma_curve;
+
+	// All inputs share the same pixel data, but it is uploaded separately
+	// for each of them, every frame.
+	vector<unsigned char> pixel_data;
+	vector<Effect *> inputs;
+	vector<FlatInput *> flat_inputs;
+	vector<YCbCrInput *> ycbcr_inputs;
+	size_t bytes_per_frame = 0;
+	for (unsigned i = 0; i < benchmark.num_inputs; ++i) {
+		if (benchmark.input_type == INPUT_YCBCR420) {
+			pixel_data.resize(width * height * 3 / 2);
+			YCbCrInput *input = new YCbCrInput(format, get_rec709_ycbcr_format(2), width, height);
+			inputs.push_back(chain.add_input(input));
+			ycbcr_inputs.push_back(input);
+			bytes_per_frame += width * height * 3 / 2;
+		} else {
+			pixel_data.resize(width * height * 4);
+			MovitPixelFormat pixel_format = (benchmark.input_type == INPUT_RGBA8_PREMULTIPLIED) ?
+				FORMAT_RGBA_PREMULTIPLIED_ALPHA : FORMAT_RGBA_POSTMULTIPLIED_ALPHA;
+			FlatInput *input = new FlatInput(format, pixel_format, GL_UNSIGNED_BYTE, width, height);
+			inputs.push_back(chain.add_input(input));
+			flat_inputs.push_back(input);
+			bytes_per_frame += width * height * 4;
+		}
+	}
+	fill_with_noise(&pixel_data);
+
+	if (benchmark.add_effects != NULL) {
+		benchmark.add_effects(&chain, inputs, width, height);
+	}
+
+	ImageFormat output_format;
+	output_format.color_space = benchmark.output_color_space;
+	output_format.gamma_curve = benchmark.output_gamma_curve;
+	if (benchmark.ycbcr_output) {
+		chain.add_ycbcr_output(output_format, benchmark.output_alpha_format, get_rec709_ycbcr_format(1));
+	} else {
+		chain.add_output(output_format, benchmark.output_alpha_format);
+	}
+	chain.set_dither_bits(benchmark.dither_bits);
+	chain.finalize();
+
+	GLuint output_texture = resource_pool->create_2d_texture(GL_RGBA8, width, height);
+	GLuint fbo = resource_pool->create_fbo(output_texture);
+
+	const bool do_phase_timing = movit_timer_queries_supported;
+	chain.enable_phase_timing(do_phase_timing);
+
+	uint64_t start_ns = 0, cpu_ns = 0;
+	const unsigned num_warmup_frames = 2;
+	for (unsigned frame = 0; frame < num_frames + num_warmup_frames; ++frame) {
+		if (frame == num_warmup_frames) {
+			// Do not count shader compilation, first-time allocation etc.
+			glFinish();
+			check_error();
+			chain.reset_phase_timing();
+			start_ns = get_monotonic_time_ns();
+			cpu_ns = 0;
+		}
+
+		uint64_t frame_start_ns = get_monotonic_time_ns();
+		for (unsigned i = 0; i < flat_inputs.size(); ++i) {
+			flat_inputs[i]->set_pixel_data(&pixel_data[0]);
+		}
+		for (unsigned i = 0; i < ycbcr_inputs.size(); ++i) {
+			ycbcr_inputs[i]->set_pixel_data(0, &pixel_data[0]);
+			ycbcr_inputs[i]->set_pixel_data(1, &pixel_data[width * height]);
+			ycbcr_inputs[i]->set_pixel_data(2, &pixel_data[width * height * 5 / 4]);
+		}
+		chain.render_to_fbo(fbo, width, height);
+		cpu_ns += get_monotonic_time_ns() - frame_start_ns;
+	}
+	glFinish();
+	check_error();
+	double elapsed_sec = (get_monotonic_time_ns() - start_ns) * 1e-9;
+
+	double fps = num_frames / elapsed_sec;
+	printf("%-34s %-6s %8.1f fps  %7.3f ms CPU/frame  %8.1f MB/s input\n",
+		benchmark.name, resolution.name, fps,
+		cpu_ns * 1e-6 / num_frames,
+		bytes_per_frame * fps / 1048576.0);
+
+	if (do_phase_timing) {
+		// The glFinish() above means every timer query has its result
+		// ready, so get_phase_timing() does not miss any frames.
+		vector<PhaseTiming> timings = chain.get_phase_timing();
+		for (unsigned phase_num = 0; phase_num < timings.size(); ++phase_num) {
+			const PhaseTiming &timing = timings[phase_num];
+			string effects;
+			for (unsigned i = 0; i < timing.effects.size(); ++i) {
+				if (i != 0) {
+					effects += ", ";
+				}
+				effects += timing.effects[i]->effect_type_id();
+			}
+			printf("    phase %u: GPU min/avg/p95/max %.3f/%.3f/%.3f/%.3f ms  [%s]\n",
+				phase_num, timing.min_gpu_ms, timing.avg_gpu_ms,
+				timing.p95_gpu_ms, timing.max_gpu_ms, effects.c_str());
+		}
+	}
+
+	resource_pool->release_fbo(fbo);
+	resource_pool->release_2d_texture(output_texture);
+}
+
+// Renders random colors through add_color_grade(), with the given
+// LUT size (zero for no baking), and reads back the result.
+void render_color_grade(const vector<float> &pixel_data, unsigned width, unsigned height,
+                        unsigned lut_size, ResourcePool *resource_pool, vector<float> *out_data)
+{
+	EffectChain chain(width, height, resource_pool);
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+	FlatInput *input = new FlatInput(format, FORMAT_RGB, GL_FLOAT, width, height);
+	input->set_pixel_data(&pixel_data[0]);
+	chain.add_input(input);
+	chain.set_lut_baking(lut_size);
+	add_color_grade(&chain, vector<Effect *>(), width, height);
+	chain.add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	chain.finalize();
+
+	GLuint output_texture = resource_pool->create_2d_texture(GL_RGBA32F, width, height);
+	GLuint fbo = resource_pool->create_fbo(output_texture);
+	chain.render_to_fbo(fbo, width, height);
+
+	out_data->resize(width * height * 4);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, &(*out_data)[0]);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+
+	resource_pool->release_fbo(fbo);
+	resource_pool->release_2d_texture(output_texture);
+}
+
+// Compares the output of the color grading chain with and without
+// LUT baking, in units of 8-bit code values.
+void report_lut_accuracy(ResourcePool *resource_pool)
+{
+	const unsigned width = 512, height = 512;
+	vector<float> pixel_data(width * height * 3);
+	unsigned seed = 1234;
+	for (size_t i = 0; i < pixel_data.size(); ++i) {
+		seed = seed * 1103515245 + 12345;
+		pixel_data[i] = (seed >> 8) * (1.0f / (1 << 24));
+	}
+
+	vector<float> reference, baked;
+	render_color_grade(pixel_data, width, height, 0, resource_pool, &reference);
+
+	static const unsigned lut_sizes[] = { 17, 33, 65 };
+	for (unsigned i = 0; i < sizeof(lut_sizes) / sizeof(lut_sizes[0]); ++i) {
+		render_color_grade(pixel_data, width, height, lut_sizes[i], resource_pool, &baked);
+		double max_error = 0.0, sum_squared_error = 0.0;
+		size_t num_visible = 0;
+		for (size_t j = 0; j < width * height; ++j) {
+			for (unsigned c = 0; c < 3; ++c) {
+				double error = fabs(baked[j * 4 + c] - reference[j * 4 + c]) * 255.0;
+				max_error = max(max_error, error);
+				sum_squared_error += error * error;
+				if (error >= 0.5) {
+					++num_visible;
+				}
+			}
+		}
+		printf("lut_accuracy/%ux%ux%u  error in 8-bit code values: max %.3f  rms %.4f  %.3f%% of values off by 0.5 or more\n",
+			lut_sizes[i], lut_sizes[i], lut_sizes[i], max_error,
+			sqrt(sum_squared_error / (width * height * 3)),
+			100.0 * num_visible / (width * height * 3));
+	}
+}
+
+bool matches_filter(const char *name, const vector<string> &filters)
+{
+	if (filters.empty()) {
+		return true;
+	}
+	for (unsigned i = 0; i < filters.size(); ++i) {
+		if (strstr(name, filters[i].c_str()) != NULL) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [--frames N] [--resolution 720p|1080p|2160p] [name...]\n", argv0);
+	exit(1);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+	unsigned num_frames = 50;
+	const char *only_resolution = NULL;
+	vector<string> filters;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			num_frames = atoi(argv[++i]);
+			if (num_frames == 0) {
+				usage(argv[0]);
+			}
+		} else if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc) {
+			only_resolution = argv[++i];
+		} else if (argv[i][0] == '-') {
+			usage(argv[0]);
+		} else {
+			filters.push_back(argv[i]);
+		}
+	}
+
+	// Set up an OpenGL context using SDL, the same way as the unit tests.
+	if (SDL_Init(SDL_INIT_VIDEO) == -1) {
+		fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
+		exit(1);
+	}
+	SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 0);
+	SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 0);
+	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+#ifdef HAVE_SDL2
+	SDL_Window *window = SDL_CreateWindow("OpenGL window for benchmark",
+		SDL_WINDOWPOS_UNDEFINED,
+		SDL_WINDOWPOS_UNDEFINED,
+		32, 32,
+		SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	SDL_GLContext context = SDL_GL_CreateContext(window);
+	if (context == NULL) {
+		fprintf(stderr, "SDL_GL_CreateContext failed: %s\n", SDL_GetError());
+		exit(1);
+	}
+#else
+	SDL_SetVideoMode(32, 32, 0, SDL_OPENGL);
+	SDL_WM_SetCaption("OpenGL window for benchmark", NULL);
+#endif
+
+	CHECK(init_movit(".", MOVIT_DEBUG_OFF));
+	printf("GL_RENDERER: %s\n", (const char *)glGetString(GL_RENDERER));
+	if (!movit_timer_queries_supported) {
+		printf("No timer queries; per-phase GPU times will not be reported.\n");
+	}
+
+	ResourcePool resource_pool;
+	for (unsigned res_num = 0; res_num < sizeof(resolutions) / sizeof(resolutions[0]); ++res_num) {
+		if (only_resolution != NULL && strcmp(only_resolution, resolutions[res_num].name) != 0) {
+			continue;
+		}
+		for (unsigned bench_num = 0; bench_num < sizeof(benchmarks) / sizeof(benchmarks[0]); ++bench_num) {
+			if (!matches_filter(benchmarks[bench_num].name, filters)) {
+				continue;
+			}
+			run_benchmark(benchmarks[bench_num], resolutions[res_num], num_frames, &resource_pool);
+			fflush(stdout);
+		}
+	}
+	if (matches_filter("lut_accuracy", filters)) {
+		report_lut_accuracy(&resource_pool);
+	}
+
+	SDL_Quit();
+	return 0;
+}
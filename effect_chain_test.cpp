@@ -8,7 +8,15 @@
 
 #include <epoxy/gl.h>
 #include <assert.h>
-
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "blur_effect.h"
 #include "effect.h"
 #include "effect_chain.h"
 #include "flat_input.h"
@@ -18,7 +26,9 @@
 #include "mirror_effect.h"
 #include "multiply_effect.h"
 #include "resize_effect.h"
+#include "resource_pool.h"
 #include "test_util.h"
+#include "trace.h"
 #include "util.h"
 
 using namespace std;
@@ -66,6 +76,7 @@ public:
 	string output_fragment_shader() { return read_file("identity.frag"); }
 	bool needs_texture_bounce() const { return true; }
 	AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
+	Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 };
 
 TEST(EffectChainTest, TextureBouncePreservesIdentity) {
@@ -81,6 +92,79 @@ TEST(EffectChainTest, TextureBouncePreservesIdentity) {
 	expect_equal(data, out_data, 3, 2);
 }
 
+TEST(EffectChainTest, IntermediateTexturesAreReleasedAfterLastUse) {
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+	float out_data[6];
+	EffectChainTester tester(data, 3, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(data, out_data, 3, 2);
+
+	// Four phases (the first bounce can sample directly from the input),
+	// but only two 3x2 fp16 RGBA textures should ever be live at the same
+	// time, namely the input and output of the phase being run.
+	EXPECT_EQ(2u * 3 * 2 * 8, tester.get_chain()->get_peak_intermediate_bytes());
+}
+
+// Like BouncingIdentityEffect, but happy to work on gamma-compressed data.
+class NonLinearBouncingIdentityEffect : public BouncingIdentityEffect {
+public:
+	NonLinearBouncingIdentityEffect() {}
+	bool needs_linear_light() const { return false; }
+	bool needs_srgb_primaries() const { return false; }
+};
+
+TEST(EffectChainTest, NarrowIntermediateFormatForGammaCompressedBlankAlpha) {
+	float data[] = {
+		0.0f / 255.0f, 64.0f / 255.0f, 128.0f / 255.0f,
+		191.0f / 255.0f, 254.0f / 255.0f, 255.0f / 255.0f,
+	};
+	unsigned char expected_data[] = {
+		0, 64, 128,
+		191, 254, 255,
+	};
+	unsigned char out_data[6];
+	EffectChainTester tester(data, 3, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_sRGB, GL_RGBA8);
+	Effect *first = tester.get_chain()->add_effect(new NonLinearBouncingIdentityEffect());
+	tester.get_chain()->add_effect(new NonLinearBouncingIdentityEffect());
+	tester.get_chain()->set_dither_bits(8);
+	tester.get_chain()->set_intermediate_format_policy(INTERMEDIATE_FORMAT_NARROW_WHEN_SAFE);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_sRGB);
+
+	// Allow for the dither flipping the rounding one way or the other.
+	expect_equal(expected_data, out_data, 3, 2, 2, 1.0);
+
+	Node *node = tester.get_chain()->find_node_for_effect(first);
+	EXPECT_EQ(GL_RGB10_A2, node->containing_phase->intermediate_format);
+	EXPECT_EQ(2u * 3 * 4, tester.get_chain()->get_peak_intermediate_bytes());
+}
+
+TEST(EffectChainTest, NoNarrowIntermediateFormatForLinearLight) {
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+	float out_data[6];
+	EffectChainTester tester(data, 3, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *first = tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.get_chain()->set_dither_bits(8);
+	tester.get_chain()->set_intermediate_format_policy(INTERMEDIATE_FORMAT_NARROW_WHEN_SAFE);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(data, out_data, 3, 2);
+
+	Node *node = tester.get_chain()->find_node_for_effect(first);
+	EXPECT_EQ(GL_RGBA16F, node->containing_phase->intermediate_format);
+}
+
 TEST(MirrorTest, BasicTest) {
 	float data[] = {
 		0.0f, 0.25f, 0.3f,
@@ -415,6 +499,71 @@ TEST(EffectChainTest, NoAlphaConversionsWhenPremultipliedAlphaNotNeeded) {
 	expect_equal(expected_data, out_data, 4, size);
 }
 
+// With premultiplied output, the fixups put an alpha multiplication at the
+// end, and then an alpha division right after it for the gamma compression,
+// giving MirrorEffect -> GammaExpansionEffect -> AlphaMultiplicationEffect ->
+// AlphaDivisionEffect -> GammaCompressionEffect. The alpha conversions cancel
+// out, and then so do the gamma conversions, including the output node.
+TEST(EffectChainTest, InverseConversionsAreRemoved) {
+	const int size = 3;
+	float data[4 * size] = {
+		0.8f, 0.0f, 0.0f, 0.5f,
+		0.0f, 0.2f, 0.2f, 0.3f,
+		0.1f, 0.0f, 1.0f, 1.0f,
+	};
+	float expected_data[4 * size] = {
+		0.1f, 0.0f, 1.0f, 1.0f,
+		0.0f, 0.2f, 0.2f, 0.3f,
+		0.8f, 0.0f, 0.0f, 0.5f,
+	};
+	float out_data[4 * size];
+	EffectChainTester tester(data, size, 1, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+	RewritingEffect<MirrorEffect> *effect = new RewritingEffect<MirrorEffect>();
+	tester.get_chain()->add_effect(effect);
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+
+	Node *node = effect->replaced_node;
+	ASSERT_EQ(1, node->incoming_links.size());
+	EXPECT_EQ(0, node->outgoing_links.size());
+	EXPECT_EQ("FlatInput", node->incoming_links[0]->effect->effect_type_id());
+
+	expect_equal(expected_data, out_data, 4, size);
+}
+
+// Same, but with a different output gamma curve, so that only the alpha
+// conversions cancel out. The output should be the same as when asking for
+// postmultiplied output, where they are never inserted.
+TEST(EffectChainTest, InverseAlphaConversionsAreRemovedBetweenGammaConversions) {
+	const int size = 3;
+	float data[4 * size] = {
+		0.8f, 0.0f, 0.0f, 0.5f,
+		0.0f, 0.2f, 0.2f, 0.3f,
+		0.1f, 0.0f, 1.0f, 1.0f,
+	};
+	float expected_data[4 * size];
+	float out_data[4 * size];
+	{
+		EffectChainTester tester(data, size, 1, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+		tester.get_chain()->add_effect(new MirrorEffect());
+		tester.run(expected_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_REC_709, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	}
+
+	EffectChainTester tester(data, size, 1, FORMAT_RGBA_POSTMULTIPLIED_ALPHA, COLORSPACE_sRGB, GAMMA_sRGB);
+	RewritingEffect<MirrorEffect> *effect = new RewritingEffect<MirrorEffect>();
+	tester.get_chain()->add_effect(effect);
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_REC_709, OUTPUT_ALPHA_FORMAT_PREMULTIPLIED);
+
+	Node *node = effect->replaced_node;
+	ASSERT_EQ(1, node->outgoing_links.size());
+	Node *expansion = node->outgoing_links[0];
+	EXPECT_EQ("GammaExpansionEffect", expansion->effect->effect_type_id());
+	ASSERT_EQ(1, expansion->outgoing_links.size());
+	EXPECT_EQ("GammaCompressionEffect", expansion->outgoing_links[0]->effect->effect_type_id());
+	EXPECT_EQ(0, expansion->outgoing_links[0]->outgoing_links.size());
+
+	expect_equal(expected_data, out_data, 4, size);
+}
+
 // An input that outputs only blue, which has blank alpha.
 class BlueInput : public Input {
 public:
@@ -977,6 +1126,109 @@ TEST(EffectChainTest, SameInputsGiveSameOutputs) {
 	EXPECT_EQ(2, input_store->input_height);
 }
 
+// An IdentityEffect that can be merged with identical ones,
+// with a parameter that does nothing.
+class MergeableIdentityEffect : public IdentityEffect {
+public:
+	MergeableIdentityEffect() : unused(0.0f) { register_float("unused", &unused); }
+	virtual string effect_type_id() const { return "MergeableIdentityEffect"; }
+	virtual bool is_mergeable() const { return true; }
+
+private:
+	float unused;
+};
+
+// An AddEffect that needs its inputs in textures.
+class BouncingAddEffect : public AddEffect {
+public:
+	BouncingAddEffect() {}
+	bool needs_texture_bounce() const { return true; }
+};
+
+// Constructs the graph
+//
+//                    FlatInput                        |
+//                   /         \                       |
+//  MergeableIdentityEffect   MergeableIdentityEffect  |
+//                   \         /                       |
+//                 BouncingAddEffect                   |
+//
+// and verifies that the two identical effects are merged into one
+// (which is then rendered once and read twice), without changing the output.
+TEST(EffectChainTest, CommonSubexpressionElimination) {
+	float data[] = {
+		1.0f, 0.5f,
+		0.25f, 0.0f,
+	};
+	float expected_data[] = {
+		2.0f, 1.0f,
+		0.5f, 0.0f,
+	};
+	float out_data[2 * 2];
+	EffectChainTester tester(NULL, 2, 2);
+	tester.get_chain()->enable_common_subexpression_elimination(true);
+	Input *input = tester.add_input(data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *first = tester.get_chain()->add_effect(new MergeableIdentityEffect(), input);
+	Effect *second = tester.get_chain()->add_effect(new MergeableIdentityEffect(), input);
+	tester.get_chain()->add_effect(new BouncingAddEffect(), first, second);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(expected_data, out_data, 2, 2);
+	EXPECT_FALSE(tester.get_chain()->find_node_for_effect(first)->disabled);
+	EXPECT_TRUE(tester.get_chain()->find_node_for_effect(second)->disabled);
+}
+
+TEST(EffectChainTest, MergedEffectsCanChangeParametersTogether) {
+	float data[] = {
+		1.0f, 0.5f,
+		0.25f, 0.0f,
+	};
+	float expected_data[] = {
+		2.0f, 1.0f,
+		0.5f, 0.0f,
+	};
+	float out_data[2 * 2];
+	EffectChainTester tester(NULL, 2, 2);
+	tester.get_chain()->enable_common_subexpression_elimination(true);
+	Input *input = tester.add_input(data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *first = tester.get_chain()->add_effect(new MergeableIdentityEffect(), input);
+	Effect *second = tester.get_chain()->add_effect(new MergeableIdentityEffect(), input);
+	tester.get_chain()->add_effect(new BouncingAddEffect(), first, second);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, 2, 2);
+
+	// Changing both (before the next frame) is fine; the parameters
+	// are compared again, and still match.
+	ASSERT_TRUE(first->set_float("unused", 1.0f));
+	ASSERT_TRUE(second->set_float("unused", 1.0f));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, 2, 2);
+}
+
+TEST(EffectChainTest, NoCommonSubexpressionEliminationWithDifferentParameters) {
+	float data[] = {
+		1.0f, 0.5f,
+		0.25f, 0.0f,
+	};
+	float expected_data[] = {
+		2.0f, 1.0f,
+		0.5f, 0.0f,
+	};
+	float out_data[2 * 2];
+	EffectChainTester tester(NULL, 2, 2);
+	tester.get_chain()->enable_common_subexpression_elimination(true);
+	Input *input = tester.add_input(data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *first = tester.get_chain()->add_effect(new MergeableIdentityEffect(), input);
+	Effect *second = tester.get_chain()->add_effect(new MergeableIdentityEffect(), input);
+	ASSERT_TRUE(second->set_float("unused", 1.0f));
+	tester.get_chain()->add_effect(new BouncingAddEffect(), first, second);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(expected_data, out_data, 2, 2);
+	EXPECT_FALSE(tester.get_chain()->find_node_for_effect(first)->disabled);
+	EXPECT_FALSE(tester.get_chain()->find_node_for_effect(second)->disabled);
+}
+
 TEST(EffectChainTest, AspectRatioConversion) {
 	float data1[4 * 3] = {
 		0.0f, 0.0f, 0.0f, 0.0f,
@@ -1123,6 +1375,57 @@ public:
 	virtual bool one_to_one_sampling() const { return true; }
 };
 
+// Constructs the graph
+//
+//             FlatInput               |
+//                 |                   |
+//           OneToOneEffect            |
+//            /         \              |
+//  MultiplyEffect  MultiplyEffect     |
+//            \         /              |
+//             AddEffect               |
+//
+// with and without the phase cost model. The OneToOneEffect is cheap,
+// so with the cost model, it should be computed twice in the same phase
+// as the rest, instead of being rendered to a texture in a phase of its own.
+TEST(EffectChainTest, CostModelRecomputesCheapSharedEffects) {
+	float data[] = {
+		1.0f, 1.0f,
+		1.0f, 0.0f,
+	};
+	float expected_data[] = {
+		2.5f, 2.5f,
+		2.5f, 0.0f,
+	};
+	const float half[] = { 0.5f, 0.5f, 0.5f, 0.5f };
+	const float two[] = { 2.0f, 2.0f, 2.0f, 0.5f };
+
+	for (int use_cost_model = 0; use_cost_model <= 1; ++use_cost_model) {
+		float out_data[2 * 2];
+		EffectChainTester tester(NULL, 2, 2);
+		if (use_cost_model) {
+			tester.get_chain()->set_phase_cost_model(PhaseCostModel());
+		}
+		Input *input = tester.add_input(data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+		Effect *shared = tester.get_chain()->add_effect(new OneToOneEffect(), input);
+		Effect *mul_half = tester.get_chain()->add_effect(new MultiplyEffect(), shared);
+		ASSERT_TRUE(mul_half->set_vec4("factor", half));
+		Effect *mul_two = tester.get_chain()->add_effect(new MultiplyEffect(), shared);
+		ASSERT_TRUE(mul_two->set_vec4("factor", two));
+		Effect *add = tester.get_chain()->add_effect(new AddEffect(), mul_half, mul_two);
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+		expect_equal(expected_data, out_data, 2, 2);
+		Node *shared_node = tester.get_chain()->find_node_for_effect(shared);
+		Node *add_node = tester.get_chain()->find_node_for_effect(add);
+		if (use_cost_model) {
+			EXPECT_EQ(add_node->containing_phase, shared_node->containing_phase);
+		} else {
+			EXPECT_NE(add_node->containing_phase, shared_node->containing_phase);
+		}
+	}
+}
+
 TEST(EffectChainTest, NoBounceWithOneToOneSampling) {
 	const int size = 2;
 	float data[size * size] = {
@@ -1258,6 +1561,765 @@ TEST(EffectChainTest, IdentityWithOwnPool) {
 	movit_debug_level = MOVIT_DEBUG_OFF;
 }
 
+TEST(EffectChainTest, RenderToBuffer) {
+	const int width = 3, height = 2;
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+	float out_data[6];
+
+	EffectChain chain(width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+	input->set_pixel_data(data);
+	chain.add_input(input);
+	chain.add_effect(new BouncingIdentityEffect());
+	chain.add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	chain.set_output_origin(OUTPUT_ORIGIN_TOP_LEFT);
+	chain.finalize();
+
+	ReadbackTicket *ticket = chain.render_to_buffer(GL_RGBA32F, width, height, GL_RGBA, GL_FLOAT);
+	ASSERT_EQ(1u, ticket->get_num_planes());
+	EXPECT_EQ(size_t(width * height * 4 * sizeof(float)), ticket->get_plane_size(0));
+
+	const vector<const void *> &planes = ticket->wait();
+	EXPECT_TRUE(ticket->poll());
+	const float *rgba = static_cast<const float *>(planes[0]);
+	for (unsigned i = 0; i < 6; ++i) {
+		out_data[i] = rgba[i * 4];
+	}
+	expect_equal(data, out_data, width, height);
+
+	delete ticket;
+}
+
+TEST(EffectChainTest, FramesInFlight) {
+	const int width = 3, height = 2;
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+	float expected_data[6], out_data[6];
+	EffectChainTester tester(NULL, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	FlatInput *input = static_cast<FlatInput *>(
+		tester.add_input(data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR));
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.get_chain()->set_frames_in_flight(2);
+
+	// Upload new data for every frame; each frame should see its own.
+	for (unsigned frame = 0; frame < 5; ++frame) {
+		for (unsigned i = 0; i < 6; ++i) {
+			expected_data[i] = data[i] * (frame + 1) * 0.2f;
+		}
+		input->set_pixel_data(expected_data);
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+		expect_equal(expected_data, out_data, width, height);
+	}
+}
+
+// Changes only some of the uniforms in a phase from frame to frame,
+// to check that every change makes it to the shader (we only upload
+// what changed when using uniform blocks).
+TEST(EffectChainTest, UniformChangesBetweenFrames) {
+	const int width = 2, height = 1;
+	float data[] = { 0.5f, 1.0f };
+	float expected_data[2], out_data[2];
+	float first_factor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	float second_factor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	MultiplyEffect *first = new MultiplyEffect();
+	MultiplyEffect *second = new MultiplyEffect();
+	tester.get_chain()->add_effect(first);
+	tester.get_chain()->add_effect(second);
+
+	const float factors[][2] = {
+		{ 1.0f, 1.0f },
+		{ 1.0f, 0.5f },
+		{ 0.25f, 0.5f },
+		{ 0.25f, 0.5f },
+		{ 1.0f, 1.0f },
+	};
+	for (unsigned frame = 0; frame < sizeof(factors) / sizeof(factors[0]); ++frame) {
+		first_factor[0] = first_factor[1] = first_factor[2] = factors[frame][0];
+		second_factor[0] = second_factor[1] = second_factor[2] = factors[frame][1];
+		ASSERT_TRUE(first->set_vec4("factor", first_factor));
+		ASSERT_TRUE(second->set_vec4("factor", second_factor));
+		for (unsigned i = 0; i < 2; ++i) {
+			expected_data[i] = data[i] * factors[frame][0] * factors[frame][1];
+		}
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+		expect_equal(expected_data, out_data, width, height);
+	}
+}
+
+TEST(EffectChainTest, BypassWithoutRecompiling) {
+	const int width = 2, height = 1;
+	float data[] = { 0.5f, 1.0f };
+	float expected_data[] = { 0.25f, 0.5f };
+	float out_data[2];
+	const float half[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+
+	EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	MultiplyEffect *multiply_effect = new MultiplyEffect();
+	ASSERT_TRUE(multiply_effect->set_vec4("factor", half));
+	tester.get_chain()->add_effect(multiply_effect);
+	tester.get_chain()->set_bypassable(multiply_effect);
+
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, width, height);
+	ResourcePool *resource_pool = tester.get_chain()->get_resource_pool();
+	unsigned num_compiled = resource_pool->get_stats().event_counts[RESOURCE_POOL_PROGRAM_COMPILED];
+
+	tester.get_chain()->set_bypass(multiply_effect, true);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, width, height);
+
+	tester.get_chain()->set_bypass(multiply_effect, false);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, width, height);
+
+	EXPECT_EQ(num_compiled, resource_pool->get_stats().event_counts[RESOURCE_POOL_PROGRAM_COMPILED]);
+}
+
+TEST(EffectChainTest, FrozenParameterChangesRecompile) {
+	const int width = 2, height = 1;
+	float data[] = { 0.5f, 1.0f };
+	float expected_data[2], out_data[2];
+	const float half[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	const float quarter[] = { 0.25f, 0.25f, 0.25f, 1.0f };
+
+	EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	MultiplyEffect *multiply_effect = new MultiplyEffect();
+	ASSERT_TRUE(multiply_effect->set_vec4("factor", half));
+	ASSERT_TRUE(multiply_effect->freeze_parameter("factor"));
+	EXPECT_FALSE(multiply_effect->freeze_parameter("nonexistent"));
+	tester.get_chain()->add_effect(multiply_effect);
+
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	for (unsigned i = 0; i < 2; ++i) {
+		expected_data[i] = data[i] * 0.5f;
+	}
+	expect_equal(expected_data, out_data, width, height);
+	ResourcePool *resource_pool = tester.get_chain()->get_resource_pool();
+	unsigned num_compiled = resource_pool->get_stats().event_counts[RESOURCE_POOL_PROGRAM_COMPILED];
+
+	// A new value needs a new program.
+	ASSERT_TRUE(multiply_effect->set_vec4("factor", quarter));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	for (unsigned i = 0; i < 2; ++i) {
+		expected_data[i] = data[i] * 0.25f;
+	}
+	expect_equal(expected_data, out_data, width, height);
+	EXPECT_EQ(num_compiled + 1, resource_pool->get_stats().event_counts[RESOURCE_POOL_PROGRAM_COMPILED]);
+
+	// Going back should find the old one in the pool.
+	ASSERT_TRUE(multiply_effect->set_vec4("factor", half));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	for (unsigned i = 0; i < 2; ++i) {
+		expected_data[i] = data[i] * 0.5f;
+	}
+	expect_equal(expected_data, out_data, width, height);
+	EXPECT_EQ(num_compiled + 1, resource_pool->get_stats().event_counts[RESOURCE_POOL_PROGRAM_COMPILED]);
+}
+
+TEST(EffectChainTest, FrozenParametersMustBeFinite) {
+	const float half[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	const float infinite[] = { 0.5f, 0.5f, 0.5f, HUGE_VALF };
+
+	MultiplyEffect multiply_effect;
+	ASSERT_TRUE(multiply_effect.set_vec4("factor", infinite));
+	EXPECT_FALSE(multiply_effect.freeze_parameter("factor"));
+	EXPECT_FALSE(multiply_effect.is_parameter_frozen("factor"));
+
+	ASSERT_TRUE(multiply_effect.set_vec4("factor", half));
+	ASSERT_TRUE(multiply_effect.freeze_parameter("factor"));
+	EXPECT_FALSE(multiply_effect.set_vec4("factor", infinite));
+}
+
+// SingleBlurPassEffect registers a uniform array in output_fragment_shader(),
+// so recompiling its phase must not ask for the shader again.
+TEST(EffectChainTest, FrozenParameterChangesRecompileWithBlur) {
+	const int width = 4, height = 4;
+	float data[width * height] = {
+		0.0f, 1.0f, 0.0f, 1.0f,
+		1.0f, 0.5f, 0.0f, 0.0f,
+		0.0f, 0.0f, 0.25f, 1.0f,
+		1.0f, 0.0f, 0.0f, 0.75f,
+	};
+	float expected_data[width * height], out_data[width * height];
+	const float half[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	const float quarter[] = { 0.25f, 0.25f, 0.25f, 1.0f };
+
+	EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	BlurEffect *blur_effect = new BlurEffect();
+	ASSERT_TRUE(blur_effect->set_float("radius", 1.0f));
+	tester.get_chain()->add_effect(blur_effect);
+	MultiplyEffect *multiply_effect = new MultiplyEffect();
+	ASSERT_TRUE(multiply_effect->set_vec4("factor", half));
+	ASSERT_TRUE(multiply_effect->freeze_parameter("factor"));
+	tester.get_chain()->add_effect(multiply_effect);
+
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	for (unsigned i = 0; i < width * height; ++i) {
+		expected_data[i] = out_data[i] * 0.5f;
+	}
+	ResourcePool *resource_pool = tester.get_chain()->get_resource_pool();
+	unsigned num_compiled = resource_pool->get_stats().event_counts[RESOURCE_POOL_PROGRAM_COMPILED];
+
+	ASSERT_TRUE(multiply_effect->set_vec4("factor", quarter));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, width, height);
+	EXPECT_EQ(num_compiled + 1, resource_pool->get_stats().event_counts[RESOURCE_POOL_PROGRAM_COMPILED]);
+}
+
+TEST(EffectChainTest, ParameterTransactionIsAppliedAtFrameStart) {
+	const int width = 2, height = 1;
+	float data[] = { 0.5f, 1.0f };
+	float expected_data[2], out_data[2];
+	const float half[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+
+	EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	MultiplyEffect *first = new MultiplyEffect();
+	MultiplyEffect *second = new MultiplyEffect();
+	tester.get_chain()->add_effect(first);
+	tester.get_chain()->add_effect(second);
+
+	// Nothing happens before the transaction is committed.
+	ParameterTransaction transaction;
+	ASSERT_TRUE(transaction.set_vec4(first, "factor", half));
+	ASSERT_TRUE(transaction.set_vec4(second, "factor", half));
+	EXPECT_FALSE(transaction.set_float(first, "nonexistent", 1.0f));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, width, height);
+
+	tester.get_chain()->commit(&transaction);
+	EXPECT_TRUE(transaction.empty());
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	for (unsigned i = 0; i < 2; ++i) {
+		expected_data[i] = data[i] * 0.25f;
+	}
+	expect_equal(expected_data, out_data, width, height);
+}
+
+namespace {
+
+struct TransactionWriterState {
+	EffectChain *chain;
+	ParamHandle<float> first, second;
+	unsigned num_commits;
+};
+
+// Keeps setting the two factors such that their product is 1,
+// one transaction at a time.
+void *write_transactions(void *arg)
+{
+	TransactionWriterState *state = static_cast<TransactionWriterState *>(arg);
+	ParameterTransaction transaction;
+	for (unsigned i = 0; i < state->num_commits; ++i) {
+		const float factor = (i % 2 == 0) ? 2.0f : 0.25f;
+		const float first[] = { factor, factor, factor, 1.0f };
+		const float second[] = { 1.0f / factor, 1.0f / factor, 1.0f / factor, 1.0f };
+		transaction.set_vec(state->first, first);
+		transaction.set_vec(state->second, second);
+		state->chain->commit(&transaction);
+	}
+	return NULL;
+}
+
+}  // namespace
+
+TEST(EffectChainTest, ParameterTransactionsFromOtherThread) {
+	const int width = 2, height = 1;
+	float data[] = { 0.5f, 1.0f };
+	float out_data[2];
+
+	EffectChainTester tester(data, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	MultiplyEffect *first = new MultiplyEffect();
+	MultiplyEffect *second = new MultiplyEffect();
+	tester.get_chain()->add_effect(first);
+	tester.get_chain()->add_effect(second);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	TransactionWriterState state;
+	state.chain = tester.get_chain();
+	state.first = first->get_vec4_handle("factor");
+	state.second = second->get_vec4_handle("factor");
+	state.num_commits = 10000;
+	ASSERT_TRUE(state.first.is_valid());
+	ASSERT_TRUE(state.second.is_valid());
+
+	pthread_t writer;
+	ASSERT_EQ(0, pthread_create(&writer, NULL, write_transactions, &state));
+
+	// No frame should ever see only one of the factors changed.
+	for (unsigned frame = 0; frame < 20; ++frame) {
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+		expect_equal(data, out_data, width, height);
+	}
+	pthread_join(writer, NULL);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, width, height);
+}
+
+TEST(EffectChainTest, PhaseCacheSkipsUnchangedPhases) {
+	const int width = 2, height = 1;
+	float data[] = { 0.5f, 1.0f };
+	float other_data[] = { 0.25f, 0.75f };
+	float expected_data[2], out_data[2];
+	const float one[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	const float half[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+
+	EffectChainTester tester(NULL, width, height, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	FlatInput *input = static_cast<FlatInput *>(
+		tester.add_input(data, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR));
+	MultiplyEffect *first = new MultiplyEffect();
+	MultiplyEffect *second = new MultiplyEffect();
+	ASSERT_TRUE(first->set_vec4("factor", one));
+	ASSERT_TRUE(second->set_vec4("factor", one));
+	tester.get_chain()->add_effect(first);
+	tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.get_chain()->add_effect(second);
+	tester.get_chain()->set_phase_cache_budget(1048576);
+
+	// First frame; nothing is cached yet.
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, width, height);
+	EXPECT_EQ(0u, tester.get_chain()->get_phase_cache_stats().num_phases_skipped_last_frame);
+	EXPECT_LT(0u, tester.get_chain()->get_phase_cache_stats().cached_bytes);
+
+	// Nothing changed, so the first phase should be skipped.
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(data, out_data, width, height);
+	EXPECT_EQ(1u, tester.get_chain()->get_phase_cache_stats().num_phases_skipped_last_frame);
+
+	// Setting a parameter to the value it already has changes nothing.
+	ASSERT_TRUE(first->set_vec4("factor", one));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	EXPECT_EQ(1u, tester.get_chain()->get_phase_cache_stats().num_phases_skipped_last_frame);
+
+	// Changing the second phase only does not invalidate the first.
+	ASSERT_TRUE(second->set_vec4("factor", half));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	for (unsigned i = 0; i < 2; ++i) {
+		expected_data[i] = data[i] * 0.5f;
+	}
+	expect_equal(expected_data, out_data, width, height);
+	EXPECT_EQ(1u, tester.get_chain()->get_phase_cache_stats().num_phases_skipped_last_frame);
+
+	// New input data invalidates everything. Since the phase just changed,
+	// it is not cached again until it has been seen to be stable.
+	input->set_pixel_data(other_data);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	for (unsigned i = 0; i < 2; ++i) {
+		expected_data[i] = other_data[i] * 0.5f;
+	}
+	expect_equal(expected_data, out_data, width, height);
+	EXPECT_EQ(0u, tester.get_chain()->get_phase_cache_stats().num_phases_skipped_last_frame);
+	EXPECT_EQ(0u, tester.get_chain()->get_phase_cache_stats().cached_bytes);
+
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, width, height);
+	EXPECT_EQ(0u, tester.get_chain()->get_phase_cache_stats().num_phases_skipped_last_frame);
+
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, width, height);
+	EXPECT_EQ(1u, tester.get_chain()->get_phase_cache_stats().num_phases_skipped_last_frame);
+
+	// Turning off the cache throws out what is in it.
+	tester.get_chain()->set_phase_cache_budget(0);
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	expect_equal(expected_data, out_data, width, height);
+	EXPECT_EQ(0u, tester.get_chain()->get_phase_cache_stats().num_phases_skipped_last_frame);
+	EXPECT_EQ(0u, tester.get_chain()->get_phase_cache_stats().cached_bytes);
+}
+
+TEST(EffectChainTest, RenderToFBORegion) {
+	const int width = 8, height = 2;
+	float data[] = {
+		0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f,
+		0.9f, 1.0f, 0.9f, 0.8f, 0.7f, 0.6f, 0.5f, 0.4f,
+	};
+	float temp[width * height * 4];
+
+	EffectChain chain(width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, width, height);
+	input->set_pixel_data(data);
+	chain.add_input(input);
+	MultiplyEffect *multiply = new MultiplyEffect();
+	const float two[] = { 2.0f, 2.0f, 2.0f, 1.0f };
+	ASSERT_TRUE(multiply->set_vec4("factor", two));
+	chain.add_effect(multiply);
+	chain.add_effect(new BouncingIdentityEffect());
+	chain.add_effect(new MirrorEffect());
+	chain.add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	chain.finalize();
+
+	ResourcePool *resource_pool = chain.get_resource_pool();
+	GLuint texnum = resource_pool->create_2d_texture(GL_RGBA32F, width, height);
+	GLuint fbo = resource_pool->create_fbo(texnum);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+	glClearColor(-1.0f, -1.0f, -1.0f, -1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	check_error();
+
+	// The right part of the top row needs only the left part of the
+	// first phase, because of the mirroring.
+	chain.render_to_fbo_region(fbo, width, height, 6, 1, 2, 1);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	check_error();
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, temp);
+	check_error();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_error();
+
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			float expected = -1.0f;
+			if (y == 1 && x >= 6) {
+				// The input data is given top row first.
+				expected = 2.0f * data[(height - 1 - y) * width + (width - 1 - x)];
+			}
+			EXPECT_NEAR(expected, temp[(y * width + x) * 4], 1e-3) << "x=" << x << ", y=" << y;
+		}
+	}
+
+	resource_pool->release_fbo(fbo);
+	resource_pool->release_2d_texture(texnum);
+}
+
+TEST(EffectChainTest, PhaseTiming) {
+	if (!movit_timer_queries_supported) {
+		// Nothing to test.
+		return;
+	}
+
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+	float out_data[6];
+	EffectChainTester tester(data, 3, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *effect = tester.get_chain()->add_effect(new BouncingIdentityEffect());
+	tester.get_chain()->enable_phase_timing(true);
+
+	// The measurement from the first frame may still be outstanding
+	// when we reset; it should not be counted afterwards.
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	tester.get_chain()->reset_phase_timing();
+	for (unsigned i = 0; i < 3; ++i) {
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	}
+
+	// This waits for all outstanding measurements.
+	tester.get_chain()->print_phase_timing();
+
+	vector<PhaseTiming> timings = tester.get_chain()->get_phase_timing();
+	ASSERT_EQ(2u, timings.size());
+	EXPECT_EQ(effect, timings[1].effects[0]);
+	for (unsigned i = 0; i < timings.size(); ++i) {
+		EXPECT_EQ(3u, timings[i].num_measured_iterations);
+		EXPECT_LE(timings[i].min_gpu_ms, timings[i].avg_gpu_ms);
+		EXPECT_LE(timings[i].avg_gpu_ms, timings[i].max_gpu_ms);
+		EXPECT_LE(timings[i].min_gpu_ms, timings[i].p95_gpu_ms);
+		EXPECT_LE(timings[i].p95_gpu_ms, timings[i].max_gpu_ms);
+		EXPECT_EQ(timings[i].effects.size(), timings[i].avg_set_gl_state_ms.size());
+	}
+
+	tester.get_chain()->reset_phase_timing();
+	timings = tester.get_chain()->get_phase_timing();
+	EXPECT_EQ(0u, timings[0].num_measured_iterations);
+	EXPECT_EQ(0.0, timings[0].max_gpu_ms);
+}
+
+TEST(EffectChainTest, TraceRecording) {
+	float data[] = {
+		0.0f, 0.25f, 0.3f,
+		0.75f, 1.0f, 1.0f,
+	};
+	float out_data[6];
+	char filename[] = "/tmp/movit-trace-XXXXXX";
+	int fd = mkstemp(filename);
+	ASSERT_NE(-1, fd);
+	close(fd);
+
+	start_trace_recording();
+	EXPECT_TRUE(trace_recording_enabled());
+	{
+		EffectChainTester tester(data, 3, 2, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+		tester.get_chain()->add_effect(new BouncingIdentityEffect());
+		tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+	}
+	ASSERT_TRUE(stop_trace_recording(filename));
+	EXPECT_FALSE(trace_recording_enabled());
+
+	string trace;
+	FILE *fp = fopen(filename, "r");
+	ASSERT_TRUE(fp != NULL);
+	char buf[4096];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		trace.append(buf, len);
+	}
+	fclose(fp);
+	unlink(filename);
+	EXPECT_EQ(0u, trace.find("{\"traceEvents\":["));
+	EXPECT_NE(string::npos, trace.find("\"EffectChain::finalize\""));
+	EXPECT_NE(string::npos, trace.find("\"compile_glsl_program\""));
+	EXPECT_NE(string::npos, trace.find("\"FlatInput upload\""));
+	EXPECT_NE(string::npos, trace.find("\"BouncingIdentityEffect"));
+}
+
+namespace {
+
+const int identity_width = 3, identity_height = 2;
+float identity_data[] = {
+	0.0f, 0.25f, 0.3f,
+	0.75f, 1.0f, 1.0f,
+};
+
+// Sets up <chain> as a bouncing identity chain on <identity_data>,
+// but does not finalize it.
+void add_identity_chain(EffectChain *chain)
+{
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_LINEAR;
+
+	FlatInput *input = new FlatInput(format, FORMAT_GRAYSCALE, GL_FLOAT, identity_width, identity_height);
+	input->set_pixel_data(identity_data);
+	chain->add_input(input);
+	chain->add_effect(new BouncingIdentityEffect());
+	chain->add_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED);
+	chain->set_output_origin(OUTPUT_ORIGIN_TOP_LEFT);
+}
+
+// Renders a chain set up by add_identity_chain(), and checks that
+// the data comes out unchanged.
+void render_identity_chain(EffectChain *chain)
+{
+	float out_data[identity_width * identity_height];
+	ReadbackTicket *ticket = chain->render_to_buffer(GL_RGBA32F, identity_width, identity_height, GL_RGBA, GL_FLOAT);
+	const float *rgba = static_cast<const float *>(ticket->wait()[0]);
+	for (unsigned i = 0; i < identity_width * identity_height; ++i) {
+		out_data[i] = rgba[i * 4];
+	}
+	expect_equal(identity_data, out_data, identity_width, identity_height);
+	delete ticket;
+}
+
+// Renders <identity_data> through a bouncing identity chain using
+// the given pool, and checks that it comes out unchanged.
+void render_identity_with_pool(ResourcePool *resource_pool)
+{
+	EffectChain chain(identity_width, identity_height, resource_pool);
+	add_identity_chain(&chain);
+	chain.finalize();
+	render_identity_chain(&chain);
+}
+
+}  // namespace
+
+TEST(EffectChainTest, ProgramCacheOnDisk) {
+	if (!movit_program_binaries_supported) {
+		// Nothing to test; the cache is silently disabled.
+		return;
+	}
+
+	char directory[] = "/tmp/movit-program-cache-XXXXXX";
+	ASSERT_TRUE(mkdtemp(directory) != NULL);
+
+	// The first pool needs to compile everything, and stores it on disk.
+	unsigned num_programs;
+	{
+		ResourcePool resource_pool;
+		resource_pool.set_program_cache_directory(directory);
+		render_identity_with_pool(&resource_pool);
+		ProgramCacheStats stats = resource_pool.get_program_cache_stats();
+		EXPECT_EQ(0u, stats.hits);
+		EXPECT_EQ(0u, stats.rejected);
+		num_programs = stats.misses;
+		EXPECT_LT(0u, num_programs);
+	}
+
+	// A fresh pool should get all of them from disk.
+	{
+		ResourcePool resource_pool;
+		resource_pool.set_program_cache_directory(directory);
+		render_identity_with_pool(&resource_pool);
+		ProgramCacheStats stats = resource_pool.get_program_cache_stats();
+		EXPECT_EQ(num_programs, stats.hits);
+		EXPECT_EQ(0u, stats.misses);
+	}
+
+	// Give every entry a binary format the driver cannot know about,
+	// keeping the identity intact. The driver should reject them, and we
+	// should fall back to compiling from source.
+	vector<string> filenames;
+	DIR *dir = opendir(directory);
+	ASSERT_TRUE(dir != NULL);
+	while (dirent *entry = readdir(dir)) {
+		if (entry->d_name[0] != '.') {
+			filenames.push_back(string(directory) + "/" + entry->d_name);
+		}
+	}
+	closedir(dir);
+	ASSERT_EQ(num_programs, filenames.size());
+	for (unsigned i = 0; i < filenames.size(); ++i) {
+		FILE *fp = fopen(filenames[i].c_str(), "r+b");
+		ASSERT_TRUE(fp != NULL);
+		fseek(fp, 12, SEEK_SET);  // Just after the magic and version.
+		const uint32_t bogus_format = 0xdeadbeef;
+		fwrite(&bogus_format, sizeof(bogus_format), 1, fp);
+		fclose(fp);
+	}
+	{
+		ResourcePool resource_pool;
+		resource_pool.set_program_cache_directory(directory);
+		render_identity_with_pool(&resource_pool);
+		ProgramCacheStats stats = resource_pool.get_program_cache_stats();
+		EXPECT_EQ(0u, stats.hits);
+		EXPECT_EQ(num_programs, stats.misses);
+		EXPECT_EQ(num_programs, stats.rejected);
+	}
+
+	// The rejected entries should have been rewritten.
+	{
+		ResourcePool resource_pool;
+		resource_pool.set_program_cache_directory(directory);
+		render_identity_with_pool(&resource_pool);
+		EXPECT_EQ(num_programs, resource_pool.get_program_cache_stats().hits);
+	}
+
+	for (unsigned i = 0; i < filenames.size(); ++i) {
+		unlink(filenames[i].c_str());
+	}
+	rmdir(directory);
+}
+
+TEST(EffectChainTest, FinalizeAsync) {
+	ResourcePool resource_pool;
+	{
+		EffectChain chain(identity_width, identity_height, &resource_pool);
+		add_identity_chain(&chain);
+		chain.finalize_async();
+		while (!chain.is_ready()) {
+			usleep(1000);
+		}
+		render_identity_chain(&chain);
+	}
+
+	// Rendering without asking should wait for the programs.
+	{
+		EffectChain chain(identity_width, identity_height, &resource_pool);
+		add_identity_chain(&chain);
+		chain.finalize_async();
+		render_identity_chain(&chain);
+		EXPECT_TRUE(chain.is_ready());
+	}
+}
+
+TEST(EffectChainTest, PrewarmCompilesPrograms) {
+	ResourcePool resource_pool;
+	vector<EffectChain *> chains;
+	chains.push_back(new EffectChain(identity_width, identity_height, &resource_pool));
+	add_identity_chain(chains[0]);
+	resource_pool.prewarm(chains);
+	EXPECT_TRUE(chains[0]->is_ready());
+	delete chains[0];
+
+	// The programs should be kept in the pool after the chain is gone,
+	// so an identical chain should not need to compile anything.
+	unsigned num_compiled = resource_pool.get_stats().event_counts[RESOURCE_POOL_PROGRAM_COMPILED];
+	EXPECT_LT(0u, num_compiled);
+	render_identity_with_pool(&resource_pool);
+	EXPECT_EQ(num_compiled, resource_pool.get_stats().event_counts[RESOURCE_POOL_PROGRAM_COMPILED]);
+}
+
+TEST(EffectChainTest, TextureFreelistIsBucketedByFormat) {
+	ResourcePool resource_pool;
+
+	GLuint tex_a = resource_pool.create_2d_texture(GL_RGBA16F, 16, 16);
+	GLuint tex_b = resource_pool.create_2d_texture(GL_RGBA8, 16, 16);
+	GLuint tex_c = resource_pool.create_2d_texture(GL_RGBA16F, 16, 16);
+	resource_pool.release_2d_texture(tex_a);
+	resource_pool.release_2d_texture(tex_b);
+	resource_pool.release_2d_texture(tex_c);
+
+	// The most recently released texture of the right format should come
+	// back first, no matter what else is on the freelist.
+	EXPECT_EQ(tex_c, resource_pool.create_2d_texture(GL_RGBA16F, 16, 16));
+	EXPECT_EQ(tex_a, resource_pool.create_2d_texture(GL_RGBA16F, 16, 16));
+	EXPECT_EQ(tex_b, resource_pool.create_2d_texture(GL_RGBA8, 16, 16));
+
+	// A different size is a different bucket.
+	GLuint tex_d = resource_pool.create_2d_texture(GL_RGBA8, 16, 8);
+	EXPECT_NE(tex_a, tex_d);
+	EXPECT_NE(tex_b, tex_d);
+	EXPECT_NE(tex_c, tex_d);
+
+	resource_pool.release_2d_texture(tex_a);
+	resource_pool.release_2d_texture(tex_b);
+	resource_pool.release_2d_texture(tex_c);
+	resource_pool.release_2d_texture(tex_d);
+}
+
+namespace {
+
+void count_event(ResourcePoolEvent event, void *userdata)
+{
+	++static_cast<unsigned *>(userdata)[event];
+}
+
+}  // namespace
+
+TEST(EffectChainTest, ResourcePoolStats) {
+	// Room for exactly one 16x16 fp16 texture on the freelist.
+	ResourcePool resource_pool(100, ResourcePool::estimate_texture_size(GL_RGBA16F, 16, 16));
+	unsigned callback_counts[RESOURCE_POOL_NUM_EVENTS] = { 0 };
+	resource_pool.set_event_callback(count_event, callback_counts);
+
+	GLuint tex_a = resource_pool.create_2d_texture(GL_RGBA16F, 16, 16);
+	GLuint tex_b = resource_pool.create_2d_texture(GL_RGBA16F, 16, 16);
+	resource_pool.release_2d_texture(tex_a);
+	resource_pool.release_2d_texture(tex_b);  // Evicts tex_a.
+
+	ResourcePoolStats stats = resource_pool.get_stats();
+	EXPECT_EQ(0u, stats.event_counts[RESOURCE_POOL_TEXTURE_HIT]);
+	EXPECT_EQ(2u, stats.event_counts[RESOURCE_POOL_TEXTURE_CREATED]);
+	EXPECT_EQ(1u, stats.event_counts[RESOURCE_POOL_TEXTURE_EVICTED]);
+	EXPECT_EQ(0u, stats.num_textures_in_use);
+	EXPECT_EQ(1u, stats.num_textures_on_freelist);
+	EXPECT_EQ(stats.texture_freelist_max_bytes, stats.texture_freelist_bytes);
+
+	EXPECT_EQ(tex_b, resource_pool.create_2d_texture(GL_RGBA16F, 16, 16));
+	stats = resource_pool.get_stats();
+	EXPECT_EQ(1u, stats.event_counts[RESOURCE_POOL_TEXTURE_HIT]);
+	EXPECT_EQ(1u, stats.num_textures_in_use);
+	EXPECT_EQ(0u, stats.num_textures_on_freelist);
+	EXPECT_EQ(0u, stats.texture_freelist_bytes);
+	resource_pool.release_2d_texture(tex_b);
+
+	// The callback should have seen exactly what was counted.
+	stats = resource_pool.get_stats();
+	for (unsigned i = 0; i < RESOURCE_POOL_NUM_EVENTS; ++i) {
+		EXPECT_EQ(stats.event_counts[i], callback_counts[i]);
+	}
+}
+
 // A dummy effect whose only purpose is to test sprintf decimal behavior.
 class PrintfingBlueEffect : public Effect {
 public:
@@ -13,6 +13,43 @@ using namespace std;
 
 namespace movit {
 
+void compute_fft_kernel(const float *pixel_data, unsigned convolve_width, unsigned convolve_height,
+                        int fft_width, int fft_height, fp16_int_t *kernel)
+{
+	// Do the FFT. Our FFTs should typically be small enough and
+	// the data changed often enough that FFTW_ESTIMATE should be
+	// quite OK. Otherwise, we'd need to worry about caching these
+	// plans (possibly including FFTW wisdom).
+	fftw_complex *in = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * fft_width * fft_height);
+	fftw_complex *out = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * fft_width * fft_height);
+	fftw_plan p = fftw_plan_dft_2d(fft_height, fft_width, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
+
+	// Zero pad.
+	for (int i = 0; i < fft_height * fft_width; ++i) {
+		in[i][0] = 0.0;
+		in[i][1] = 0.0;
+	}
+	for (unsigned y = 0; y < convolve_height; ++y) {
+		for (unsigned x = 0; x < convolve_width; ++x) {
+			int i = y * fft_width + x;
+			in[i][0] = pixel_data[y * convolve_width + x];
+			in[i][1] = 0.0;
+		}
+	}
+
+	fftw_execute(p);
+
+	// Convert to fp16.
+	for (int i = 0; i < fft_width * fft_height; ++i) {
+		kernel[i * 2 + 0] = fp32_to_fp16(out[i][0]);
+		kernel[i * 2 + 1] = fp32_to_fp16(out[i][1]);
+	}
+
+	fftw_destroy_plan(p);
+	fftw_free(in);
+	fftw_free(out);
+}
+
 FFTInput::FFTInput(unsigned width, unsigned height)
 	: texture_num(0),
 	  fft_width(width),
@@ -41,35 +78,8 @@ void FFTInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsig
 	if (texture_num == 0) {
 		assert(pixel_data != NULL);
 
-		// Do the FFT. Our FFTs should typically be small enough and
-		// the data changed often enough that FFTW_ESTIMATE should be
-		// quite OK. Otherwise, we'd need to worry about caching these
-		// plans (possibly including FFTW wisdom).
-		fftw_complex *in = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * fft_width * fft_height);
-		fftw_complex *out = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * fft_width * fft_height);
-		fftw_plan p = fftw_plan_dft_2d(fft_height, fft_width, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-
-		// Zero pad.
-		for (int i = 0; i < fft_height * fft_width; ++i) {
-			in[i][0] = 0.0;
-			in[i][1] = 0.0;
-		}
-		for (unsigned y = 0; y < convolve_height; ++y) {
-			for (unsigned x = 0; x < convolve_width; ++x) {
-				int i = y * fft_width + x;
-				in[i][0] = pixel_data[y * convolve_width + x];
-				in[i][1] = 0.0;
-			}
-		}
-
-		fftw_execute(p);
-
-		// Convert to fp16.
 		fp16_int_t *kernel = new fp16_int_t[fft_width * fft_height * 2];
-		for (int i = 0; i < fft_width * fft_height; ++i) {
-			kernel[i * 2 + 0] = fp32_to_fp16(out[i][0]);
-			kernel[i * 2 + 1] = fp32_to_fp16(out[i][1]);
-		}
+		compute_fft_kernel(pixel_data, convolve_width, convolve_height, fft_width, fft_height, kernel);
 
 		// (Re-)upload the texture.
 		texture_num = resource_pool->create_2d_texture(GL_RG16F, fft_width, fft_height);
@@ -90,8 +100,6 @@ void FFTInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsig
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		check_error();
 
-		fftw_free(in);
-		fftw_free(out);
 		delete[] kernel;
 	} else {
 		glBindTexture(GL_TEXTURE_2D, texture_num);
@@ -115,6 +123,7 @@ void FFTInput::invalidate_pixel_data()
 		resource_pool->release_2d_texture(texture_num);
 		texture_num = 0;
 	}
+	bump_generation();
 }
 
 bool FFTInput::set_int(const std::string& key, int value)
@@ -123,19 +132,18 @@ bool FFTInput::set_int(const std::string& key, int value)
 		// We cannot supply mipmaps; it would not make any sense for FFT data.
 		return (value == 0);
 	}
-	if (key == "fft_width") {
-		if (value < int(convolve_width)) {
-			return false;
-		}
-		invalidate_pixel_data();
+	return Effect::set_int(key, value);
+}
+
+bool FFTInput::parameter_changed(const void *param)
+{
+	if (fft_width < int(convolve_width) || fft_height < int(convolve_height)) {
+		return false;
 	}
-	if (key == "fft_height") {
-		if (value < int(convolve_height)) {
-			return false;
-		}
+	if (param == &fft_width || param == &fft_height) {
 		invalidate_pixel_data();
 	}
-	return Effect::set_int(key, value);
+	return true;
 }
 
 }  // namespace movit
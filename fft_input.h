@@ -20,6 +20,7 @@
 
 #include "effect.h"
 #include "effect_chain.h"
+#include "fp16.h"
 #include "image_format.h"
 #include "input.h"
 
@@ -69,6 +70,9 @@ public:
 
 	virtual bool set_int(const std::string& key, int value);
 
+protected:
+	virtual bool parameter_changed(const void *param);
+
 private:
 	GLuint texture_num;
 	int fft_width, fft_height;
@@ -78,6 +82,13 @@ private:
 	GLint uniform_tex;
 };
 
+// Zero-pads the <convolve_width> x <convolve_height> kernel in <pixel_data>
+// to <fft_width> x <fft_height>, FFTs it and stores the result as interleaved
+// real/imaginary fp16 in <kernel> (2 * fft_width * fft_height values).
+// This is what FFTInput uploads; it needs no OpenGL context.
+void compute_fft_kernel(const float *pixel_data, unsigned convolve_width, unsigned convolve_height,
+                        int fft_width, int fft_height, fp16_int_t *kernel);
+
 }  // namespace movit
 
 #endif // !defined(_MOVIT_FFT_INPUT_H)
@@ -5,6 +5,7 @@
 #include "effect_util.h"
 #include "flat_input.h"
 #include "resource_pool.h"
+#include "trace.h"
 #include "util.h"
 
 using namespace std;
@@ -23,6 +24,7 @@ FlatInput::FlatInput(ImageFormat image_format, MovitPixelFormat pixel_format_in,
 	  pitch(width),
 	  owns_texture(false),
 	  pixel_data(NULL),
+	  chain(NULL),
 	  fixup_swap_rb(false),
 	  fixup_red_to_grayscale(false)
 {
@@ -67,6 +69,8 @@ void FlatInput::set_gl_state(GLuint glsl_program_num, const string& prefix, unsi
 	check_error();
 
 	if (texture_num == 0) {
+		TraceScope trace("upload", "FlatInput upload");
+
 		// Translate the input format to OpenGL's enums.
 		GLint internal_format;
 		GLenum format;
@@ -184,12 +188,13 @@ string FlatInput::output_fragment_shader()
 void FlatInput::invalidate_pixel_data()
 {
 	possibly_release_texture();
+	bump_generation();
 }
 
 void FlatInput::possibly_release_texture()
 {
 	if (texture_num != 0 && owns_texture) {
-		resource_pool->release_2d_texture(texture_num);
+		chain->release_texture_when_idle(texture_num);
 		texture_num = 0;
 		owns_texture = false;
 	}
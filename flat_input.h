@@ -137,15 +137,21 @@ public:
 	// NOTE: The input does not take ownership of this texture; you are responsible
 	// for releasing it yourself. In particular, if you call invalidate_pixel_data()
 	// or anything calling it, the texture will silently be removed from the input.
+	//
+	// If you change the contents of the texture, call set_texture_num() again
+	// (with the same number is fine); otherwise, a chain with a phase cache
+	// (see EffectChain::set_phase_cache_budget()) might not notice.
 	void set_texture_num(GLuint texture_num)
 	{
 		possibly_release_texture();
 		this->texture_num = texture_num;
 		this->owns_texture = false;
+		bump_generation();
 	}
 
 	virtual void inform_added(EffectChain *chain)
 	{
+		this->chain = chain;
 		resource_pool = chain->get_resource_pool();
 	}
 
@@ -161,6 +167,7 @@ private:
 	unsigned width, height, pitch;
 	bool owns_texture;
 	const void *pixel_data;
+	EffectChain *chain;
 	ResourcePool *resource_pool;
 	bool fixup_swap_rb, fixup_red_to_grayscale;
 	GLint uniform_tex;
@@ -31,6 +31,10 @@ public:
 	virtual bool needs_linear_light() const { return false; }
 	virtual bool needs_srgb_primaries() const { return false; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual bool is_pointwise() const { return true; }
+	virtual bool is_mergeable() const { return true; }
+	virtual unsigned estimated_alu_ops() const { return 20; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 
 	// Actually processes its input in a nonlinear fashion,
 	// but does not touch alpha, and we are a special case anyway.
@@ -49,6 +49,16 @@ bool GlowEffect::set_float(const string &key, float value) {
 	return blur->set_float(key, value);
 }
 
+ParamHandle<float> GlowEffect::get_float_handle(const string &key) {
+	if (key == "blurred_mix_amount") {
+		return mix->get_float_handle("strength_second");
+	}
+	if (key == "highlight_cutoff") {
+		return cutoff->get_float_handle("cutoff");
+	}
+	return blur->get_float_handle(key);
+}
+
 HighlightCutoffEffect::HighlightCutoffEffect()
 	: cutoff(0.0f)
 {
@@ -27,6 +27,7 @@ public:
 
 	virtual void rewrite_graph(EffectChain *graph, Node *self);
 	virtual bool set_float(const std::string &key, float value);
+	virtual ParamHandle<float> get_float_handle(const std::string &key);
 
 	virtual std::string output_fragment_shader() {
 		assert(false);
@@ -53,6 +54,8 @@ public:
 	
 	virtual AlphaHandling alpha_handling() const { return INPUT_PREMULTIPLIED_ALPHA_KEEP_BLANK; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual bool is_mergeable() const { return true; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 
 private:
 	float cutoff;
@@ -17,6 +17,10 @@ MovitDebugLevel movit_debug_level = MOVIT_DEBUG_ON;
 float movit_texel_subpixel_precision;
 bool movit_srgb_textures_supported;
 bool movit_timer_queries_supported;
+bool movit_sync_objects_supported;
+bool movit_sampler_objects_supported;
+bool movit_program_binaries_supported;
+bool movit_parallel_shader_compile_supported;
 int movit_num_wrongly_rounded;
 MovitShaderModel movit_shader_model;
 
@@ -309,6 +313,33 @@ const RequiredExtension required_extensions[] = {
 	{ 30, "GL_ARB_texture_rg" },
 };
 
+// Even if glGetProgramBinary() exists, the driver is free to not support
+// any binary formats at all, in which case it is useless to us.
+bool has_program_binary_formats()
+{
+	GLint num_formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+	check_error();
+	return num_formats > 0;
+}
+
+// Let the driver compile and link in as many threads as it likes,
+// if it can do so at all.
+void enable_parallel_shader_compile()
+{
+	if (epoxy_has_gl_extension("GL_KHR_parallel_shader_compile")) {
+		glMaxShaderCompilerThreadsKHR(0xffffffff);
+		check_error();
+		movit_parallel_shader_compile_supported = true;
+	} else if (epoxy_has_gl_extension("GL_ARB_parallel_shader_compile")) {
+		glMaxShaderCompilerThreadsARB(0xffffffff);
+		check_error();
+		movit_parallel_shader_compile_supported = true;
+	} else {
+		movit_parallel_shader_compile_supported = false;
+	}
+}
+
 bool check_extensions()
 {
 	// GLES generally doesn't use extensions as actively as desktop OpenGL.
@@ -317,6 +348,10 @@ bool check_extensions()
 	if (!epoxy_is_desktop_gl()) {
 		if (epoxy_gl_version() >= 30) {
 			movit_srgb_textures_supported = true;
+			movit_sync_objects_supported = true;
+			movit_sampler_objects_supported = true;
+			movit_program_binaries_supported = has_program_binary_formats();
+			enable_parallel_shader_compile();
 			return true;
 		} else {
 			fprintf(stderr, "Movit system requirements: GLES version %.1f is too old (GLES 3.0 needed).\n",
@@ -357,6 +392,26 @@ bool check_extensions()
 	movit_timer_queries_supported =
 		(epoxy_gl_version() >= 33 || epoxy_has_gl_extension("GL_ARB_timer_query"));
 
+	// Asynchronous readback (EffectChain::render_to_buffer()) needs fences
+	// to know when the pixel buffer objects are ready to be mapped.
+	movit_sync_objects_supported =
+		(epoxy_gl_version() >= 32 || epoxy_has_gl_extension("GL_ARB_sync"));
+
+	// Sampler objects let us avoid setting texture parameters on intermediate
+	// textures every frame, but we can do without.
+	movit_sampler_objects_supported =
+		(epoxy_gl_version() >= 33 || epoxy_has_gl_extension("GL_ARB_sampler_objects"));
+
+	// The on-disk program cache (see ResourcePool::set_program_cache_directory())
+	// needs to be able to get linked programs back out of the driver.
+	movit_program_binaries_supported =
+		(epoxy_gl_version() >= 41 || epoxy_has_gl_extension("GL_ARB_get_program_binary")) &&
+		has_program_binary_formats();
+
+	// Background compilation (see EffectChain::finalize_async()) is only
+	// a nicety; without it, programs are simply compiled synchronously.
+	enable_parallel_shader_compile();
+
 	return true;
 }
 
@@ -70,6 +70,21 @@ extern bool movit_srgb_textures_supported;
 // Whether the OpenGL driver (or GPU) in use supports GL_ARB_timer_query.
 extern bool movit_timer_queries_supported;
 
+// Whether the OpenGL driver (or GPU) in use supports GL_ARB_sync.
+extern bool movit_sync_objects_supported;
+
+// Whether the OpenGL driver (or GPU) in use supports GL_ARB_sampler_objects.
+extern bool movit_sampler_objects_supported;
+
+// Whether the OpenGL driver in use supports GL_ARB_get_program_binary
+// with at least one binary format.
+extern bool movit_program_binaries_supported;
+
+// Whether the OpenGL driver in use supports GL_KHR_parallel_shader_compile
+// (or GL_ARB_parallel_shader_compile), ie., can compile and link programs
+// in the background; see EffectChain::finalize_async().
+extern bool movit_parallel_shader_compile_supported;
+
 // What shader model we are compiling for. This only affects the choice
 // of a few files (like header.frag); most of the shaders are the same.
 enum MovitShaderModel {
@@ -0,0 +1,219 @@
+// CPU-only benchmarks for the work effects do on the CPU whenever their
+// parameters change: resampling and blur weights, the deconvolution kernel,
+// dither noise, the FFT of convolution kernels, and fp32 to fp16 conversion.
+// None of this shows up in GPU timings, but it all delays the frame.
+//
+// Usage: kernel_bench [name...]
+//
+// Any names given restrict the run to benchmarks whose name contains
+// one of them as a substring. Unlike effect_chain_bench, this does not
+// need an OpenGL context (or a display) at all.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "blur_effect.h"
+#include "deconvolution_sharpen_effect.h"
+#include "dither_effect.h"
+#include "fft_input.h"
+#include "fp16.h"
+#include "init.h"
+#include "resample_effect.h"
+#include "trace.h"
+
+using namespace std;
+using namespace movit;
+
+namespace {
+
+// Each benchmark function does one unit of work (e.g. computing one set
+// of weights) for the parameters given in <param>.
+typedef void (*BenchmarkFunc)(int param);
+
+vector<string> filters;
+
+bool matches_filter(const string &name)
+{
+	if (filters.empty()) {
+		return true;
+	}
+	for (unsigned i = 0; i < filters.size(); ++i) {
+		if (name.find(filters[i]) != string::npos) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Runs <func> repeatedly for at least 200 ms (after one untimed
+// warmup call), and prints the average time per call.
+void run(const string &name, BenchmarkFunc func, int param)
+{
+	if (!matches_filter(name)) {
+		return;
+	}
+	func(param);
+
+	const uint64_t min_duration_ns = 200000000;
+	uint64_t start_ns = get_monotonic_time_ns(), elapsed_ns;
+	unsigned iterations = 0;
+	do {
+		func(param);
+		++iterations;
+		elapsed_ns = get_monotonic_time_ns() - start_ns;
+	} while (elapsed_ns < min_duration_ns);
+
+	printf("%-48s %12.3f us/call  (%u iterations)\n",
+		name.c_str(), elapsed_ns * 1e-3 / iterations, iterations);
+	fflush(stdout);
+}
+
+string format_name(const char *fmt, int a, int b = 0, int c = 0)
+{
+	char buf[256];
+	snprintf(buf, sizeof(buf), fmt, a, b, c);
+	return buf;
+}
+
+// SingleResamplePassEffect::update_texture(). The parameter is
+// (src_size << 16) | dst_size; the zoom is set separately,
+// since it is a float.
+float resample_zoom = 1.0f;
+
+void bench_resample(int param)
+{
+	ScalingWeights weights = calculate_scaling_weights(param >> 16, param & 0xffff, resample_zoom, 0.0f);
+	delete[] weights.bilinear_weights_fp16;
+	delete[] weights.bilinear_weights_fp32;
+}
+
+// SingleBlurPassEffect::set_gl_state(), with the default 16 taps
+// over 1920 pixels; the parameter is the radius.
+void bench_blur(int radius)
+{
+	const int num_taps = 16;
+	float samples[2 * (num_taps / 2 + 1)];
+	calculate_blur_samples(radius, num_taps, 1920, samples);
+}
+
+// DeconvolutionSharpenEffect::update_deconvolution_kernel(), with the
+// default parameters; the parameter is R (the shader constant).
+void bench_deconvolution(int R)
+{
+	compute_deconvolution_kernel(R, 2.0f, 0.0f, 0.95f, 0.01f);
+}
+
+// DitherEffect::update_texture(), for 1080p output;
+// the parameter is the texture size.
+void bench_dither(int texture_size)
+{
+	vector<float> noise(texture_size * texture_size);
+	generate_dither_noise(1920, 1080, 8, texture_size, texture_size, &noise[0]);
+}
+
+// FFTInput::set_gl_state(), for a 64x64 convolution kernel;
+// the parameter is the FFT size.
+void bench_fft(int fft_size)
+{
+	const int convolve_size = 64;
+	static float kernel[convolve_size * convolve_size];
+	vector<fp16_int_t> out(fft_size * fft_size * 2);
+	compute_fft_kernel(kernel, convolve_size, convolve_size, fft_size, fft_size, &out[0]);
+}
+
+// Conversion of an RGBA image of the given width (in 16:9) to fp16,
+// as done e.g. when uploading float data to fp16 textures.
+void bench_fp16(int width)
+{
+	static vector<float> in;
+	static vector<fp16_int_t> out;
+	const size_t num_values = size_t(width) * (width * 9 / 16) * 4;
+	if (in.size() != num_values) {
+		in.resize(num_values);
+		out.resize(num_values);
+		for (size_t i = 0; i < num_values; ++i) {
+			in[i] = float(i % 1024) / 1023.0f;
+		}
+	}
+	for (size_t i = 0; i < num_values; ++i) {
+		out[i] = fp32_to_fp16(in[i]);
+	}
+}
+
+void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [name...]\n", argv0);
+	exit(1);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; ++i) {
+		if (argv[i][0] == '-') {
+			usage(argv[0]);
+		}
+		filters.push_back(argv[i]);
+	}
+
+	// Normally measured by init_movit(), which needs an OpenGL context.
+	// This is the precision of most current GPUs; nothing else that
+	// init_movit() sets up is used by the code we benchmark.
+	movit_texel_subpixel_precision = 1.0f / 64.0f;
+	movit_initialized = true;
+
+	// The common scaling cases, which can use looping (see update_texture()),
+	// and then with zoom, which turns looping off.
+	static const int resample_sizes[][2] = {
+		{ 720, 1080 },    // 720p -> 1080p, vertical.
+		{ 1280, 1920 },   // 720p -> 1080p, horizontal.
+		{ 1920, 1280 },   // 1080p -> 720p, horizontal.
+		{ 1920, 3840 },   // 1080p -> 2160p, horizontal.
+		{ 3840, 1920 },   // 2160p -> 1080p, horizontal.
+		{ 1920, 640 },    // 3:1 downscale, e.g. for a multiviewer.
+		{ 1917, 1080 },   // Odd sizes, where gcd() is 1.
+	};
+	static const float zooms[] = { 1.0f, 1.1f };
+	for (unsigned zoom_num = 0; zoom_num < sizeof(zooms) / sizeof(zooms[0]); ++zoom_num) {
+		resample_zoom = zooms[zoom_num];
+		for (unsigned i = 0; i < sizeof(resample_sizes) / sizeof(resample_sizes[0]); ++i) {
+			char name[256];
+			snprintf(name, sizeof(name), "resample_weights/%d->%d/zoom=%.1f",
+				resample_sizes[i][0], resample_sizes[i][1], zooms[zoom_num]);
+			run(name, bench_resample, (resample_sizes[i][0] << 16) | resample_sizes[i][1]);
+		}
+	}
+
+	static const int blur_radii[] = { 1, 3, 10, 30 };
+	for (unsigned i = 0; i < sizeof(blur_radii) / sizeof(blur_radii[0]); ++i) {
+		run(format_name("blur_weights/radius=%d", blur_radii[i]), bench_blur, blur_radii[i]);
+	}
+
+	// R=5 is the default.
+	static const int deconvolution_R[] = { 3, 5, 8 };
+	for (unsigned i = 0; i < sizeof(deconvolution_R) / sizeof(deconvolution_R[0]); ++i) {
+		run(format_name("deconvolution_kernel/R=%d", deconvolution_R[i]), bench_deconvolution, deconvolution_R[i]);
+	}
+
+	static const int dither_sizes[] = { 128, 512 };
+	for (unsigned i = 0; i < sizeof(dither_sizes) / sizeof(dither_sizes[0]); ++i) {
+		run(format_name("dither_noise/%dx%d", dither_sizes[i], dither_sizes[i]), bench_dither, dither_sizes[i]);
+	}
+
+	static const int fft_sizes[] = { 128, 512, 2048 };
+	for (unsigned i = 0; i < sizeof(fft_sizes) / sizeof(fft_sizes[0]); ++i) {
+		run(format_name("fft_kernel/%dx%d", fft_sizes[i], fft_sizes[i]), bench_fft, fft_sizes[i]);
+	}
+
+	static const int fp16_widths[] = { 1280, 1920, 3840 };
+	for (unsigned i = 0; i < sizeof(fp16_widths) / sizeof(fp16_widths[0]); ++i) {
+		run(format_name("fp32_to_fp16/%dx%d RGBA", fp16_widths[i], fp16_widths[i] * 9 / 16), bench_fp16, fp16_widths[i]);
+	}
+
+	return 0;
+}
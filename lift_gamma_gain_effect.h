@@ -33,6 +33,10 @@ public:
 	virtual std::string effect_type_id() const { return "LiftGammaGainEffect"; }
 	virtual AlphaHandling alpha_handling() const { return INPUT_PREMULTIPLIED_ALPHA_KEEP_BLANK; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual bool is_pointwise() const { return true; }
+	virtual bool is_mergeable() const { return true; }
+	virtual unsigned estimated_alu_ops() const { return 30; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 	std::string output_fragment_shader();
 
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
@@ -19,6 +19,10 @@ public:
 	virtual bool needs_srgb_primaries() const { return false; }
 	virtual AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const {
+		return Region(1.0f - output_region.right, output_region.bottom,
+		              1.0f - output_region.left, output_region.top);
+	}
 };
 
 }  // namespace movit
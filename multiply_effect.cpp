@@ -1,6 +1,7 @@
 #include "multiply_effect.h"
 #include "util.h"
 
+using namespace Eigen;
 using namespace std;
 
 namespace movit {
@@ -16,4 +17,11 @@ string MultiplyEffect::output_fragment_shader()
 	return read_file("multiply_effect.frag");
 }
 
+bool MultiplyEffect::get_color_matrix(Matrix3d *matrix, float *alpha_factor) const
+{
+	*matrix = Vector3d(factor.r, factor.g, factor.b).asDiagonal();
+	*alpha_factor = factor.a;
+	return true;
+}
+
 }  // namespace movit
@@ -7,6 +7,7 @@
 // (remember, alpha is premultiplied).
 
 #include <epoxy/gl.h>
+#include <Eigen/Core>
 #include <string>
 
 #include "effect.h"
@@ -18,7 +19,9 @@ public:
 	MultiplyEffect();
 	virtual std::string effect_type_id() const { return "MultiplyEffect"; }
 	std::string output_fragment_shader();
+	virtual bool get_color_matrix(Eigen::Matrix3d *matrix, float *alpha_factor) const;
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 
 private:
 	RGBATuple factor;
@@ -134,6 +134,21 @@ void PaddingEffect::inform_input_size(unsigned input_num, unsigned width, unsign
 	input_height = height;
 }
 
+Region PaddingEffect::get_input_footprint(unsigned input_num, const Region &output_region) const
+{
+	// The same mapping as in the shader (see set_gl_state()),
+	// plus one texel for the bilinear filtering along the edges.
+	float offset_x = left / output_width;
+	float offset_y = (output_height - input_height - top) / output_height;
+	float scale_x = float(output_width) / input_width;
+	float scale_y = float(output_height) / input_height;
+	float margin_x = 1.0f / input_width, margin_y = 1.0f / input_height;
+	return Region((output_region.left - offset_x) * scale_x - margin_x,
+	              (output_region.bottom - offset_y) * scale_y - margin_y,
+	              (output_region.right - offset_x) * scale_x + margin_x,
+	              (output_region.top - offset_y) * scale_y + margin_y);
+}
+
 IntegralPaddingEffect::IntegralPaddingEffect() {}
 
 bool IntegralPaddingEffect::set_int(const std::string &key, int value)
@@ -155,4 +170,13 @@ bool IntegralPaddingEffect::set_float(const std::string &key, float value)
 	}
 }
 
+ParamHandle<float> IntegralPaddingEffect::get_float_handle(const std::string &key)
+{
+	if (key == "top" || key == "left") {
+		// See set_float().
+		return ParamHandle<float>();
+	}
+	return PaddingEffect::get_float_handle(key);
+}
+
 }  // namespace movit
@@ -48,6 +48,7 @@ public:
 	virtual bool sets_virtual_output_size() const { return false; }
 	virtual void get_output_size(unsigned *width, unsigned *height, unsigned *virtual_width, unsigned *virtual_height) const;
 	virtual void inform_input_size(unsigned input_num, unsigned width, unsigned height);
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const;
 
 private:
 	RGBATuple border_color;
@@ -68,6 +69,7 @@ public:
 	virtual bool one_to_one_sampling() const { return true; }
 	virtual bool set_int(const std::string&, int value);
 	virtual bool set_float(const std::string &key, float value);
+	virtual ParamHandle<float> get_float_handle(const std::string &key);
 };
 
 }  // namespace movit
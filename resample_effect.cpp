@@ -18,6 +18,7 @@
 #include "fp16.h"
 #include "init.h"
 #include "resample_effect.h"
+#include "trace.h"
 #include "util.h"
 
 using namespace Eigen;
@@ -27,12 +28,6 @@ namespace movit {
 
 namespace {
 
-template<class T>
-struct Tap {
-	T weight;
-	T pos;
-};
-
 float sinc(float x)
 {
 	if (fabs(x) < 1e-6) {
@@ -310,6 +305,12 @@ ResampleEffect::ResampleEffect()
 {
 	register_int("width", &output_width);
 	register_int("height", &output_height);
+	register_float("top", &offset_y);
+	register_float("left", &offset_x);
+	register_float("zoom_x", &zoom_x);
+	register_float("zoom_y", &zoom_y);
+	register_float("zoom_center_x", &zoom_center_x);
+	register_float("zoom_center_y", &zoom_center_y);
 
 	// The first blur pass will forward resolution information to us.
 	hpass = new SingleResamplePassEffect(this);
@@ -379,53 +380,25 @@ void ResampleEffect::update_offset_and_zoom()
 }
 
 bool ResampleEffect::set_float(const string &key, float value) {
-	if (key == "width") {
-		output_width = value;
-		update_size();
-		return true;
+	// The size used to be settable as floats, too.
+	if (key == "width" || key == "height") {
+		return set_int(key, int(value));
 	}
-	if (key == "height") {
-		output_height = value;
+	return Effect::set_float(key, value);
+}
+
+bool ResampleEffect::parameter_changed(const void *param)
+{
+	if (param == &output_width || param == &output_height) {
 		update_size();
 		return true;
 	}
-	if (key == "top") {
-		offset_y = value;
-		update_offset_and_zoom();
-		return true;
+	if ((param == &zoom_x && zoom_x <= 0.0f) ||
+	    (param == &zoom_y && zoom_y <= 0.0f)) {
+		return false;
 	}
-	if (key == "left") {
-		offset_x = value;
-		update_offset_and_zoom();
-		return true;
-	}
-	if (key == "zoom_x") {
-		if (value <= 0.0f) {
-			return false;
-		}
-		zoom_x = value;
-		update_offset_and_zoom();
-		return true;
-	}
-	if (key == "zoom_y") {
-		if (value <= 0.0f) {
-			return false;
-		}
-		zoom_y = value;
-		update_offset_and_zoom();
-		return true;
-	}
-	if (key == "zoom_center_x") {
-		zoom_center_x = value;
-		update_offset_and_zoom();
-		return true;
-	}
-	if (key == "zoom_center_y") {
-		zoom_center_y = value;
-		update_offset_and_zoom();
-		return true;
-	}
-	return false;
+	update_offset_and_zoom();
+	return true;
 }
 
 SingleResamplePassEffect::SingleResamplePassEffect(ResampleEffect *parent)
@@ -491,19 +464,13 @@ string SingleResamplePassEffect::output_fragment_shader()
 //
 // For horizontal scaling, we fill in the exact same texture;
 // the shader just interprets it differently.
-void SingleResamplePassEffect::update_texture(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+ScalingWeights calculate_scaling_weights(unsigned src_size, unsigned dst_size, float zoom, float offset)
 {
-	unsigned src_size, dst_size;
-	if (direction == SingleResamplePassEffect::HORIZONTAL) {
-		assert(input_height == output_height);
-		src_size = input_width;
-		dst_size = output_width;
-	} else if (direction == SingleResamplePassEffect::VERTICAL) {
-		assert(input_width == output_width);
-		src_size = input_height;
-		dst_size = output_height;
-	} else {
-		assert(false);
+	TraceScope trace("weights", "SingleResamplePassEffect weights");
+	if (!lanczos_table_init_done) {
+		// Could in theory race between two threads if we are unlucky,
+		// but that is harmless, since they'll write the same data.
+		init_lanczos_table();
 	}
 
 	// For many resamplings (e.g. 640 -> 1280), we will end up with the same
@@ -511,6 +478,7 @@ void SingleResamplePassEffect::update_texture(GLuint glsl_program_num, const str
 	// the first such loop, and then ask the card to repeat the texture for us.
 	// This is both easier on the texture cache and lowers our CPU cost for
 	// generating the kernel somewhat.
+	unsigned num_loops;
 	float scaling_factor;
 	if (fabs(zoom - 1.0f) < 1e-6) {
 		num_loops = gcd(src_size, dst_size);
@@ -524,7 +492,6 @@ void SingleResamplePassEffect::update_texture(GLuint glsl_program_num, const str
 		num_loops = 1;
 		scaling_factor = zoom * float(dst_size) / float(src_size);
 	}
-	slice_height = 1.0f / num_loops;
 	unsigned dst_samples = dst_size / num_loops;
 
 	// Sample the kernel in the right place. A diagram with a triangular kernel
@@ -603,9 +570,8 @@ void SingleResamplePassEffect::update_texture(GLuint glsl_program_num, const str
 	// samples, since one would assume overall errors in the shape don't matter as much.
 	const float max_error = 2.0f / (255.0f * 255.0f);
 	Tap<fp16_int_t> *bilinear_weights_fp16;
-	src_bilinear_samples = combine_many_samples(weights, src_size, src_samples, dst_samples, &bilinear_weights_fp16);
+	unsigned src_bilinear_samples = combine_many_samples(weights, src_size, src_samples, dst_samples, &bilinear_weights_fp16);
 	Tap<float> *bilinear_weights_fp32 = NULL;
-	bool fallback_to_fp32 = false;
 	double max_sum_sq_error_fp16 = 0.0;
 	for (unsigned y = 0; y < dst_samples; ++y) {
 		double sum_sq_error_fp16 = compute_sum_sq_error(
@@ -619,10 +585,43 @@ void SingleResamplePassEffect::update_texture(GLuint glsl_program_num, const str
 	}
 
 	if (max_sum_sq_error_fp16 > max_error) {
-		fallback_to_fp32 = true;
+		delete[] bilinear_weights_fp16;
+		bilinear_weights_fp16 = NULL;
 		src_bilinear_samples = combine_many_samples(weights, src_size, src_samples, dst_samples, &bilinear_weights_fp32);
 	}
 
+	delete[] weights;
+
+	ScalingWeights ret;
+	ret.src_bilinear_samples = src_bilinear_samples;
+	ret.dst_samples = dst_samples;
+	ret.num_loops = num_loops;
+	ret.bilinear_weights_fp16 = bilinear_weights_fp16;
+	ret.bilinear_weights_fp32 = bilinear_weights_fp32;
+	return ret;
+}
+
+void SingleResamplePassEffect::update_texture(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	unsigned src_size, dst_size;
+	if (direction == SingleResamplePassEffect::HORIZONTAL) {
+		assert(input_height == output_height);
+		src_size = input_width;
+		dst_size = output_width;
+	} else if (direction == SingleResamplePassEffect::VERTICAL) {
+		assert(input_width == output_width);
+		src_size = input_height;
+		dst_size = output_height;
+	} else {
+		assert(false);
+	}
+
+	ScalingWeights weights = calculate_scaling_weights(src_size, dst_size, zoom, offset);
+	src_bilinear_samples = weights.src_bilinear_samples;
+	num_loops = weights.num_loops;
+	slice_height = 1.0f / num_loops;
+	unsigned dst_samples = weights.dst_samples;
+
 	// Encode as a two-component texture. Note the GL_REPEAT.
 	glActiveTexture(GL_TEXTURE0 + *sampler_num);
 	check_error();
@@ -640,14 +639,14 @@ void SingleResamplePassEffect::update_texture(GLuint glsl_program_num, const str
 
 	GLenum type, internal_format;
 	void *pixels;
-	if (fallback_to_fp32) {
+	if (weights.bilinear_weights_fp32 != NULL) {
 		type = GL_FLOAT;
 		internal_format = GL_RG32F;
-		pixels = bilinear_weights_fp32;
+		pixels = weights.bilinear_weights_fp32;
 	} else {
 		type = GL_HALF_FLOAT;
 		internal_format = GL_RG16F;
-		pixels = bilinear_weights_fp16;
+		pixels = weights.bilinear_weights_fp16;
 	}
 
 	if (int(src_bilinear_samples) == last_texture_width &&
@@ -664,9 +663,8 @@ void SingleResamplePassEffect::update_texture(GLuint glsl_program_num, const str
 	}
 	check_error();
 
-	delete[] weights;
-	delete[] bilinear_weights_fp16;
-	delete[] bilinear_weights_fp32;
+	delete[] weights.bilinear_weights_fp16;
+	delete[] weights.bilinear_weights_fp32;
 }
 
 void SingleResamplePassEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
@@ -725,4 +723,19 @@ void SingleResamplePassEffect::set_gl_state(GLuint glsl_program_num, const strin
 	}
 }
 
+Region SingleResamplePassEffect::get_input_footprint(unsigned input_num, const Region &output_region) const
+{
+	// Offset and zoom can move the footprint around freely along our
+	// direction, so we only narrow it down in the other one.
+	Region input_region = output_region;
+	if (direction == HORIZONTAL) {
+		input_region.left = 0.0f;
+		input_region.right = 1.0f;
+	} else {
+		input_region.bottom = 0.0f;
+		input_region.top = 1.0f;
+	}
+	return input_region;
+}
+
 }  // namespace movit
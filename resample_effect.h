@@ -21,6 +21,7 @@
 #include <string>
 
 #include "effect.h"
+#include "fp16.h"
 
 namespace movit {
 
@@ -50,7 +51,10 @@ public:
 
 	virtual void rewrite_graph(EffectChain *graph, Node *self);
 	virtual bool set_float(const std::string &key, float value);
-	
+
+protected:
+	virtual bool parameter_changed(const void *param);
+
 private:
 	void update_size();
 	void update_offset_and_zoom();
@@ -93,6 +97,7 @@ public:
 	}
 
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const;
 	
 	enum Direction { HORIZONTAL = 0, VERTICAL = 1 };
 
@@ -118,6 +123,32 @@ private:
 	GLuint last_texture_internal_format;
 };
 
+template<class T>
+struct Tap {
+	T weight;
+	T pos;
+};
+
+// The weights for one SingleResamplePassEffect, as computed by
+// calculate_scaling_weights(). The texture holds dst_samples rows of
+// src_bilinear_samples taps each, and is to be repeated num_loops times.
+struct ScalingWeights {
+	unsigned src_bilinear_samples;
+	unsigned dst_samples, num_loops;
+
+	// Exactly one of these is non-NULL, depending on whether fp16 was
+	// accurate enough. The caller owns them, and must delete[] them.
+	Tap<fp16_int_t> *bilinear_weights_fp16;
+	Tap<float> *bilinear_weights_fp32;
+};
+
+// Computes the Lanczos weights for scaling one dimension from <src_size>
+// to <dst_size> pixels, and combines them into bilinear samples.
+// This is the CPU-side work done by SingleResamplePassEffect whenever its
+// parameters change, and needs no OpenGL context (but note that it depends
+// on movit_texel_subpixel_precision, which is set by init_movit()).
+ScalingWeights calculate_scaling_weights(unsigned src_size, unsigned dst_size, float zoom, float offset);
+
 }  // namespace movit
 
 #endif // !defined(_MOVIT_RESAMPLE_EFFECT_H)
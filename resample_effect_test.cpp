@@ -237,6 +237,40 @@ TEST(ResampleEffectTest, ReadWholePixelFromLeft) {
 	expect_equal(expected_data, out_data, size, size);
 }
 
+TEST(ResampleEffectTest, ReadWholePixelFromLeftThroughParamHandles) {
+	const int size = 5;
+
+	float data[size * size] = {
+		0.0, 0.0, 0.0, 0.0, 0.0,
+		0.0, 0.0, 0.0, 0.0, 0.0,
+		0.0, 0.0, 1.0, 0.0, 0.0,
+		0.0, 0.0, 0.0, 0.0, 0.0,
+		0.0, 0.0, 0.0, 0.0, 0.0,
+	};
+	float expected_data[size * size] = {
+		0.0, 0.0, 0.0, 0.0, 0.0,
+		0.0, 0.0, 0.0, 0.0, 0.0,
+		0.0, 1.0, 0.0, 0.0, 0.0,
+		0.0, 0.0, 0.0, 0.0, 0.0,
+		0.0, 0.0, 0.0, 0.0, 0.0,
+	};
+	float out_data[size * size];
+
+	EffectChainTester tester(data, size, size, FORMAT_GRAYSCALE, COLORSPACE_sRGB, GAMMA_LINEAR);
+	Effect *resample_effect = tester.get_chain()->add_effect(new ResampleEffect());
+	ParamHandle<int> width = resample_effect->get_int_handle("width");
+	ParamHandle<int> height = resample_effect->get_int_handle("height");
+	ParamHandle<float> left = resample_effect->get_float_handle("left");
+	ParamHandle<float> zoom_x = resample_effect->get_float_handle("zoom_x");
+	ASSERT_TRUE(width.set(size));
+	ASSERT_TRUE(height.set(size));
+	ASSERT_TRUE(left.set(1.0f));
+	EXPECT_FALSE(zoom_x.set(0.0f));
+	tester.run(out_data, GL_RED, COLORSPACE_sRGB, GAMMA_LINEAR);
+
+	expect_equal(expected_data, out_data, size, size);
+}
+
 TEST(ResampleEffectTest, ReadQuarterPixelFromLeft) {
 	const int size = 5;
 
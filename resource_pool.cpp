@@ -1,13 +1,18 @@
 #include <assert.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <algorithm>
 #include <map>
+#include <set>
 #include <string>
 #include <utility>
 #include <epoxy/gl.h>
 
+#include "effect_chain.h"
 #include "init.h"
 #include "resource_pool.h"
 #include "util.h"
@@ -16,15 +21,58 @@ using namespace std;
 
 namespace movit {
 
+namespace {
+
+// Header of an entry in the on-disk program cache. It is followed by
+// <identity_length> bytes of identity (see compile_glsl_program()) and
+// then <binary_length> bytes of program binary. Everything is stored in
+// native byte order, since the binaries are not portable anyway.
+struct ProgramCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t binary_format;
+	uint32_t identity_length;
+	uint32_t binary_length;
+};
+
+const char program_cache_magic[8] = { 'M', 'o', 'v', 'i', 't', 'P', 'r', 'g' };
+const uint32_t program_cache_version = 1;
+
+const uint64_t fnv1a_offset_basis = 14695981039346656037ULL;
+
+// 64-bit FNV-1a, continuing from <hash>. Collisions are harmless both
+// in the on-disk cache and in the in-memory program lookup, since the
+// full sources are always compared before an entry is used.
+uint64_t fnv1a_hash(const string &str, uint64_t hash = fnv1a_offset_basis)
+{
+	for (size_t i = 0; i < str.size(); ++i) {
+		hash ^= (unsigned char)str[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+}  // namespace
+
 ResourcePool::ResourcePool(size_t program_freelist_max_length,
                            size_t texture_freelist_max_bytes,
-                           size_t fbo_freelist_max_length)
+                           size_t fbo_freelist_max_length,
+                           size_t pbo_freelist_max_length)
 	: program_freelist_max_length(program_freelist_max_length),
 	  texture_freelist_max_bytes(texture_freelist_max_bytes),
 	  fbo_freelist_max_length(fbo_freelist_max_length),
-	  texture_freelist_bytes(0)
+	  pbo_freelist_max_length(pbo_freelist_max_length),
+	  texture_freelist_bytes(0),
+	  event_callback(NULL),
+	  event_callback_userdata(NULL)
 {
 	pthread_mutex_init(&lock, NULL);
+	program_cache_stats.hits = 0;
+	program_cache_stats.misses = 0;
+	program_cache_stats.rejected = 0;
+	for (unsigned i = 0; i < RESOURCE_POOL_NUM_EVENTS; ++i) {
+		event_counts[i] = 0;
+	}
 }
 
 ResourcePool::~ResourcePool()
@@ -37,6 +85,7 @@ ResourcePool::~ResourcePool()
 		delete_program(*freelist_it);
 	}
 	assert(programs.empty());
+	assert(program_sources.empty());
 	assert(program_shaders.empty());
 
 	for (list<GLuint>::const_iterator freelist_it = texture_freelist.begin();
@@ -49,12 +98,29 @@ ResourcePool::~ResourcePool()
 		glDeleteTextures(1, &free_texture_num);
 		check_error();
 	}
+	texture_freelist_by_format.clear();
 	assert(texture_formats.empty());
 	assert(texture_freelist_bytes == 0);
 
+	for (list<GLuint>::const_iterator freelist_it = pbo_freelist.begin();
+	     freelist_it != pbo_freelist.end();
+	     ++freelist_it) {
+		GLuint free_pbo_num = *freelist_it;
+		assert(pbo_sizes.count(free_pbo_num) != 0);
+		pbo_sizes.erase(free_pbo_num);
+		glDeleteBuffers(1, &free_pbo_num);
+		check_error();
+	}
+	assert(pbo_sizes.empty());
+
 	void *context = get_gl_context_identifier();
 	cleanup_unlinked_fbos(context);
 
+	// As with FBOs, the client should have called clean_context()
+	// for all the other contexts.
+	cleanup_released_vaos(context);
+	assert(vaos_to_delete.empty());
+
 	for (map<void *, std::list<FBOFormatIterator> >::iterator context_it = fbo_freelist.begin();
 	     context_it != fbo_freelist.end();
 	     ++context_it) {
@@ -78,17 +144,15 @@ ResourcePool::~ResourcePool()
 
 void ResourcePool::delete_program(GLuint glsl_program_num)
 {
-	bool found_program = false;
-	for (map<pair<string, string>, GLuint>::iterator program_it = programs.begin();
-	     program_it != programs.end();
-	     ++program_it) {
-		if (program_it->second == glsl_program_num) {
-			programs.erase(program_it);
-			found_program = true;
-			break;
-		}
+	map<GLuint, ProgramSource>::iterator source_it = program_sources.find(glsl_program_num);
+	assert(source_it != program_sources.end());
+	map<uint64_t, GLuint>::iterator program_it = programs.find(source_it->second.hash);
+	if (program_it != programs.end() && program_it->second == glsl_program_num) {
+		programs.erase(program_it);
 	}
-	assert(found_program);
+	program_sources.erase(source_it);
+	program_freelist_positions.erase(glsl_program_num);
+	pending_programs.erase(glsl_program_num);
 	glDeleteProgram(glsl_program_num);
 
 	map<GLuint, pair<GLuint, GLuint> >::iterator shader_it =
@@ -100,68 +164,176 @@ void ResourcePool::delete_program(GLuint glsl_program_num)
 	program_shaders.erase(shader_it);
 }
 
+uint64_t ResourcePool::hash_glsl_program(const string& vertex_shader,
+                                         const string& fragment_shader,
+                                         const vector<string>& fragment_shader_outputs)
+{
+	// Terminate each string with a zero byte, so that moving text from
+	// one string to the next changes the hash.
+	const string terminator(1, '\0');
+	uint64_t hash = fnv1a_hash(vertex_shader);
+	hash = fnv1a_hash(terminator, hash);
+	hash = fnv1a_hash(fragment_shader, hash);
+	hash = fnv1a_hash(terminator, hash);
+	for (unsigned output_index = 0; output_index < fragment_shader_outputs.size(); ++output_index) {
+		hash = fnv1a_hash(fragment_shader_outputs[output_index], hash);
+		hash = fnv1a_hash(terminator, hash);
+	}
+	return hash;
+}
+
 GLuint ResourcePool::compile_glsl_program(const string& vertex_shader,
                                           const string& fragment_shader,
                                           const vector<string>& fragment_shader_outputs)
+{
+	return compile_glsl_program(vertex_shader, fragment_shader, fragment_shader_outputs,
+	                            hash_glsl_program(vertex_shader, fragment_shader, fragment_shader_outputs));
+}
+
+GLuint ResourcePool::compile_glsl_program(const string& vertex_shader,
+                                          const string& fragment_shader,
+                                          const vector<string>& fragment_shader_outputs,
+                                          uint64_t program_hash)
+{
+	return compile_glsl_program(vertex_shader, fragment_shader, fragment_shader_outputs, program_hash, true);
+}
+
+GLuint ResourcePool::compile_glsl_program_async(const string& vertex_shader,
+                                                const string& fragment_shader,
+                                                const vector<string>& fragment_shader_outputs,
+                                                uint64_t program_hash)
+{
+	return compile_glsl_program(vertex_shader, fragment_shader, fragment_shader_outputs, program_hash, false);
+}
+
+GLuint ResourcePool::compile_glsl_program(const string& vertex_shader,
+                                          const string& fragment_shader,
+                                          const vector<string>& fragment_shader_outputs,
+                                          uint64_t program_hash,
+                                          bool wait)
 {
 	GLuint glsl_program_num;
 	pthread_mutex_lock(&lock);
 
-	// Augment the fragment shader program text with the outputs, so that they become
-	// part of the key. Also potentially useful for debugging.
-	string fragment_shader_processed = fragment_shader;
-	for (unsigned output_index = 0; output_index < fragment_shader_outputs.size(); ++output_index) {
-		char buf[256];
-		snprintf(buf, sizeof(buf), "// Bound output: %s\n", fragment_shader_outputs[output_index].c_str());
-		fragment_shader_processed += buf;
+	// Look up the program by its hash. The full sources are compared only
+	// once, against the single candidate we find; if they differ (which
+	// should never happen in practice), we compile a separate program that
+	// is simply not findable through <programs>.
+	map<uint64_t, GLuint>::const_iterator program_it = programs.find(program_hash);
+	bool found = false;
+	if (program_it != programs.end()) {
+		map<GLuint, ProgramSource>::const_iterator source_it = program_sources.find(program_it->second);
+		assert(source_it != program_sources.end());
+		found = (source_it->second.vertex_shader == vertex_shader &&
+		         source_it->second.fragment_shader == fragment_shader &&
+		         source_it->second.fragment_shader_outputs == fragment_shader_outputs);
 	}
 
-	const pair<string, string> key(vertex_shader, fragment_shader_processed);
-	if (programs.count(key)) {
+	if (found) {
 		// Already in the cache. Increment the refcount, or take it off the freelist
 		// if it's zero.
-		glsl_program_num = programs[key];
+		glsl_program_num = program_it->second;
+		record_event(RESOURCE_POOL_PROGRAM_HIT);
+		if (wait && pending_programs.count(glsl_program_num)) {
+			// Someone else started it in the background.
+			finish_linking(glsl_program_num);
+		}
 		map<GLuint, int>::iterator refcount_it = program_refcount.find(glsl_program_num);
 		if (refcount_it != program_refcount.end()) {
 			++refcount_it->second;
 		} else {
-			list<GLuint>::iterator freelist_it =
-				find(program_freelist.begin(), program_freelist.end(), glsl_program_num);
-			assert(freelist_it != program_freelist.end());
-			program_freelist.erase(freelist_it);
+			map<GLuint, list<GLuint>::iterator>::iterator position_it =
+				program_freelist_positions.find(glsl_program_num);
+			assert(position_it != program_freelist_positions.end());
+			program_freelist.erase(position_it->second);
+			program_freelist_positions.erase(position_it);
 			program_refcount.insert(make_pair(glsl_program_num, 1));
 		}
 	} else {
-		// Not in the cache. Compile the shaders.
-		glsl_program_num = glCreateProgram();
-		check_error();
-		GLuint vs_obj = compile_shader(vertex_shader, GL_VERTEX_SHADER);
-		check_error();
-		GLuint fs_obj = compile_shader(fragment_shader_processed, GL_FRAGMENT_SHADER);
-		check_error();
-		glAttachShader(glsl_program_num, vs_obj);
-		check_error();
-		glAttachShader(glsl_program_num, fs_obj);
-		check_error();
+		// Augment the fragment shader program text with the outputs, so that they become
+		// part of the on-disk cache identity. Also potentially useful for debugging.
+		string fragment_shader_processed = fragment_shader;
+		for (unsigned output_index = 0; output_index < fragment_shader_outputs.size(); ++output_index) {
+			char buf[256];
+			snprintf(buf, sizeof(buf), "// Bound output: %s\n", fragment_shader_outputs[output_index].c_str());
+			fragment_shader_processed += buf;
+		}
 
-		// Bind the outputs, if we have multiple ones.
-		if (fragment_shader_outputs.size() > 1) {
+		// Not in the cache. See if we have it on disk; if not, compile the shaders.
+		GLuint vs_obj = 0, fs_obj = 0;
+		string cache_filename, cache_identity;
+		glsl_program_num = 0;
+		if (!program_cache_directory.empty() && movit_program_binaries_supported) {
+			cache_identity = vertex_shader;
+			cache_identity.push_back('\0');
+			cache_identity += fragment_shader_processed;
+			cache_identity.push_back('\0');
 			for (unsigned output_index = 0; output_index < fragment_shader_outputs.size(); ++output_index) {
-				glBindFragDataLocation(glsl_program_num, output_index,
-				                       fragment_shader_outputs[output_index].c_str());
+				cache_identity += fragment_shader_outputs[output_index];
+				cache_identity.push_back('\0');
+			}
+			cache_identity += (const char *)glGetString(GL_RENDERER);
+			cache_identity.push_back('\0');
+			cache_identity += (const char *)glGetString(GL_VERSION);
+			check_error();
+
+			char buf[32];
+			snprintf(buf, sizeof(buf), "/%016llx.bin", (unsigned long long)fnv1a_hash(cache_identity));
+			cache_filename = program_cache_directory + buf;
+
+			glsl_program_num = load_program_binary(cache_filename, cache_identity);
+			if (glsl_program_num != 0) {
+				++program_cache_stats.hits;
+				record_event(RESOURCE_POOL_PROGRAM_LOADED);
+			} else {
+				++program_cache_stats.misses;
 			}
 		}
 
-		glLinkProgram(glsl_program_num);
-		check_error();
+		if (glsl_program_num == 0) {
+			record_event(RESOURCE_POOL_PROGRAM_COMPILED);
+			glsl_program_num = glCreateProgram();
+			check_error();
+			// The compile status is not checked until finish_linking(),
+			// since asking for it would wait for the compiler.
+			vs_obj = start_compiling_shader(vertex_shader, GL_VERTEX_SHADER);
+			check_error();
+			fs_obj = start_compiling_shader(fragment_shader_processed, GL_FRAGMENT_SHADER);
+			check_error();
+			glAttachShader(glsl_program_num, vs_obj);
+			check_error();
+			glAttachShader(glsl_program_num, fs_obj);
+			check_error();
+
+			// Bind the outputs, if we have multiple ones.
+			if (fragment_shader_outputs.size() > 1) {
+				for (unsigned output_index = 0; output_index < fragment_shader_outputs.size(); ++output_index) {
+					glBindFragDataLocation(glsl_program_num, output_index,
+					                       fragment_shader_outputs[output_index].c_str());
+				}
+			}
 
-		GLint success;
-		glGetProgramiv(glsl_program_num, GL_LINK_STATUS, &success);
-		if (success == GL_FALSE) {
-			GLchar error_log[1024] = {0};
-			glGetProgramInfoLog(glsl_program_num, 1024, NULL, error_log);
-			fprintf(stderr, "Error linking program: %s\n", error_log);
-			exit(1);
+			if (!cache_filename.empty()) {
+				glProgramParameteri(glsl_program_num, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+				check_error();
+			}
+
+			glLinkProgram(glsl_program_num);
+			check_error();
+
+			// With parallel compilation, glLinkProgram() returns right
+			// away, and it is only asking for the result that blocks.
+			PendingProgram pending;
+			pending.vs_obj = vs_obj;
+			pending.fs_obj = fs_obj;
+			pending.vertex_shader = vertex_shader;
+			pending.fragment_shader = fragment_shader_processed;
+			pending.cache_filename = cache_filename;
+			pending.cache_identity = cache_identity;
+			pending_programs.insert(make_pair(glsl_program_num, pending));
+			if (wait || !movit_parallel_shader_compile_supported) {
+				finish_linking(glsl_program_num);
+			}
 		}
 
 		if (movit_debug_level == MOVIT_DEBUG_ON) {
@@ -178,7 +350,15 @@ GLuint ResourcePool::compile_glsl_program(const string& vertex_shader,
 			fclose(fp);
 		}
 
-		programs.insert(make_pair(key, glsl_program_num));
+		if (program_it == programs.end()) {
+			programs.insert(make_pair(program_hash, glsl_program_num));
+		}
+		ProgramSource source;
+		source.hash = program_hash;
+		source.vertex_shader = vertex_shader;
+		source.fragment_shader = fragment_shader;
+		source.fragment_shader_outputs = fragment_shader_outputs;
+		program_sources.insert(make_pair(glsl_program_num, source));
 		program_refcount.insert(make_pair(glsl_program_num, 1));
 		program_shaders.insert(make_pair(glsl_program_num, make_pair(vs_obj, fs_obj)));
 	}
@@ -186,6 +366,221 @@ GLuint ResourcePool::compile_glsl_program(const string& vertex_shader,
 	return glsl_program_num;
 }
 
+void ResourcePool::finish_linking(GLuint glsl_program_num)
+{
+	map<GLuint, PendingProgram>::iterator pending_it = pending_programs.find(glsl_program_num);
+	assert(pending_it != pending_programs.end());
+
+	check_shader_compile_status(pending_it->second.vs_obj, pending_it->second.vertex_shader);
+	check_shader_compile_status(pending_it->second.fs_obj, pending_it->second.fragment_shader);
+
+	GLint success;
+	glGetProgramiv(glsl_program_num, GL_LINK_STATUS, &success);
+	if (success == GL_FALSE) {
+		GLchar error_log[1024] = {0};
+		glGetProgramInfoLog(glsl_program_num, 1024, NULL, error_log);
+		fprintf(stderr, "Error linking program: %s\n", error_log);
+		exit(1);
+	}
+
+	if (!pending_it->second.cache_filename.empty()) {
+		save_program_binary(pending_it->second.cache_filename, pending_it->second.cache_identity, glsl_program_num);
+	}
+	pending_programs.erase(pending_it);
+}
+
+bool ResourcePool::is_program_ready(GLuint glsl_program_num)
+{
+	pthread_mutex_lock(&lock);
+	bool ready = true;
+	if (pending_programs.count(glsl_program_num)) {
+		GLint done;
+		glGetProgramiv(glsl_program_num, GL_COMPLETION_STATUS_KHR, &done);
+		check_error();
+		if (done == GL_TRUE) {
+			finish_linking(glsl_program_num);
+		} else {
+			ready = false;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return ready;
+}
+
+void ResourcePool::wait_for_program(GLuint glsl_program_num)
+{
+	pthread_mutex_lock(&lock);
+	if (pending_programs.count(glsl_program_num)) {
+		finish_linking(glsl_program_num);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void ResourcePool::prewarm(const vector<EffectChain *> &chains)
+{
+	// Start everything before waiting for anything,
+	// so that the driver can work on all of it at once.
+	for (unsigned i = 0; i < chains.size(); ++i) {
+		assert(chains[i]->get_resource_pool() == this);
+		chains[i]->finalize_async();
+	}
+	for (unsigned i = 0; i < chains.size(); ++i) {
+		chains[i]->wait_until_ready();
+	}
+}
+
+GLuint ResourcePool::load_program_binary(const string &filename, const string &identity)
+{
+	FILE *fp = fopen(filename.c_str(), "rb");
+	if (fp == NULL) {
+		return 0;
+	}
+
+	// Anything that does not match exactly (truncated files, old versions,
+	// hash collisions) is treated as if the entry did not exist.
+	ProgramCacheHeader header;
+	string stored_identity;
+	vector<char> binary;
+	bool ok = (fread(&header, sizeof(header), 1, fp) == 1 &&
+	           memcmp(header.magic, program_cache_magic, sizeof(program_cache_magic)) == 0 &&
+	           header.version == program_cache_version &&
+	           header.identity_length == identity.size() &&
+	           header.binary_length > 0);
+	if (ok) {
+		stored_identity.resize(header.identity_length);
+		ok = (fread(&stored_identity[0], header.identity_length, 1, fp) == 1 &&
+		      stored_identity == identity);
+	}
+	if (ok) {
+		binary.resize(header.binary_length);
+		ok = (fread(&binary[0], header.binary_length, 1, fp) == 1);
+	}
+	fclose(fp);
+	if (!ok) {
+		return 0;
+	}
+
+	GLuint glsl_program_num = glCreateProgram();
+	check_error();
+	glProgramBinary(glsl_program_num, header.binary_format, &binary[0], header.binary_length);
+
+	// The driver is free to reject the binary for any reason (e.g. after
+	// an upgrade that did not change GL_VERSION), and it may flag an error
+	// in addition to failing the link; neither is fatal to us.
+	while (glGetError() != GL_NO_ERROR) ;
+
+	GLint success;
+	glGetProgramiv(glsl_program_num, GL_LINK_STATUS, &success);
+	check_error();
+	if (success == GL_FALSE) {
+		glDeleteProgram(glsl_program_num);
+		check_error();
+		++program_cache_stats.rejected;
+		return 0;
+	}
+	return glsl_program_num;
+}
+
+void ResourcePool::save_program_binary(const string &filename, const string &identity, GLuint glsl_program_num)
+{
+	GLint binary_length = 0;
+	glGetProgramiv(glsl_program_num, GL_PROGRAM_BINARY_LENGTH, &binary_length);
+	check_error();
+	if (binary_length <= 0) {
+		return;
+	}
+
+	vector<char> binary(binary_length);
+	GLenum binary_format;
+	glGetProgramBinary(glsl_program_num, binary_length, &binary_length, &binary_format, &binary[0]);
+	check_error();
+
+	ProgramCacheHeader header;
+	memcpy(header.magic, program_cache_magic, sizeof(program_cache_magic));
+	header.version = program_cache_version;
+	header.binary_format = binary_format;
+	header.identity_length = identity.size();
+	header.binary_length = binary_length;
+
+	// Write to a temporary file and rename it into place, so that other
+	// processes sharing the directory never see a half-written entry.
+	char buf[32];
+	snprintf(buf, sizeof(buf), ".%ld.tmp", (long)getpid());
+	const string tmp_filename = filename + buf;
+	FILE *fp = fopen(tmp_filename.c_str(), "wb");
+	if (fp == NULL) {
+		perror(tmp_filename.c_str());
+		return;
+	}
+	bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1 &&
+	           fwrite(identity.data(), identity.size(), 1, fp) == 1 &&
+	           fwrite(&binary[0], binary_length, 1, fp) == 1);
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok || rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+		perror(filename.c_str());
+		unlink(tmp_filename.c_str());
+	}
+}
+
+void ResourcePool::set_program_cache_directory(const string &directory)
+{
+	pthread_mutex_lock(&lock);
+	program_cache_directory = directory;
+	pthread_mutex_unlock(&lock);
+}
+
+ProgramCacheStats ResourcePool::get_program_cache_stats()
+{
+	pthread_mutex_lock(&lock);
+	ProgramCacheStats ret = program_cache_stats;
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+ResourcePoolStats ResourcePool::get_stats()
+{
+	ResourcePoolStats ret;
+	pthread_mutex_lock(&lock);
+	for (unsigned i = 0; i < RESOURCE_POOL_NUM_EVENTS; ++i) {
+		ret.event_counts[i] = event_counts[i];
+	}
+	ret.program_cache = program_cache_stats;
+
+	ret.num_programs_in_use = program_refcount.size();
+	ret.num_programs_on_freelist = program_freelist.size();
+
+	ret.num_textures_in_use = texture_formats.size() - texture_freelist.size();
+	ret.num_textures_on_freelist = texture_freelist.size();
+	ret.texture_freelist_bytes = texture_freelist_bytes;
+	ret.texture_freelist_max_bytes = texture_freelist_max_bytes;
+
+	for (map<void *, list<FBOFormatIterator> >::const_iterator context_it = fbo_freelist.begin();
+	     context_it != fbo_freelist.end();
+	     ++context_it) {
+		ret.fbo_freelist_lengths[context_it->first] = context_it->second.size();
+	}
+
+	ret.num_pbos_on_freelist = pbo_freelist.size();
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+void ResourcePool::set_event_callback(ResourcePoolEventCallback callback, void *userdata)
+{
+	pthread_mutex_lock(&lock);
+	event_callback = callback;
+	event_callback_userdata = userdata;
+	pthread_mutex_unlock(&lock);
+}
+
+void ResourcePool::record_event(ResourcePoolEvent event)
+{
+	++event_counts[event];
+	if (event_callback != NULL) {
+		event_callback(event, event_callback_userdata);
+	}
+}
+
 void ResourcePool::release_glsl_program(GLuint glsl_program_num)
 {
 	pthread_mutex_lock(&lock);
@@ -194,12 +589,13 @@ void ResourcePool::release_glsl_program(GLuint glsl_program_num)
 
 	if (--refcount_it->second == 0) {
 		program_refcount.erase(refcount_it);
-		assert(find(program_freelist.begin(), program_freelist.end(), glsl_program_num)
-			== program_freelist.end());
+		assert(program_freelist_positions.count(glsl_program_num) == 0);
 		program_freelist.push_front(glsl_program_num);
+		program_freelist_positions.insert(make_pair(glsl_program_num, program_freelist.begin()));
 		if (program_freelist.size() > program_freelist_max_length) {
 			delete_program(program_freelist.back());
 			program_freelist.pop_back();
+			record_event(RESOURCE_POOL_PROGRAM_EVICTED);
 		}
 	}
 
@@ -212,22 +608,25 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	assert(height > 0);
 
 	pthread_mutex_lock(&lock);
-	// See if there's a texture on the freelist we can use.
-	for (list<GLuint>::iterator freelist_it = texture_freelist.begin();
-	     freelist_it != texture_freelist.end();
-	     ++freelist_it) {
-		GLuint texture_num = *freelist_it;
+	// See if there's a texture on the freelist we can use. We take the most
+	// recently freed one, as the old linear search of the freelist would.
+	map<TextureKey, list<GLuint> >::iterator bucket_it =
+		texture_freelist_by_format.find(texture_key(internal_format, width, height));
+	if (bucket_it != texture_freelist_by_format.end()) {
+		GLuint texture_num = bucket_it->second.front();
+		bucket_it->second.pop_front();
+		if (bucket_it->second.empty()) {
+			texture_freelist_by_format.erase(bucket_it);
+		}
 		map<GLuint, Texture2D>::const_iterator format_it = texture_formats.find(texture_num);
 		assert(format_it != texture_formats.end());
-		if (format_it->second.internal_format == internal_format &&
-		    format_it->second.width == width &&
-		    format_it->second.height == height) {
-			texture_freelist_bytes -= estimate_texture_size(format_it->second);
-			texture_freelist.erase(freelist_it);
-			pthread_mutex_unlock(&lock);
-			return texture_num;
-		}
+		texture_freelist_bytes -= estimate_texture_size(format_it->second);
+		texture_freelist.erase(format_it->second.freelist_it);
+		record_event(RESOURCE_POOL_TEXTURE_HIT);
+		pthread_mutex_unlock(&lock);
+		return texture_num;
 	}
+	record_event(RESOURCE_POOL_TEXTURE_CREATED);
 
 	// Find any reasonable format given the internal format; OpenGL validates it
 	// even though we give NULL as pointer.
@@ -237,10 +636,12 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	case GL_RGBA16F_ARB:
 	case GL_RGBA8:
 	case GL_SRGB8_ALPHA8:
+	case GL_RGB10_A2:
 		format = GL_RGBA;
 		break;
 	case GL_RGB32F:
 	case GL_RGB16F:
+	case GL_R11F_G11F_B10F:
 	case GL_RGB8:
 	case GL_SRGB8:
 	case GL_RGB565:
@@ -285,6 +686,12 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 	case GL_RGB565:
 		type = GL_UNSIGNED_SHORT_5_6_5;
 		break;
+	case GL_RGB10_A2:
+		type = GL_UNSIGNED_INT_2_10_10_10_REV;
+		break;
+	case GL_R11F_G11F_B10F:
+		type = GL_UNSIGNED_INT_10F_11F_11F_REV;
+		break;
 	default:
 		// TODO: Add more here as needed.
 		assert(false);
@@ -315,18 +722,35 @@ GLuint ResourcePool::create_2d_texture(GLint internal_format, GLsizei width, GLs
 void ResourcePool::release_2d_texture(GLuint texture_num)
 {
 	pthread_mutex_lock(&lock);
+	map<GLuint, Texture2D>::iterator format_it = texture_formats.find(texture_num);
+	assert(format_it != texture_formats.end());
 	texture_freelist.push_front(texture_num);
-	assert(texture_formats.count(texture_num) != 0);
-	texture_freelist_bytes += estimate_texture_size(texture_formats[texture_num]);
+	format_it->second.freelist_it = texture_freelist.begin();
+	texture_freelist_by_format[texture_key(format_it->second)].push_front(texture_num);
+	texture_freelist_bytes += estimate_texture_size(format_it->second);
 
 	while (texture_freelist_bytes > texture_freelist_max_bytes) {
 		GLuint free_texture_num = texture_freelist.back();
 		texture_freelist.pop_back();
-		assert(texture_formats.count(free_texture_num) != 0);
-		texture_freelist_bytes -= estimate_texture_size(texture_formats[free_texture_num]);
-		texture_formats.erase(free_texture_num);
+		format_it = texture_formats.find(free_texture_num);
+		assert(format_it != texture_formats.end());
+
+		// Both lists are in order of release, so the oldest texture
+		// overall is also the oldest one of its format.
+		map<TextureKey, list<GLuint> >::iterator bucket_it =
+			texture_freelist_by_format.find(texture_key(format_it->second));
+		assert(bucket_it != texture_freelist_by_format.end());
+		assert(bucket_it->second.back() == free_texture_num);
+		bucket_it->second.pop_back();
+		if (bucket_it->second.empty()) {
+			texture_freelist_by_format.erase(bucket_it);
+		}
+
+		texture_freelist_bytes -= estimate_texture_size(format_it->second);
+		texture_formats.erase(format_it);
 		glDeleteTextures(1, &free_texture_num);
 		check_error();
+		record_event(RESOURCE_POOL_TEXTURE_EVICTED);
 
 		// Unlink any lingering FBO related to this texture. We might
 		// not be in the right context, so don't delete it right away;
@@ -370,11 +794,13 @@ GLuint ResourcePool::create_fbo(GLuint texture0_num, GLuint texture1_num, GLuint
 			    fbo_it->second.texture_num[2] == texture2_num &&
 			    fbo_it->second.texture_num[3] == texture3_num) {
 				fbo_freelist[context].erase(freelist_it);
+				record_event(RESOURCE_POOL_FBO_HIT);
 				pthread_mutex_unlock(&lock);
 				return fbo_it->second.fbo_num;
 			}
 		}
 	}
+	record_event(RESOURCE_POOL_FBO_CREATED);
 
 	// Create a new one.
 	FBO fbo_format;
@@ -433,7 +859,116 @@ void ResourcePool::release_fbo(GLuint fbo_num)
 	// to deleted textures (in release_2d_texture).
 	cleanup_unlinked_fbos(context);
 
+	size_t old_freelist_length = fbo_freelist[context].size();
 	shrink_fbo_freelist(context, fbo_freelist_max_length);
+	for (size_t i = fbo_freelist[context].size(); i < old_freelist_length; ++i) {
+		record_event(RESOURCE_POOL_FBO_EVICTED);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+GLuint ResourcePool::create_pbo(size_t size)
+{
+	assert(size > 0);
+
+	pthread_mutex_lock(&lock);
+	// See if there's a buffer on the freelist we can use. Go from the back,
+	// so that we take the one that was released the longest time ago.
+	for (list<GLuint>::reverse_iterator freelist_it = pbo_freelist.rbegin();
+	     freelist_it != pbo_freelist.rend();
+	     ++freelist_it) {
+		GLuint pbo_num = *freelist_it;
+		map<GLuint, size_t>::const_iterator size_it = pbo_sizes.find(pbo_num);
+		assert(size_it != pbo_sizes.end());
+		if (size_it->second == size) {
+			pbo_freelist.erase(--freelist_it.base());
+			record_event(RESOURCE_POOL_PBO_HIT);
+			pthread_mutex_unlock(&lock);
+			return pbo_num;
+		}
+	}
+	record_event(RESOURCE_POOL_PBO_CREATED);
+
+	GLuint pbo_num;
+	glGenBuffers(1, &pbo_num);
+	check_error();
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo_num);
+	check_error();
+	glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+	check_error();
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	check_error();
+
+	assert(pbo_sizes.count(pbo_num) == 0);
+	pbo_sizes.insert(make_pair(pbo_num, size));
+
+	pthread_mutex_unlock(&lock);
+	return pbo_num;
+}
+
+void ResourcePool::release_pbo(GLuint pbo_num)
+{
+	pthread_mutex_lock(&lock);
+	assert(pbo_sizes.count(pbo_num) != 0);
+	assert(find(pbo_freelist.begin(), pbo_freelist.end(), pbo_num) == pbo_freelist.end());
+	pbo_freelist.push_front(pbo_num);
+
+	while (pbo_freelist.size() > pbo_freelist_max_length) {
+		GLuint free_pbo_num = pbo_freelist.back();
+		pbo_freelist.pop_back();
+		pbo_sizes.erase(free_pbo_num);
+		glDeleteBuffers(1, &free_pbo_num);
+		check_error();
+		record_event(RESOURCE_POOL_PBO_EVICTED);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+GLuint ResourcePool::create_vec2_vao(const set<GLint> &attribute_indices, GLuint vbo_num)
+{
+	void *context = get_gl_context_identifier();
+
+	pthread_mutex_lock(&lock);
+	cleanup_released_vaos(context);
+	pthread_mutex_unlock(&lock);
+
+	GLuint vao;
+	glGenVertexArrays(1, &vao);
+	check_error();
+	glBindVertexArray(vao);
+	check_error();
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_num);
+	check_error();
+
+	for (set<GLint>::const_iterator attr_it = attribute_indices.begin();
+	     attr_it != attribute_indices.end();
+	     ++attr_it) {
+		glEnableVertexAttribArray(*attr_it);
+		check_error();
+		glVertexAttribPointer(*attr_it, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+		check_error();
+	}
+
+	glBindVertexArray(0);
+	check_error();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	check_error();
+
+	return vao;
+}
+
+void ResourcePool::release_vec2_vao(void *context, GLuint vao_num)
+{
+	void *current_context = get_gl_context_identifier();
+
+	pthread_mutex_lock(&lock);
+	if (context == current_context) {
+		glDeleteVertexArrays(1, &vao_num);
+		check_error();
+	} else {
+		vaos_to_delete[context].push_back(vao_num);
+	}
+	cleanup_released_vaos(current_context);
 	pthread_mutex_unlock(&lock);
 }
 
@@ -441,10 +976,24 @@ void ResourcePool::clean_context()
 {
 	void *context = get_gl_context_identifier();
 
-	// Currently, we only need to worry about FBOs, as they are the only
-	// non-shareable resource we hold.
+	// Currently, we only need to worry about FBOs and VAOs, as they are
+	// the only non-shareable resources we hold.
 	shrink_fbo_freelist(context, 0);
 	fbo_freelist.erase(context);
+	cleanup_released_vaos(context);
+}
+
+void ResourcePool::cleanup_released_vaos(void *context)
+{
+	map<void *, vector<GLuint> >::iterator vao_it = vaos_to_delete.find(context);
+	if (vao_it == vaos_to_delete.end()) {
+		return;
+	}
+	for (unsigned i = 0; i < vao_it->second.size(); ++i) {
+		glDeleteVertexArrays(1, &vao_it->second[i]);
+		check_error();
+	}
+	vaos_to_delete.erase(vao_it);
 }
 
 void ResourcePool::cleanup_unlinked_fbos(void *context)
@@ -485,10 +1034,25 @@ void ResourcePool::shrink_fbo_freelist(void *context, size_t max_length)
 }
 
 size_t ResourcePool::estimate_texture_size(const Texture2D &texture_format)
+{
+	return estimate_texture_size(texture_format.internal_format, texture_format.width, texture_format.height);
+}
+
+ResourcePool::TextureKey ResourcePool::texture_key(GLint internal_format, GLsizei width, GLsizei height)
+{
+	return make_pair(internal_format, make_pair(width, height));
+}
+
+ResourcePool::TextureKey ResourcePool::texture_key(const Texture2D &texture_format)
+{
+	return texture_key(texture_format.internal_format, texture_format.width, texture_format.height);
+}
+
+size_t ResourcePool::estimate_texture_size(GLint internal_format, GLsizei width, GLsizei height)
 {
 	size_t bytes_per_pixel;
 
-	switch (texture_format.internal_format) {
+	switch (internal_format) {
 	case GL_RGBA32F_ARB:
 		bytes_per_pixel = 16;
 		break;
@@ -503,6 +1067,8 @@ size_t ResourcePool::estimate_texture_size(const Texture2D &texture_format)
 		break;
 	case GL_RGBA8:
 	case GL_SRGB8_ALPHA8:
+	case GL_RGB10_A2:
+	case GL_R11F_G11F_B10F:
 		bytes_per_pixel = 4;
 		break;
 	case GL_RGB8:
@@ -535,7 +1101,7 @@ size_t ResourcePool::estimate_texture_size(const Texture2D &texture_format)
 		assert(false);
 	}
 
-	return texture_format.width * texture_format.height * bytes_per_pixel;
+	return width * height * bytes_per_pixel;
 }
 
 }  // namespace movit
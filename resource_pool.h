@@ -25,14 +25,86 @@
 #include <epoxy/gl.h>
 #include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <list>
 #include <map>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
 namespace movit {
 
+class EffectChain;
+
+// Statistics for the on-disk program cache; see
+// ResourcePool::set_program_cache_directory().
+struct ProgramCacheStats {
+	// Programs that were loaded from disk instead of being compiled.
+	unsigned hits;
+
+	// Programs that had to be compiled from source, either because there
+	// was no usable entry for them on disk, or because the driver
+	// rejected the stored binary (the latter are also counted in
+	// <rejected>). Programs found in the in-memory cache are not counted.
+	unsigned misses;
+	unsigned rejected;
+};
+
+// Things that can happen inside a ResourcePool; see ResourcePool::get_stats()
+// and ResourcePool::set_event_callback().
+enum ResourcePoolEvent {
+	// A program was found in the in-memory cache.
+	RESOURCE_POOL_PROGRAM_HIT,
+	// A program was not in memory, and was loaded from the on-disk cache
+	// (see ResourcePool::set_program_cache_directory()).
+	RESOURCE_POOL_PROGRAM_LOADED,
+	// A program had to be compiled from source.
+	RESOURCE_POOL_PROGRAM_COMPILED,
+	// An unused program was deleted because the freelist was full.
+	RESOURCE_POOL_PROGRAM_EVICTED,
+
+	// The same for textures, FBOs and pixel pack buffers; “created” means
+	// nothing suitable was on the freelist.
+	RESOURCE_POOL_TEXTURE_HIT,
+	RESOURCE_POOL_TEXTURE_CREATED,
+	RESOURCE_POOL_TEXTURE_EVICTED,
+	RESOURCE_POOL_FBO_HIT,
+	RESOURCE_POOL_FBO_CREATED,
+	RESOURCE_POOL_FBO_EVICTED,
+	RESOURCE_POOL_PBO_HIT,
+	RESOURCE_POOL_PBO_CREATED,
+	RESOURCE_POOL_PBO_EVICTED,
+
+	RESOURCE_POOL_NUM_EVENTS
+};
+
+// A snapshot of the state of a ResourcePool; see ResourcePool::get_stats().
+struct ResourcePoolStats {
+	// How many times each event has happened since the pool was created.
+	uint64_t event_counts[RESOURCE_POOL_NUM_EVENTS];
+
+	// Same as ResourcePool::get_program_cache_stats().
+	ProgramCacheStats program_cache;
+
+	size_t num_programs_in_use, num_programs_on_freelist;
+
+	// <texture_freelist_bytes> is subject to the same coarse estimate
+	// as the limit given to the ResourcePool constructor.
+	size_t num_textures_in_use, num_textures_on_freelist;
+	size_t texture_freelist_bytes, texture_freelist_max_bytes;
+
+	// Keyed by context (as given by get_gl_context_identifier()).
+	std::map<void *, size_t> fbo_freelist_lengths;
+
+	size_t num_pbos_on_freelist;
+};
+
+// Called with the pool's lock held, so it must not call back into the pool,
+// and should be quick; typically, it would just bump a counter or log
+// something for monitoring.
+typedef void (*ResourcePoolEventCallback)(ResourcePoolEvent event, void *userdata);
+
 class ResourcePool {
 public:
 	// program_freelist_max_length is how many compiled programs that are unused to keep
@@ -46,11 +118,60 @@ public:
 	// take into account padding, metadata, and most importantly mipmapping.
 	// This means you should be prepared for actual memory usage of the freelist being
 	// twice this estimate or more.
+	//
+	// pbo_freelist_max_length is how many unused pixel pack buffers (used for
+	// asynchronous readback; see EffectChain::render_to_buffer()) to keep around.
 	ResourcePool(size_t program_freelist_max_length = 100,
 	             size_t texture_freelist_max_bytes = 100 << 20,  // 100 MB.
-	             size_t fbo_freelist_max_length = 100);  // Per context.
+	             size_t fbo_freelist_max_length = 100,  // Per context.
+	             size_t pbo_freelist_max_length = 16);
 	~ResourcePool();
 
+	// Store linked programs in <directory> (which must already exist),
+	// so that later processes can load them with glProgramBinary() instead
+	// of compiling the shaders again. Entries are keyed on the shader source
+	// and the GL_RENDERER and GL_VERSION strings, so a driver or GPU change
+	// simply causes new entries to be written; if the driver still refuses
+	// a stored binary, the program is compiled from source as usual and
+	// the entry is overwritten. Stale entries are never deleted, so clearing
+	// out the directory now and then is the user's responsibility.
+	//
+	// An empty string (the default) disables the cache. The cache is also
+	// silently disabled if the driver does not support program binaries
+	// (see movit_program_binaries_supported).
+	void set_program_cache_directory(const std::string &directory);
+	ProgramCacheStats get_program_cache_stats();
+
+	// Get a consistent snapshot of counters and freelist sizes, e.g. for
+	// monitoring. Frequent RESOURCE_POOL_PROGRAM_COMPILED events after
+	// startup mean chains are being built that miss the program cache;
+	// frequent RESOURCE_POOL_TEXTURE_EVICTED events mean the texture
+	// freelist limit is too small for the working set, and textures
+	// are being recreated every frame.
+	ResourcePoolStats get_stats();
+
+	// Have <callback> called (with <userdata>) every time an event is
+	// counted; see ResourcePoolEventCallback for restrictions. NULL
+	// (the default) disables the callback. Counting is always on.
+	void set_event_callback(ResourcePoolEventCallback callback, void *userdata);
+
+	// Finalize all the given chains (which must use this pool, and must not
+	// be finalized yet), and wait until all their programs are compiled.
+	// This is meant to be called at startup, with one chain of each kind
+	// that will be needed later, so that setting up the real chains later
+	// finds their programs already compiled instead of stalling. The chains
+	// are still yours; if you delete them, their programs are kept on the
+	// freelist (see program_freelist_max_length) for chains that want
+	// exactly the same programs.
+	//
+	// If the driver can compile in the background (see
+	// movit_parallel_shader_compile_supported), all programs are compiled
+	// in parallel. If not, they are compiled one by one; you can still
+	// keep that off your rendering thread by calling this from a thread
+	// of its own, with an OpenGL context sharing resources with the one
+	// you render in (see the thread-safety notes above).
+	void prewarm(const std::vector<EffectChain *> &chains);
+
 	// All remaining functions are intended for calls from EffectChain only.
 
 	// Compile the given vertex+fragment shader pair, or fetch an already
@@ -65,6 +186,36 @@ public:
 	GLuint compile_glsl_program(const std::string& vertex_shader,
 	                            const std::string& fragment_shader,
 	                            const std::vector<std::string>& frag_shader_outputs);
+
+	// Same as above, but with the program's hash (as returned by
+	// hash_glsl_program()) precomputed, so that callers that keep the
+	// sources around can avoid hashing tens of kilobytes of text every time.
+	// Lookups are by hash; the full sources are only compared against the
+	// one cached program with the same hash, if any.
+	GLuint compile_glsl_program(const std::string& vertex_shader,
+	                            const std::string& fragment_shader,
+	                            const std::vector<std::string>& frag_shader_outputs,
+	                            uint64_t program_hash);
+	// Same as above, but if the driver can compile in the background
+	// (see movit_parallel_shader_compile_supported), returns without waiting
+	// for the shaders to be compiled and the program to be linked (errors in
+	// either are reported once it is done). You must not use the program (not even
+	// to look up uniforms) until is_program_ready() has returned true,
+	// or you have called wait_for_program().
+	GLuint compile_glsl_program_async(const std::string& vertex_shader,
+	                                  const std::string& fragment_shader,
+	                                  const std::vector<std::string>& frag_shader_outputs,
+	                                  uint64_t program_hash);
+
+	// Whether the given program has finished linking; never blocks.
+	bool is_program_ready(GLuint glsl_program_num);
+
+	// Block until the given program has finished linking.
+	void wait_for_program(GLuint glsl_program_num);
+
+	static uint64_t hash_glsl_program(const std::string& vertex_shader,
+	                                  const std::string& fragment_shader,
+	                                  const std::vector<std::string>& frag_shader_outputs);
 	void release_glsl_program(GLuint glsl_program_num);
 
 	// Allocate a 2D texture of the given internal format and dimensions,
@@ -91,6 +242,32 @@ public:
 	                  GLuint texture3_num = 0);
 	void release_fbo(GLuint fbo_num);
 
+	// Allocate a pixel pack buffer (for use with GL_PIXEL_PACK_BUFFER) of
+	// exactly <size> bytes, or fetch a previously used one if possible.
+	// Buffers on the freelist are reused oldest first, so that if you
+	// keep a few readbacks in flight, they will rotate through a ring
+	// of buffers, and the one you get back is the one the GPU is most
+	// likely to be done with. Unbinds GL_PIXEL_PACK_BUFFER afterwards.
+	// Keeps ownership of the buffer; you must call release_pbo() instead
+	// of deleting it when you no longer want it (and it must not be mapped
+	// at that point).
+	GLuint create_pbo(size_t size);
+	void release_pbo(GLuint pbo_num);
+
+	// Create a vertex array object in the current context, with all the given
+	// attribute indices enabled and pointing to <vbo_num> as two-component
+	// floats, tightly packed from the start of the buffer. Unbinds the VAO
+	// (and GL_ARRAY_BUFFER) afterwards.
+	//
+	// VAOs are not shareable across contexts, so when you are done with it,
+	// you need to give it back with release_vec2_vao(), along with the context
+	// it was created in (as given by get_gl_context_identifier()). If that is
+	// not the current context, the deletion is deferred until the next time
+	// that context calls into create_vec2_vao(), release_vec2_vao() or
+	// clean_context().
+	GLuint create_vec2_vao(const std::set<GLint> &attribute_indices, GLuint vbo_num);
+	void release_vec2_vao(void *context, GLuint vao_num);
+
 	// Informs the ResourcePool that the current context is going away soon,
 	// and that any resources held for it in the freelist should be deleted.
 	//
@@ -99,13 +276,46 @@ public:
 	// thread/context, you never need to call this function.
 	void clean_context();
 
+	// Estimate how many bytes a 2D texture of the given format and dimensions
+	// will take up. See the caveats at the constructor; in particular,
+	// mipmaps are not taken into account.
+	static size_t estimate_texture_size(GLint internal_format, GLsizei width, GLsizei height);
+
 private:
+	GLuint compile_glsl_program(const std::string& vertex_shader,
+	                            const std::string& fragment_shader,
+	                            const std::vector<std::string>& frag_shader_outputs,
+	                            uint64_t program_hash,
+	                            bool wait);
+
+	// Check the compile status of the shaders and the link status of a program
+	// in <pending_programs> (blocking until they are known), and store it
+	// on disk if the cache wants it.
+	// Must be called with the lock held.
+	void finish_linking(GLuint glsl_program_num);
+
 	// Delete the given program and both its shaders.
 	void delete_program(GLuint program_num);
 
+	// Try to create a program from the on-disk cache entry in <filename>,
+	// which must have been stored for exactly <identity>. Returns 0 if there
+	// is no such entry, or if it was rejected by the driver.
+	GLuint load_program_binary(const std::string &filename, const std::string &identity);
+
+	// Write the given (linked) program to the on-disk cache. Failures are
+	// reported, but are otherwise not fatal.
+	void save_program_binary(const std::string &filename, const std::string &identity, GLuint glsl_program_num);
+
+	// Count the given event, and call the event callback if there is one.
+	// Must be called with the lock held.
+	void record_event(ResourcePoolEvent event);
+
 	// Deletes all FBOs for the given context that belong to deleted textures.
 	void cleanup_unlinked_fbos(void *context);
 
+	// Delete all VAOs that were released for <context> while it was not current.
+	void cleanup_released_vaos(void *context);
+
 	// Remove FBOs off the end of the freelist for <context>, until it
 	// is no more than <max_length> elements long.
 	void shrink_fbo_freelist(void *context, size_t max_length);
@@ -113,10 +323,20 @@ private:
 	// Protects all the other elements in the class.
 	pthread_mutex_t lock;
 
-	size_t program_freelist_max_length, texture_freelist_max_bytes, fbo_freelist_max_length;
+	size_t program_freelist_max_length, texture_freelist_max_bytes, fbo_freelist_max_length, pbo_freelist_max_length;
 		
-	// A mapping from vertex/fragment shader source strings to compiled program number.
-	std::map<std::pair<std::string, std::string>, GLuint> programs;
+	// A mapping from program hash (see hash_glsl_program()) to compiled program number.
+	std::map<uint64_t, GLuint> programs;
+
+	// The full sources of every compiled program, so that a hash match in
+	// <programs> can be verified. In the unlikely event of a hash collision,
+	// the second program is only present here, and not in <programs>.
+	struct ProgramSource {
+		uint64_t hash;
+		std::string vertex_shader, fragment_shader;
+		std::vector<std::string> fragment_shader_outputs;
+	};
+	std::map<GLuint, ProgramSource> program_sources;
 
 	// A mapping from compiled program number to number of current users.
 	// Once this reaches zero, the program is taken out of this map and instead
@@ -124,6 +344,7 @@ private:
 	std::map<GLuint, int> program_refcount;
 
 	// A mapping from program number to vertex and fragment shaders.
+	// Both are zero for programs that were loaded from the on-disk cache.
 	std::map<GLuint, std::pair<GLuint, GLuint> > program_shaders;
 
 	// A list of programs that are no longer in use, most recently freed first.
@@ -131,11 +352,40 @@ private:
 	// will be deleted.
 	std::list<GLuint> program_freelist;
 
+	// The position of each program in <program_freelist>, so that it can
+	// be taken off the freelist without searching for it.
+	std::map<GLuint, std::list<GLuint>::iterator> program_freelist_positions;
+
+	// Programs that have been linked, but whose shader compile status and
+	// link status we have not checked yet (see compile_glsl_program_async()).
+	// We keep the shader sources for the error message if compilation
+	// failed, and the on-disk cache entry to write once they are done
+	// (both strings empty if none).
+	struct PendingProgram {
+		GLuint vs_obj, fs_obj;
+		std::string vertex_shader, fragment_shader;
+		std::string cache_filename, cache_identity;
+	};
+	std::map<GLuint, PendingProgram> pending_programs;
+
+	// See set_program_cache_directory(). Empty if the on-disk cache is disabled.
+	std::string program_cache_directory;
+	ProgramCacheStats program_cache_stats;
+
 	struct Texture2D {
 		GLint internal_format;
 		GLsizei width, height;
+
+		// The texture's position in <texture_freelist>.
+		// Only valid while it is on the freelist.
+		std::list<GLuint>::iterator freelist_it;
 	};
 
+	// Internal format, width and height.
+	typedef std::pair<GLint, std::pair<GLsizei, GLsizei> > TextureKey;
+	static TextureKey texture_key(GLint internal_format, GLsizei width, GLsizei height);
+	static TextureKey texture_key(const Texture2D &texture_format);
+
 	// A mapping from texture number to format details. This is filled if the
 	// texture is given out to a client or on the freelist, but not if it is
 	// deleted from the freelist.
@@ -149,6 +399,11 @@ private:
 	std::list<GLuint> texture_freelist;
 	size_t texture_freelist_bytes;
 
+	// The same textures as in <texture_freelist>, bucketed by format and
+	// dimensions, and in the same order within each bucket. Empty buckets
+	// are removed.
+	std::map<TextureKey, std::list<GLuint> > texture_freelist_by_format;
+
 	static const unsigned num_fbo_attachments = 4;
 	struct FBO {
 		GLuint fbo_num;
@@ -170,6 +425,25 @@ private:
 	// We store iterators directly into <fbo_format> for efficiency.
 	std::map<void *, std::list<FBOFormatIterator> > fbo_freelist;
 
+	// For each context, VAOs that have been released from another context,
+	// and are waiting to be deleted.
+	std::map<void *, std::vector<GLuint> > vaos_to_delete;
+
+	// A mapping from pixel pack buffer number to its size in bytes. This is
+	// filled if the buffer is given out to a client or on the freelist, but
+	// not if it is deleted from the freelist.
+	std::map<GLuint, size_t> pbo_sizes;
+
+	// A list of all pixel pack buffers that are released but not freed
+	// (most recently freed first). Once this reaches <pbo_freelist_max_length>,
+	// the last element will be deleted.
+	std::list<GLuint> pbo_freelist;
+
+	// See get_stats() and set_event_callback().
+	uint64_t event_counts[RESOURCE_POOL_NUM_EVENTS];
+	ResourcePoolEventCallback event_callback;
+	void *event_callback_userdata;
+
 	// See the caveats at the constructor.
 	static size_t estimate_texture_size(const Texture2D &texture_format);
 };
@@ -1,6 +1,7 @@
 #include "saturation_effect.h"
 #include "util.h"
 
+using namespace Eigen;
 using namespace std;
 
 namespace movit {
@@ -16,4 +17,14 @@ string SaturationEffect::output_fragment_shader()
 	return read_file("saturation_effect.frag");
 }
 
+bool SaturationEffect::get_color_matrix(Matrix3d *matrix, float *alpha_factor) const
+{
+	// mix(vec3(luminance), x.rgb, saturation), as in the shader.
+	RowVector3d luminance_weights(0.2126, 0.7152, 0.0722);
+	*matrix = saturation * Matrix3d::Identity() +
+		(1.0 - saturation) * Vector3d::Ones() * luminance_weights;
+	*alpha_factor = 1.0f;
+	return true;
+}
+
 }  // namespace movit
@@ -7,6 +7,7 @@
 // (saturation=1). Extrapolating that curve further (ie., saturation > 1)
 // gives us increased saturation if so desired.
 
+#include <Eigen/Core>
 #include <string>
 
 #include "effect.h"
@@ -19,7 +20,11 @@ public:
 	virtual std::string effect_type_id() const { return "SaturationEffect"; }
 	virtual AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual bool is_pointwise() const { return true; }
+	virtual bool is_mergeable() const { return true; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 	std::string output_fragment_shader();
+	virtual bool get_color_matrix(Eigen::Matrix3d *matrix, float *alpha_factor) const;
 
 private:
 	float saturation;
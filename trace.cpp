@@ -0,0 +1,182 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+
+using namespace std;
+
+namespace movit {
+
+namespace {
+
+struct TraceEvent {
+	const char *category;
+	string name;
+	uint64_t start_ns, duration_ns;
+	unsigned track;  // 0 is the GPU; the rest are indexes into <threads>, plus one.
+};
+
+// Whether we are recording. This is only written with <trace_lock> held,
+// but is also read without it as a quick check (see trace_recording_enabled()),
+// so all accesses to it go through relaxed atomics. A stale value only means
+// an event more or less at the edges of the recording; anything that actually
+// touches the recorded events checks the flag again with the lock held.
+bool recording = false;
+
+// Must be called with the lock held.
+void set_recording(bool enabled)
+{
+	__atomic_store_n(&recording, enabled, __ATOMIC_RELAXED);
+}
+
+// Protects everything below.
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+uint64_t trace_start_ns;
+vector<TraceEvent> trace_events;
+vector<pthread_t> threads;
+
+// Must be called with the lock held. There are only ever a handful of threads,
+// so a linear search is fine.
+unsigned get_track_for_current_thread()
+{
+	pthread_t self = pthread_self();
+	for (unsigned i = 0; i < threads.size(); ++i) {
+		if (pthread_equal(threads[i], self)) {
+			return i + 1;
+		}
+	}
+	threads.push_back(self);
+	return threads.size();
+}
+
+void add_event(const char *category, const string &name, uint64_t start_ns, uint64_t duration_ns, bool gpu)
+{
+	if (!trace_recording_enabled()) {
+		return;
+	}
+	pthread_mutex_lock(&trace_lock);
+	if (trace_recording_enabled()) {
+		TraceEvent event;
+		event.category = category;
+		event.name = name;
+		event.start_ns = start_ns;
+		event.duration_ns = duration_ns;
+		event.track = gpu ? 0 : get_track_for_current_thread();
+		trace_events.push_back(event);
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+// Writes <str> as a JSON string, including the quotes.
+void write_json_string(FILE *fp, const string &str)
+{
+	putc('"', fp);
+	for (size_t i = 0; i < str.size(); ++i) {
+		unsigned char ch = str[i];
+		if (ch == '"' || ch == '\\') {
+			fprintf(fp, "\\%c", ch);
+		} else if (ch < 0x20) {
+			fprintf(fp, "\\u%04x", ch);
+		} else {
+			putc(ch, fp);
+		}
+	}
+	putc('"', fp);
+}
+
+void write_track_name(FILE *fp, unsigned track, const string &name)
+{
+	fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", track);
+	write_json_string(fp, name);
+	fprintf(fp, "}}");
+}
+
+}  // namespace
+
+bool trace_recording_enabled()
+{
+	return __atomic_load_n(&recording, __ATOMIC_RELAXED);
+}
+
+void start_trace_recording()
+{
+	pthread_mutex_lock(&trace_lock);
+	trace_events.clear();
+	threads.clear();
+	trace_start_ns = get_monotonic_time_ns();
+	set_recording(true);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+bool stop_trace_recording(const string &filename)
+{
+	pthread_mutex_lock(&trace_lock);
+	set_recording(false);
+
+	FILE *fp = fopen(filename.c_str(), "w");
+	if (fp == NULL) {
+		perror(filename.c_str());
+		pthread_mutex_unlock(&trace_lock);
+		return false;
+	}
+
+	fprintf(fp, "{\"traceEvents\":[\n");
+	write_track_name(fp, 0, "GPU");
+	for (unsigned i = 0; i < threads.size(); ++i) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "CPU thread %u", i + 1);
+		fprintf(fp, ",\n");
+		write_track_name(fp, i + 1, buf);
+	}
+	for (unsigned i = 0; i < trace_events.size(); ++i) {
+		const TraceEvent &event = trace_events[i];
+		fprintf(fp, ",\n{\"name\":");
+		write_json_string(fp, event.name);
+		fprintf(fp, ",\"cat\":");
+		write_json_string(fp, event.category);
+
+		// Timestamps are in microseconds. Some events can start before
+		// recording did (e.g. GPU events submitted just before).
+		double ts_us = (int64_t(event.start_ns) - int64_t(trace_start_ns)) * 1e-3;
+		fprintf(fp, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+			ts_us, event.duration_ns * 1e-3, event.track);
+	}
+	fprintf(fp, "\n]}\n");
+
+	bool ok = !ferror(fp);
+	if (fclose(fp) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		perror(filename.c_str());
+	}
+	trace_events.clear();
+	threads.clear();
+	pthread_mutex_unlock(&trace_lock);
+	return ok;
+}
+
+uint64_t get_monotonic_time_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return uint64_t(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+void add_trace_event(const char *category, const string &name,
+                     uint64_t start_ns, uint64_t duration_ns)
+{
+	add_event(category, name, start_ns, duration_ns, false);
+}
+
+void add_gpu_trace_event(const char *category, const string &name,
+                         uint64_t start_ns, uint64_t duration_ns)
+{
+	add_event(category, name, start_ns, duration_ns, true);
+}
+
+}  // namespace movit
@@ -0,0 +1,79 @@
+#ifndef _MOVIT_TRACE_H
+#define _MOVIT_TRACE_H 1
+
+// Optional recording of a timeline of what Movit spends its time on, written
+// in the Trace Event Format understood by chrome://tracing and Perfetto.
+// This covers the steps of EffectChain::finalize() (including shader
+// compilation), each frame's phases, texture uploads in the inputs, and
+// weight generation in the resampling and blur effects. If phase timing
+// is enabled (see EffectChain::enable_phase_timing()), the GPU time for
+// each phase is also recorded, on a separate “GPU” track.
+//
+// Recording is process-wide, since effects generally do not know which
+// EffectChain they belong to; events from different threads go on
+// different tracks. When recording is off, the cost of each trace point
+// is a single call to check a global flag.
+
+#include <stdint.h>
+#include <string>
+
+namespace movit {
+
+// Start recording, throwing away any events recorded earlier.
+void start_trace_recording();
+
+// Stop recording, and write all the events recorded since
+// start_trace_recording() to <filename>. Returns false (after printing
+// an error message) if the file could not be written.
+bool stop_trace_recording(const std::string &filename);
+
+// Whether recording is on. This can be called from any thread, without
+// taking a lock, so that it is cheap enough to check everywhere; around
+// start_trace_recording() and stop_trace_recording(), it may return a
+// slightly stale value.
+bool trace_recording_enabled();
+
+// A monotonic clock, in nanoseconds from some arbitrary point in time.
+// All trace timestamps come from this clock.
+uint64_t get_monotonic_time_ns();
+
+// Record an event on the current thread's track, starting at <start_ns>
+// and lasting for <duration_ns> (both from get_monotonic_time_ns()).
+// Does nothing if recording is off.
+void add_trace_event(const char *category, const std::string &name,
+                     uint64_t start_ns, uint64_t duration_ns);
+
+// Same, but on the GPU track. Since we only know how long a phase took
+// on the GPU and not when it started, <start_ns> is typically the time
+// it was submitted, so the events are placed on the timeline earlier
+// than when they actually ran.
+void add_gpu_trace_event(const char *category, const std::string &name,
+                         uint64_t start_ns, uint64_t duration_ns);
+
+// Records an event spanning the lifetime of the object, e.g.:
+//
+//   {
+//           TraceScope trace("finalize", "construct_phase");
+//           ...
+//   }
+//
+// <category> must be a string literal (or otherwise outlive the recording).
+class TraceScope {
+public:
+	TraceScope(const char *category, const char *name)
+		: category(category), name(name), start_ns(trace_recording_enabled() ? get_monotonic_time_ns() : 0) {}
+	~TraceScope()
+	{
+		if (start_ns != 0) {
+			add_trace_event(category, name, start_ns, get_monotonic_time_ns() - start_ns);
+		}
+	}
+
+private:
+	const char *category, *name;
+	uint64_t start_ns;
+};
+
+}  // namespace movit
+
+#endif  // !defined(_MOVIT_TRACE_H)
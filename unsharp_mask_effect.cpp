@@ -42,4 +42,12 @@ bool UnsharpMaskEffect::set_float(const string &key, float value) {
 	return blur->set_float(key, value);
 }
 
+ParamHandle<float> UnsharpMaskEffect::get_float_handle(const string &key) {
+	if (key == "amount") {
+		// Sets two parameters; see set_float().
+		return ParamHandle<float>();
+	}
+	return blur->get_float_handle(key);
+}
+
 }  // namespace movit
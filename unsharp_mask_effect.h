@@ -32,6 +32,7 @@ public:
 
 	virtual void rewrite_graph(EffectChain *graph, Node *self);
 	virtual bool set_float(const std::string &key, float value);
+	virtual ParamHandle<float> get_float_handle(const std::string &key);
 
 	virtual std::string output_fragment_shader() {
 		assert(false);
@@ -138,14 +138,18 @@ string read_version_dependent_file(const string &base, const string &extension)
 	}
 }
 
-GLuint compile_shader(const string &shader_src, GLenum type)
+GLuint start_compiling_shader(const string &shader_src, GLenum type)
 {
 	GLuint obj = glCreateShader(type);
 	const GLchar* source[] = { shader_src.data() };
 	const GLint length[] = { (GLint)shader_src.size() };
 	glShaderSource(obj, 1, source, length);
 	glCompileShader(obj);
+	return obj;
+}
 
+void check_shader_compile_status(GLuint obj, const string &shader_src)
+{
 	GLchar info_log[4096];
 	GLsizei log_length = sizeof(info_log) - 1;
 	glGetShaderInfoLog(obj, log_length, &log_length, info_log);
@@ -160,7 +164,12 @@ GLuint compile_shader(const string &shader_src, GLenum type)
 		fprintf(stderr, "Failed to compile shader: %s\n", shader_src.c_str());
 		exit(1);
 	}
+}
 
+GLuint compile_shader(const string &shader_src, GLenum type)
+{
+	GLuint obj = start_compiling_shader(shader_src, type);
+	check_shader_compile_status(obj, shader_src);
 	return obj;
 }
 
@@ -186,6 +195,15 @@ string output_glsl_mat3(const string &name, const Eigen::Matrix3d &m)
 	return ss.str();
 }
 
+string output_glsl_int(const string &name, int x)
+{
+	// Use stringstream to be independent of the current locale in a thread-safe manner.
+	stringstream ss;
+	ss.imbue(locale("C"));
+	ss << "const int " << name << " = " << x << ";\n";
+	return ss.str();
+}
+
 string output_glsl_float(const string &name, float x)
 {
 	// Use stringstream to be independent of the current locale in a thread-safe manner.
@@ -219,6 +237,17 @@ string output_glsl_vec3(const string &name, float x, float y, float z)
 	return ss.str();
 }
 
+string output_glsl_vec4(const string &name, float x, float y, float z, float w)
+{
+	// Use stringstream to be independent of the current locale in a thread-safe manner.
+	stringstream ss;
+	ss.imbue(locale("C"));
+	ss.precision(8);
+	ss << scientific;
+	ss << "const vec4 " << name << " = vec4(" << x << ", " << y << ", " << z << ", " << w << ");\n";
+	return ss.str();
+}
+
 template<class DestFloat>
 void combine_two_samples(float w1, float w2, float pos1, float pos2, float num_subtexels, float inv_num_subtexels,
                          DestFloat *offset, DestFloat *total_weight, float *sum_sq_error)
@@ -32,16 +32,25 @@ std::string read_version_dependent_file(const std::string &base, const std::stri
 // and return the object number.
 GLuint compile_shader(const std::string &shader_src, GLenum type);
 
+// The two halves of compile_shader(). start_compiling_shader() does not ask
+// for the result, so with GL_KHR_parallel_shader_compile, it returns before
+// the driver is done; check_shader_compile_status() blocks until it is,
+// prints the compile log, and exits if compilation failed.
+GLuint start_compiling_shader(const std::string &shader_src, GLenum type);
+void check_shader_compile_status(GLuint obj, const std::string &shader_src);
+
 // Print a 3x3 matrix to standard output. Useful for debugging.
 void print_3x3_matrix(const Eigen::Matrix3d &m);
 
 // Output a GLSL 3x3 matrix declaration.
 std::string output_glsl_mat3(const std::string &name, const Eigen::Matrix3d &m);
 
-// Output GLSL scalar, 2-length and 3-length vector declarations.
+// Output GLSL scalar, 2-length, 3-length and 4-length vector declarations.
+std::string output_glsl_int(const std::string &name, int x);
 std::string output_glsl_float(const std::string &name, float x);
 std::string output_glsl_vec2(const std::string &name, float x, float y);
 std::string output_glsl_vec3(const std::string &name, float x, float y, float z);
+std::string output_glsl_vec4(const std::string &name, float x, float y, float z, float w);
 
 // Calculate a / b, rounding up. Does not handle overflow correctly.
 unsigned div_round_up(unsigned a, unsigned b);
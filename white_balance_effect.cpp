@@ -114,6 +114,18 @@ string WhiteBalanceEffect::output_fragment_shader()
 }
 
 void WhiteBalanceEffect::set_gl_state(GLuint glsl_program_num, const string &prefix, unsigned *sampler_num)
+{
+	uniform_correction_matrix = compute_correction_matrix();
+}
+
+bool WhiteBalanceEffect::get_color_matrix(Matrix3d *matrix, float *alpha_factor) const
+{
+	*matrix = compute_correction_matrix();
+	*alpha_factor = 1.0f;
+	return true;
+}
+
+Matrix3d WhiteBalanceEffect::compute_correction_matrix() const
 {
 	Matrix3d rgb_to_xyz_matrix = ColorspaceConversionEffect::get_xyz_matrix(COLORSPACE_sRGB);
 	Vector3d rgb(neutral_color.r, neutral_color.g, neutral_color.b);
@@ -143,8 +155,7 @@ void WhiteBalanceEffect::set_gl_state(GLuint glsl_program_num, const string &pre
 	 * Note that since we postmultiply our vectors, the order of the matrices
 	 * has to be the opposite of the execution order.
 	 */
-	uniform_correction_matrix =
-		rgb_to_xyz_matrix.inverse() *
+	return rgb_to_xyz_matrix.inverse() *
 		Map<const Matrix3d>(xyz_to_lms_matrix).inverse() *
 		lms_scale.asDiagonal() *
 		Map<const Matrix3d>(xyz_to_lms_matrix) *
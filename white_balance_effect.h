@@ -17,11 +17,17 @@ public:
 	virtual std::string effect_type_id() const { return "WhiteBalanceEffect"; }
 	virtual AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual bool is_pointwise() const { return true; }
+	virtual bool is_mergeable() const { return true; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 	std::string output_fragment_shader();
 
 	void set_gl_state(GLuint glsl_program_num, const std::string &prefix, unsigned *sampler_num);
+	virtual bool get_color_matrix(Eigen::Matrix3d *matrix, float *alpha_factor) const;
 
 private:
+	Eigen::Matrix3d compute_correction_matrix() const;
+
 	// The neutral color, in linear sRGB.
 	RGBTriplet neutral_color;
 
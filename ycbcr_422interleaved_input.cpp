@@ -21,6 +21,7 @@ YCbCr422InterleavedInput::YCbCr422InterleavedInput(const ImageFormat &image_form
 	  ycbcr_format(ycbcr_format),
 	  width(width),
 	  height(height),
+	  chain(NULL),
 	  resource_pool(NULL)
 {
 	pbo = 0;
@@ -45,7 +46,7 @@ YCbCr422InterleavedInput::~YCbCr422InterleavedInput()
 {
 	for (unsigned channel = 0; channel < 2; ++channel) {
 		if (texture_num[channel] != 0) {
-			resource_pool->release_2d_texture(texture_num[channel]);
+			chain->release_texture_when_idle(texture_num[channel]);
 		}
 	}
 }
@@ -134,10 +135,11 @@ void YCbCr422InterleavedInput::invalidate_pixel_data()
 {
 	for (unsigned channel = 0; channel < 2; ++channel) {
 		if (texture_num[channel] != 0) {
-			resource_pool->release_2d_texture(texture_num[channel]);
+			chain->release_texture_when_idle(texture_num[channel]);
 			texture_num[channel] = 0;
 		}
 	}
+	bump_generation();
 }
 
 bool YCbCr422InterleavedInput::set_int(const std::string& key, int value)
@@ -106,6 +106,7 @@ public:
 
 	virtual void inform_added(EffectChain *chain)
 	{
+		this->chain = chain;
 		resource_pool = chain->get_resource_pool();
 	}
 
@@ -127,6 +128,7 @@ private:
 
 	unsigned width, height;
 	const unsigned char *pixel_data;
+	EffectChain *chain;
 	ResourcePool *resource_pool;
 
 	GLint uniform_tex_y, uniform_tex_cbcr;
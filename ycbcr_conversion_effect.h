@@ -25,6 +25,7 @@ public:
 	std::string output_fragment_shader();
 	virtual AlphaHandling alpha_handling() const { return DONT_CARE_ALPHA_TYPE; }
 	virtual bool one_to_one_sampling() const { return true; }
+	virtual Region get_input_footprint(unsigned input_num, const Region &output_region) const { return output_region; }
 
 private:
 	YCbCrFormat ycbcr_format;
@@ -240,6 +240,62 @@ TEST(YCbCrConversionEffectTest, PlanarOutput) {
 	expect_equal(cr, out_cr, width, height);
 }
 
+TEST(YCbCrConversionEffectTest, PlanarOutputToBuffer) {
+	const int width = 1;
+	const int height = 5;
+
+	// Same data as PlanarOutput.
+	unsigned char y[width * height] = {
+		16, 235, 81, 145, 41,
+	};
+	unsigned char cb[width * height] = {
+		128, 128, 90, 54, 240,
+	};
+	unsigned char cr[width * height] = {
+		128, 128, 240, 34, 110,
+	};
+
+	EffectChain chain(width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 256;
+	ycbcr_format.chroma_subsampling_x = 1;
+	ycbcr_format.chroma_subsampling_y = 1;
+	ycbcr_format.cb_x_position = 0.5f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.5f;
+	ycbcr_format.cr_y_position = 0.5f;
+
+	YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height);
+	input->set_pixel_data(0, y);
+	input->set_pixel_data(1, cb);
+	input->set_pixel_data(2, cr);
+	chain.add_input(input);
+
+	chain.add_ycbcr_output(format, OUTPUT_ALPHA_FORMAT_POSTMULTIPLIED, ycbcr_format, YCBCR_OUTPUT_PLANAR);
+	chain.set_output_origin(OUTPUT_ORIGIN_TOP_LEFT);
+	chain.finalize();
+
+	ReadbackTicket *ticket = chain.render_to_buffer(GL_RGBA8, width, height, GL_RED, GL_UNSIGNED_BYTE);
+	ASSERT_EQ(3u, ticket->get_num_planes());
+	const std::vector<const void *> &planes = ticket->wait();
+	EXPECT_TRUE(ticket->poll());
+	ASSERT_EQ(3u, planes.size());
+	EXPECT_EQ(size_t(width * height), ticket->get_plane_size(0));
+
+	expect_equal(y, static_cast<const unsigned char *>(planes[0]), width, height);
+	expect_equal(cb, static_cast<const unsigned char *>(planes[1]), width, height);
+	expect_equal(cr, static_cast<const unsigned char *>(planes[2]), width, height);
+
+	delete ticket;
+}
+
 TEST(YCbCrConversionEffectTest, SplitLumaAndChroma) {
 	const int width = 1;
 	const int height = 5;
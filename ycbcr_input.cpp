@@ -7,6 +7,7 @@
 
 #include "effect_util.h"
 #include "resource_pool.h"
+#include "trace.h"
 #include "util.h"
 #include "ycbcr.h"
 #include "ycbcr_input.h"
@@ -25,6 +26,7 @@ YCbCrInput::YCbCrInput(const ImageFormat &image_format,
 	  ycbcr_input_splitting(ycbcr_input_splitting),
 	  width(width),
 	  height(height),
+	  chain(NULL),
 	  resource_pool(NULL)
 {
 	pbos[0] = pbos[1] = pbos[2] = 0;
@@ -63,6 +65,7 @@ void YCbCrInput::set_gl_state(GLuint glsl_program_num, const string& prefix, uns
 		check_error();
 
 		if (texture_num[channel] == 0) {
+			TraceScope trace("upload", "YCbCrInput upload");
 			GLenum format, internal_format;
 			if (channel == 1 && ycbcr_input_splitting == YCBCR_INPUT_SPLIT_Y_AND_CBCR) {
 				format = GL_RG;
@@ -153,6 +156,7 @@ void YCbCrInput::invalidate_pixel_data()
 	for (unsigned channel = 0; channel < 3; ++channel) {
 		possibly_release_texture(channel);
 	}
+	bump_generation();
 }
 
 bool YCbCrInput::set_int(const std::string& key, int value)
@@ -167,7 +171,7 @@ bool YCbCrInput::set_int(const std::string& key, int value)
 void YCbCrInput::possibly_release_texture(unsigned channel)
 {
 	if (texture_num[channel] != 0 && owns_texture[channel]) {
-		resource_pool->release_2d_texture(texture_num[channel]);
+		chain->release_texture_when_idle(texture_num[channel]);
 		texture_num[channel] = 0;
 		owns_texture[channel] = false;
 	}
@@ -118,10 +118,12 @@ public:
 		possibly_release_texture(channel);
 		this->texture_num[channel] = texture_num;
 		this->owns_texture[channel] = false;
+		bump_generation();
 	}
 
 	virtual void inform_added(EffectChain *chain)
 	{
+		this->chain = chain;
 		resource_pool = chain->get_resource_pool();
 	}
 
@@ -142,6 +144,7 @@ private:
 	const unsigned char *pixel_data[3];
 	unsigned pitch[3];
 	bool owns_texture[3];
+	EffectChain *chain;
 	ResourcePool *resource_pool;
 };
 
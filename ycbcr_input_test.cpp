@@ -10,6 +10,7 @@
 #include "gtest/gtest.h"
 #include "test_util.h"
 #include "util.h"
+#include "resample_effect.h"
 #include "resource_pool.h"
 #include "ycbcr_input.h"
 
@@ -615,6 +616,93 @@ TEST(YCbCrInputTest, ExternalTexture) {
 	expect_equal(expected_data, out_data, 4 * width, height, 0.025, 0.002);
 }
 
+TEST(YCbCrInputTest, NewPixelDataInvalidatesPhaseCache) {
+	const int width = 1;
+	const int height = 5;
+
+	// Same as Simple444, and then the same colors in reverse order.
+	unsigned char y[width * height] = {
+		16, 235, 81, 145, 41,
+	};
+	unsigned char cb[width * height] = {
+		128, 128, 90, 54, 240,
+	};
+	unsigned char cr[width * height] = {
+		128, 128, 240, 34, 110,
+	};
+	unsigned char reversed_y[width * height] = {
+		41, 145, 81, 235, 16,
+	};
+	unsigned char reversed_cb[width * height] = {
+		240, 54, 90, 128, 128,
+	};
+	unsigned char reversed_cr[width * height] = {
+		110, 34, 240, 128, 128,
+	};
+	float expected_data[4 * width * height] = {
+		0.0, 0.0, 0.0, 1.0,
+		1.0, 1.0, 1.0, 1.0,
+		1.0, 0.0, 0.0, 1.0,
+		0.0, 1.0, 0.0, 1.0,
+		0.0, 0.0, 1.0, 1.0,
+	};
+	float reversed_expected_data[4 * width * height] = {
+		0.0, 0.0, 1.0, 1.0,
+		0.0, 1.0, 0.0, 1.0,
+		1.0, 0.0, 0.0, 1.0,
+		1.0, 1.0, 1.0, 1.0,
+		0.0, 0.0, 0.0, 1.0,
+	};
+	float out_data[4 * width * height];
+
+	EffectChainTester tester(NULL, width, height);
+
+	ImageFormat format;
+	format.color_space = COLORSPACE_sRGB;
+	format.gamma_curve = GAMMA_sRGB;
+
+	YCbCrFormat ycbcr_format;
+	ycbcr_format.luma_coefficients = YCBCR_REC_601;
+	ycbcr_format.full_range = false;
+	ycbcr_format.num_levels = 256;
+	ycbcr_format.chroma_subsampling_x = 1;
+	ycbcr_format.chroma_subsampling_y = 1;
+	ycbcr_format.cb_x_position = 0.5f;
+	ycbcr_format.cb_y_position = 0.5f;
+	ycbcr_format.cr_x_position = 0.5f;
+	ycbcr_format.cr_y_position = 0.5f;
+
+	YCbCrInput *input = new YCbCrInput(format, ycbcr_format, width, height);
+	input->set_pixel_data(0, y);
+	input->set_pixel_data(1, cb);
+	input->set_pixel_data(2, cr);
+	tester.get_chain()->add_input(input);
+
+	// An identity resample, just to get a phase (the horizontal pass,
+	// which reads straight from the input) that can be cached.
+	ResampleEffect *resample = new ResampleEffect();
+	ASSERT_TRUE(resample->set_int("width", width));
+	ASSERT_TRUE(resample->set_int("height", height));
+	tester.get_chain()->add_effect(resample);
+	tester.get_chain()->set_phase_cache_budget(1048576);
+
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	expect_equal(expected_data, out_data, 4 * width, height, 0.025, 0.002);
+
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	expect_equal(expected_data, out_data, 4 * width, height, 0.025, 0.002);
+	EXPECT_EQ(1u, tester.get_chain()->get_phase_cache_stats().num_phases_skipped_last_frame);
+
+	// New pixel data must invalidate the cached phase, not give us
+	// the previous frame back.
+	input->set_pixel_data(0, reversed_y);
+	input->set_pixel_data(1, reversed_cb);
+	input->set_pixel_data(2, reversed_cr);
+	tester.run(out_data, GL_RGBA, COLORSPACE_sRGB, GAMMA_sRGB);
+	expect_equal(reversed_expected_data, out_data, 4 * width, height, 0.025, 0.002);
+	EXPECT_EQ(0u, tester.get_chain()->get_phase_cache_stats().num_phases_skipped_last_frame);
+}
+
 TEST(YCbCrTest, WikipediaRec601ForwardMatrix) {
 	YCbCrFormat ycbcr_format;
 	ycbcr_format.luma_coefficients = YCBCR_REC_601;